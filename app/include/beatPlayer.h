@@ -11,6 +11,13 @@
  * for Bass Drum, "wbeatbox-wave-files100053__menegass__gui-drum-cc.wav" for Hi-Hat, and 
  * "beatbox-wave-files/100059__menegass__gui-drum-snare-soft.wav" for Snare).
  * 
+ * The beats themselves are drum patterns loaded at startup from the text files in
+ * PATTERN_DIRECTORY (see pattern.h), in file name order: beat mode 1 is the first
+ * pattern, mode 2 the second, and so on. They are played by the sequencer (sequencer.h).
+ * 
+ * Each drum can also be played by a procedurally synthesized voice (see hal/drumSynth.h)
+ * instead of its wave file; BeatPlayer_setKit() selects which of the two kits is used.
+ * 
  * Functions provided by this module allow for control over sound playback, BPM (beats 
  * per minute), volume, and the ability to switch between different beat modes.
  * 
@@ -18,24 +25,41 @@
 
 #ifndef BEAT_HELPER_H
 #define BEAT_HELPER_H
-#include "periodTimer.h"
+#include "probes.h"
+#include "onsetDetector.h"
 #include <stdbool.h>
 
 #define BASE_DRUM_FILE "beatbox-wave-files/100051__menegass__gui-drum-bd-hard.wav"
 #define HI_HAT_FILE "beatbox-wave-files/100053__menegass__gui-drum-cc.wav"
 #define SNARE_FILE "beatbox-wave-files/100059__menegass__gui-drum-snare-soft.wav"
 #define NONE_MODE 0
-#define ROCK_MODE 1
-#define CUSTOM_MODE 2
-
-// Structure to store a single step of a beat pattern.
-// Each step can include up to three drum sounds: Hi-Hat, Bass Drum, and Snare.
-// If a value is true, that instrument will be played during that step.
-typedef struct {
-    bool playHiHat;    // True if Hi-Hat should be played
-    bool playBaseDrum; // True if Bass Drum should be played
-    bool playSnare;    // True if Snare should be played
-} Beat;
+#define MAX_PATTERNS 8
+#define SAMPLE_KIT 0
+#define SYNTH_KIT 1
+
+// Drum sounds, numbered as in the UDP "play" command
+#define BASE_DRUM_SOUND 0
+#define HI_HAT_SOUND 1
+#define SNARE_SOUND 2
+#define NUM_SOUNDS 3
+
+// What turning the rotary encoder adjusts (joystick left/right cycles through these)
+#define KNOB_BPM 0
+#define KNOB_SWING 1
+#define KNOB_HUMANIZE_TIMING 2
+#define KNOB_HUMANIZE_VELOCITY 3
+#define NUM_KNOB_TARGETS 4
+
+// How accelerometer gestures are sampled
+#define ACCEL_POLL_MODE 0       // Sample at a fixed rate on the sampler thread
+#define ACCEL_STREAM_MODE 1     // Read batches from the accelerometer's FIFO
+#define ACCEL_CLICK_MODE 2      // Let the accelerometer detect taps and wait on INT1
+#define NUM_ACCEL_MODES 3
+
+// Where tap tempo taps come from
+#define TAP_OFF 0
+#define TAP_JOYSTICK 1      // Joystick presses (instead of changing the LCD page)
+#define TAP_ACCEL 2         // Up/down knocks (instead of playing the bass drum)
 
 // Initialize/clean up the resource to play sound
 void BeatPlayer_init();
@@ -46,18 +70,85 @@ void BeatPlayer_playHiHat();
 void BeatPlayer_playBaseDrum();
 void BeatPlayer_playSnare();
 
-// Set/Get the BPM of the playing sound
+// Set/Get the BPM of the playing sound. A new BPM applies from the next step;
+// during a ramp, get returns the tempo currently being played.
 int BeatPlayer_getBpm();
 void BeatPlayer_setBPM(int newBpm);
 
+// Ramp the BPM to targetBpm over numBars bars, linearly or exponentially
+void BeatPlayer_rampBPM(int targetBpm, int numBars, bool isExponential);
+
+// Set/Get how accelerometer gestures are sampled (an ACCEL_ mode)
+int BeatPlayer_getAccelMode();
+void BeatPlayer_setAccelMode(int mode);
+
+// Start writing every accelerometer sample, with the axes the onset detector found
+// hits on, to a CSV file at path (NULL stops). Traces can be replayed through an
+// OnsetDetector_t to tune it. Returns false if the file cannot be opened.
+bool BeatPlayer_setAccelTrace(const char *path);
+
+// Get the onset detector's statistics since the accel mode last changed.
+void BeatPlayer_getOnsetStatistics(OnsetDetector_statistics_t *pStats, double *pHitsPerMinute);
+
+// Set/Get the source of tap tempo taps (a TAP_ value). The tempo estimated from the
+// taps (see tapTempo.h) is applied like BeatPlayer_setBPM().
+int BeatPlayer_getTapSource();
+void BeatPlayer_setTapSource(int source);
+
+// Set/Get the swing of the playing pattern, in percent (50 = straight, see pattern.h).
+// Like the humanize settings, it applies until the beat mode changes, from the next bar.
+int BeatPlayer_getSwing();
+void BeatPlayer_setSwing(int swingPercent);
+
+// Set/Get the humanize amount of the playing pattern: random timing in percent of a
+// step and random velocity in percent; and the seed of its random variation
+void BeatPlayer_getHumanize(int *pTimingPercent, int *pVelocityPercent);
+void BeatPlayer_setHumanize(int timingPercent, int velocityPercent);
+void BeatPlayer_setHumanizeSeed(unsigned int seed);
+
+// Set/Get what the rotary encoder adjusts (a KNOB_ value) and its display name
+int BeatPlayer_getKnobTarget();
+void BeatPlayer_setKnobTarget(int target);
+const char* BeatPlayer_getKnobTargetName(int target);
+
 // Set/Get the volumn of plaaaying sound
 int BeatPlayer_getVolume();
 void BeatPlayer_setVolume(int newVolume);
 
 // Set the playing mode of this module.
-// Mode 0 -> No music pplay, Mode 1 -> play rock beat, Mode 2 -> play custom beat
+// Mode 0 -> No music pplay, Mode n -> play the n'th loaded pattern
 int BeatPlayer_getBeatMode();
 void BeatPlayer_setBeatMode(int mode);
 
+// Number of beat modes, including NONE_MODE
+int BeatPlayer_getNumBeatModes();
+
+// Name of the pattern played in the given mode ("None" for NONE_MODE)
+const char* BeatPlayer_getBeatName(int mode);
+
+// Parse a pattern in the pattern file format (see pattern.h) and play it from the
+// next bar, until the beat mode changes. On a parse error, returns false and writes
+// the reason into errorBuff.
+bool BeatPlayer_playUploadedPattern(const char *text, char *errorBuff, int errorBuffSize);
+
+// Name of the pattern playing now (the uploaded pattern's, or the beat mode's)
+void BeatPlayer_getPlayingName(char *buff, int size);
+
+// Look up a drum sound by its pattern file name ("bass", "hihat", "snare").
+// Returns -1 if there is no such sound. May be called before BeatPlayer_init().
+int BeatPlayer_findSound(const char *name);
+
+// Set/Get the drum kit: SAMPLE_KIT plays the wave files, SYNTH_KIT the synthesized voices
+int BeatPlayer_getKit();
+void BeatPlayer_setKit(int kit);
+
+// Change one parameter (a DrumSynth_params field name, e.g. "toneDecayMs") of the
+// synthesized voice for `sound`. Returns false if the sound or parameter is unknown.
+bool BeatPlayer_tuneSynth(int sound, const char *param, float value);
+
+// Measure the cost of mixing each drum from its sample and from its synthesized voice,
+// and write a one-line summary (microseconds per audio block) into buff.
+void BeatPlayer_benchmarkKits(char *buff, int size);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+/* looper.h
+ *
+ * This module records hits played live (accelerometer gestures, UDP "play" commands)
+ * into the playing pattern, so they are repeated on every following pass ("overdub").
+ *
+ * Recording has two halves:
+ * - Looper_captureHit() is called on the trigger path of every live hit. It only
+ *   timestamps the hit against the audio clock and pushes it into a lock-free capture
+ *   buffer; it never allocates or takes a lock, and may be called from any thread.
+ * - A scheduler task, every LOOPER_PERIOD_MS, drains the capture buffer, quantizes
+ *   each hit to the recording grid and merges it into the playing pattern from the
+ *   next bar. The merge is done inside the sequencer, so edits of the pattern made
+ *   meanwhile are kept; hits played before another pattern was chosen are dropped.
+ *
+ * Each pass through the pattern that recorded at least one hit can be undone, newest
+ * first, up to LOOPER_MAX_UNDO passes back.
+ */
+
+#ifndef _LOOPER_H_
+#define _LOOPER_H_
+
+#include <stdbool.h>
+
+#define LOOPER_MAX_UNDO 8
+#define LOOPER_PERIOD_MS 10
+
+// Initialize/clean up the module. Recording starts off, with a one-step grid.
+// The scheduler must be initialized first.
+void Looper_init(void);
+void Looper_cleanup(void);
+
+// Turn recording on/off.
+void Looper_setRecording(bool isRecording);
+bool Looper_isRecording(void);
+
+// Set/Get the recording grid, in steps of the playing pattern (1 = every step).
+void Looper_setGrid(int steps);
+int Looper_getGrid(void);
+
+// Remove the hits recorded in the newest pass which has not been undone yet.
+// Takes effect at the next run of the looper task. The history only covers the
+// playing pattern: it is forgotten when another pattern is chosen.
+void Looper_undo(void);
+
+// Forget the undo history, at the next run of the looper task.
+void Looper_reset(void);
+
+// Record a live hit which the mixer starts playing at audio frame `frame`.
+// Does nothing when not recording. Returns false if the hit had to be dropped.
+bool Looper_captureHit(int sound, float gain, long long frame);
+
+// Number of hits dropped because the capture buffer was full.
+int Looper_getNumDropped(void);
+
+#endif
@@ -0,0 +1,125 @@
+/* onsetDetector.h
+ *
+ * This module detects hits (onsets) in accelerometer samples, separately on each axis.
+ *
+ * Each axis runs through a fixed-point pipeline:
+ * - a one-pole high-pass filter, which removes gravity and slow tilts;
+ * - an envelope follower (instant attack, exponential release) on the rectified signal;
+ * - an adaptive threshold: a multiple of the slowly averaged envelope (the noise floor),
+ *   never below a minimum;
+ * - a refractory period after each hit, and hysteresis: the envelope must fall below
+ *   half the threshold before the axis can trigger again.
+ *
+ * A detector is a plain struct, so one can run live on the sampler's batches and
+ * another can replay a recorded trace with the same settings. Each hit reports its
+ * detection latency: the time from the start of the envelope's rise to the sample
+ * which crossed the threshold. The statistics give the hit rate, which on a trace
+ * with no intended hits is the false-trigger rate.
+ */
+
+#ifndef _ONSET_DETECTOR_H_
+#define _ONSET_DETECTOR_H_
+
+#include <stdbool.h>
+#include "hal/accelerometer.h"
+
+#define ONSET_AXIS_X 0
+#define ONSET_AXIS_Y 1
+#define ONSET_AXIS_Z 2
+#define ONSET_NUM_AXES 3
+
+typedef struct {
+    int sampleRateHz;
+    int highPassHz;         // High-pass cutoff
+    int releaseMs;          // Envelope release time constant
+    int floorMs;            // Noise floor averaging time constant
+    int thresholdRatio;     // Threshold as a multiple of the noise floor
+    int minThresholdMg;     // Lowest threshold, in milli-g
+    int fullScaleMg;        // Envelope giving full velocity, in milli-g
+    int refractoryMs;       // Shortest time between two hits on one axis
+} OnsetDetector_config_t;
+
+#define ONSET_DEFAULT_HIGH_PASS_HZ 5
+#define ONSET_DEFAULT_RELEASE_MS 30
+#define ONSET_DEFAULT_FLOOR_MS 500
+#define ONSET_DEFAULT_THRESHOLD_RATIO 4
+#define ONSET_DEFAULT_MIN_THRESHOLD_MG 300
+#define ONSET_DEFAULT_FULL_SCALE_MG 1500
+#define ONSET_DEFAULT_REFRACTORY_MS 60
+
+typedef struct {
+    int axis;               // ONSET_AXIS_
+    float velocity;         // 0..1, from how far the envelope passed the threshold
+    long long timestampNs;  // Timestamp of the sample which crossed the threshold
+    long long latencyNs;    // From the start of the rise to timestampNs
+} OnsetDetector_hit_t;
+
+typedef struct {
+    long long numSamples;
+    long long numHits[ONSET_NUM_AXES];
+    long long firstNs;
+    long long lastNs;
+    long long totalLatencyNs;
+    long long maxLatencyNs;
+} OnsetDetector_statistics_t;
+
+typedef struct {
+    int previousInput;      // milli-g
+    int highPass;           // milli-g
+    int envelope;           // milli-g
+    int floorQ8;            // milli-g * 256
+    bool isArmed;
+    bool isRising;
+    long long riseStartNs;
+    long long lastHitNs;
+    bool hasHit;
+} OnsetDetector_axis_t;
+
+typedef struct {
+    OnsetDetector_config_t config;
+    int highPassCoefQ15;
+    int releaseCoefQ15;
+    int floorCoefQ15;
+    long long refractoryNs;
+    bool hasInput;
+    OnsetDetector_axis_t axes[ONSET_NUM_AXES];
+    OnsetDetector_statistics_t stats;
+} OnsetDetector_t;
+
+// Fill pConfig with the default settings for a sample rate.
+void OnsetDetector_getDefaultConfig(OnsetDetector_config_t *pConfig, int sampleRateHz);
+
+// Reset a detector to use pConfig, forgetting all previous samples and statistics.
+void OnsetDetector_init(OnsetDetector_t *pDetector, const OnsetDetector_config_t *pConfig);
+
+// Run one sample through the detector. Writes the hits it completes (at most one
+// per axis) into pHits and returns their number.
+int OnsetDetector_process(OnsetDetector_t *pDetector, const AccelerometerSample *pSample,
+                          OnsetDetector_hit_t pHits[ONSET_NUM_AXES]);
+
+// Hits per minute over all the samples processed so far (0 before a full second).
+double OnsetDetector_getHitsPerMinute(const OnsetDetector_t *pDetector);
+
+typedef struct {
+    OnsetDetector_statistics_t stats;   // The replaying detector's
+    double hitsPerMinute;
+    int sampleRateHz;                   // Measured from the trace's timestamps
+    long long numRecordedHits;
+    // A replayed hit matches a recorded hit on the same axis less than half the
+    // refractory period away from it
+    long long numMatched;
+    long long numMissed;                // Recorded hits with no replayed match
+    long long numExtra;                 // Replayed hits with no recorded match
+    double avgOffsetInMs;               // Replayed minus recorded time, when matched
+    double maxOffsetInMs;               // Largest offset either way
+} OnsetDetector_replay_t;
+
+// Replay a recorded trace, a CSV file of "timestamp_ns,x,y,z,hits" rows (hits being
+// a bit mask of the axes which hit, as 'accel trace' writes), through a fresh
+// detector with pConfig, at the trace's own sample rate. Fills pResult with the
+// detector's statistics and how its hits compare with the recorded ones. Returns
+// false if the file cannot be read or holds fewer than two samples.
+bool OnsetDetector_replay(const char *path, const OnsetDetector_config_t *pConfig,
+                          OnsetDetector_replay_t *pResult);
+
+#endif
@@ -0,0 +1,101 @@
+/* pattern.h
+ *
+ * This module loads drum patterns ("grooves") from text and compiles them into
+ * event timelines that the sequencer can play without any further work.
+ *
+ * Pattern text format: one directive per line (a ';' also ends a directive, so a
+ * whole pattern fits on one line). '#' starts a comment.
+ *
+ *   name Rock               Name shown on the LCD (optional)
+ *   steps 8                 Number of steps in one bar (1..PATTERN_MAX_STEPS)
+ *   resolution 2            Steps per beat (2 = eighth notes, 4 = sixteenths)
+ *   track hihat xxxxxxxx    One line per track: a sound name ("bass", "hihat", "snare")
+ *   track bass  x...x...    and one character per step: '.' or '-' is a rest, 'x' is
+ *   track snare ..x...x.    full velocity, '1'..'9' a velocity of n/9. Spaces and '|'
+ *                           in the step grid are ignored.
+ *   swing 58                Swing percentage (optional, see Pattern_groove_t)
+ *   humanize 10 20          Random timing (% of a step) and velocity (%) variation (optional)
+ *   seed 42                 Seed for the humanize variation (optional)
+ *
+ * Swing and humanize are applied when the pattern is compiled, so playback still only
+ * walks the compiled events; the same seed always gives the same variation.
+ *
+ * A compiled timeline is a flat array of (step position, sound, gain) events for one
+ * bar, sorted by position. Positions are in steps rather than frames so a timeline
+ * does not depend on the tempo: the sequencer converts them to frames as it plays.
+ */
+
+#ifndef _PATTERN_H_
+#define _PATTERN_H_
+
+#include <stdbool.h>
+
+#define PATTERN_DIRECTORY "beatbox-patterns"
+#define PATTERN_MAX_NAME 16
+#define PATTERN_MAX_TRACKS 8
+#define PATTERN_MAX_STEPS 64
+#define PATTERN_MAX_EVENTS (PATTERN_MAX_TRACKS * PATTERN_MAX_STEPS)
+#define PATTERN_MAX_VELOCITY 9
+#define PATTERN_STRAIGHT_SWING 50
+#define PATTERN_MAX_SWING 75
+#define PATTERN_MAX_HUMANIZE 50
+
+// Groove settings applied when a pattern is compiled.
+typedef struct {
+    // Share of each pair of steps given to the first step, in percent:
+    // 50 = straight, 67 = triplet shuffle, up to PATTERN_MAX_SWING.
+    int swingPercent;
+    // Maximum random timing offset of a hit, in percent of a step.
+    int humanizeTimingPercent;
+    // Maximum random change in a hit's velocity, in percent.
+    int humanizeVelocityPercent;
+    // Seed for the humanize random numbers.
+    unsigned int seed;
+} Pattern_groove_t;
+
+// A pattern as written in its text form.
+typedef struct {
+    int sound;                                   // BeatPlayer sound number
+    unsigned char velocity[PATTERN_MAX_STEPS];   // 0 = rest, else 1..PATTERN_MAX_VELOCITY
+} Pattern_track_t;
+
+typedef struct {
+    char name[PATTERN_MAX_NAME];
+    int numSteps;
+    int stepsPerBeat;
+    int numTracks;
+    Pattern_track_t tracks[PATTERN_MAX_TRACKS];
+    Pattern_groove_t groove;
+} Pattern_t;
+
+// A pattern compiled for playback.
+typedef struct {
+    float stepPos;          // Position in the bar, in steps
+    unsigned char step;     // The step it is written on, before swing and humanize
+    unsigned char sound;
+    float gain;
+} Pattern_event_t;
+
+typedef struct {
+    int numSteps;           // 0 for an empty timeline (nothing playing)
+    int stepsPerBeat;
+    int numEvents;
+    Pattern_event_t events[PATTERN_MAX_EVENTS];
+} Pattern_timeline_t;
+
+// Parse pattern text into pPattern. On failure, returns false and writes a
+// description of the problem into errorBuff.
+bool Pattern_parse(const char *text, Pattern_t *pPattern, char *errorBuff, int errorBuffSize);
+
+// Load every "*.pat" file in directory, in file name order, into patterns[].
+// Files which fail to parse are reported and skipped. Returns the number loaded.
+int Pattern_loadDirectory(const char *directory, Pattern_t *patterns, int maxPatterns);
+
+// Compile pPattern, including its groove, into pTimeline. A NULL pattern compiles
+// to an empty timeline. Does not allocate memory.
+void Pattern_compile(const Pattern_t *pPattern, Pattern_timeline_t *pTimeline);
+
+// Clamp each groove setting into its valid range.
+void Pattern_clampGroove(Pattern_groove_t *pGroove);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+// Module to register named timing probes, record them cheaply, and
+// report them all.
+//     Grown from Brian Fraser's period timer.
+// Usage:
+//  1. At init, call Probe_register() with a name and a type to get
+//     the probe's handle; keep the handle in the module that records it.
+//  2. On the hot path, record through the handle:
+//     - PROBE_PERIOD: Probe_markPeriod() on each occurrence of a
+//       periodic event (for example, each A2D sample); the time between
+//       occurrences is recorded.
+//     - PROBE_DURATION: Probe_endDuration() with Probe_beginDuration()'s
+//       return value to record how long some work took.
+//     - PROBE_COUNTER: Probe_add() to count things.
+//     - PROBE_GAUGE: Probe_setGauge() to publish the latest value of something.
+//  3. Call Probes_collect() periodically (the terminal output does, once
+//     a second) to close the window of samples for every probe.
+//  4. Read the last window's statistics for one probe, or enumerate all
+//     of them, from any thread and any number of times.
+// Periods and durations are summarized as they are recorded (running
+// totals and a histogram), so memory is fixed however many samples a
+// window holds, and recording takes no lock.
+
+#include <stdbool.h>
+
+#define PROBES_MAX 24
+#define PROBE_MAX_NAME 16
+
+typedef enum {
+    PROBE_PERIOD,
+    PROBE_DURATION,
+    PROBE_COUNTER,
+    PROBE_GAUGE,
+} Probe_type;
+
+typedef struct Probe Probe;
+
+typedef struct {
+    const char *name;
+    Probe_type type;
+    // Periods and durations, over the last window
+    int numSamples;
+    double minInMs;
+    double maxInMs;
+    double avgInMs;
+    double stdDevInMs;
+    // Percentiles, from a histogram with buckets 1/16th of a power of 2 wide
+    double p50InMs;
+    double p90InMs;
+    double p99InMs;
+    double p999InMs;
+    // Counters: the total, and its increase per second over the last window.
+    // Gauges: the latest value.
+    long long value;
+    double ratePerSecond;
+} Probe_statistics_t;
+
+// Initialize/cleanup the module's data structures. Initialize before
+// any module registers probes.
+void Probes_init(void);
+void Probes_cleanup(void);
+
+// Get the probe called name, registering it if it is new. Meant for
+// init, not the hot path. name must stay valid while the module is used.
+// Registering a name again with the same type returns the same probe.
+Probe *Probe_register(const char *name, Probe_type type);
+
+// Record on a probe. These are wait-free (no lock), so they are safe
+// in the audio path. A period probe must be marked from one thread at
+// a time; the others may be recorded from any thread.
+void Probe_markPeriod(Probe *pProbe);
+long long Probe_beginDuration(void);
+void Probe_endDuration(Probe *pProbe, long long beginNs);
+void Probe_add(Probe *pProbe, long long amount);
+void Probe_setGauge(Probe *pProbe, long long value);
+
+// Close the current window of every probe, and start the next.
+void Probes_collect(void);
+
+// Fill pStats with the probe's statistics for the last closed window.
+void Probe_getStatistics(Probe *pProbe, Probe_statistics_t *pStats);
+
+// Copy the statistics of up to maxProbes probes, in the order they
+// were registered, into pStats; returns how many.
+int Probes_getStatistics(Probe_statistics_t *pStats, int maxProbes);
+
+// Write a one line summary of a probe's statistics (no newline) into
+// buffer, like snprintf(); returns its length.
+int Probe_format(const Probe_statistics_t *pStats, char *buffer, int size);
+
+#endif
@@ -0,0 +1,66 @@
+/* scheduler.h
+ *
+ * This module is a small cooperative scheduler: one thread (the main thread, in
+ * Scheduler_run()) runs all the app's non-real-time work as tasks, instead of each
+ * feature sleeping and polling on a thread of its own.
+ *
+ * A task is a function run either
+ * - on a timer: every periodMs, from absolute deadlines kept by a timerfd, or
+ * - when a file descriptor (a socket, an eventfd) becomes readable.
+ * The thread sleeps in epoll until one of them is due. Tasks run to completion one
+ * at a time, so they must not block: a long task delays every other task.
+ *
+ * For each task the scheduler keeps how long it runs and, for timer tasks, how late
+ * after its deadline it starts and how many deadlines it missed entirely.
+ */
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <stdbool.h>
+
+#define SCHEDULER_MAX_TASKS 16
+
+typedef void (*Scheduler_taskFunction)(void *pContext);
+
+typedef struct {
+    const char *name;
+    bool isTimer;
+    long long numRuns;
+    double avgRunInMs;
+    double maxRunInMs;
+    double avgLatenessInMs;     // Timer tasks: start time after the deadline
+    double maxLatenessInMs;
+    long long numMissed;        // Timer tasks: deadlines passed while it could not run
+} Scheduler_taskStatistics_t;
+
+// Initialize/clean up the module.
+void Scheduler_init(void);
+void Scheduler_cleanup(void);
+
+// Add a task run every periodMs (first run one period from now); 0 adds it stopped,
+// to be started with Scheduler_setPeriod(). Returns a task id.
+// name must stay valid while the task exists.
+int Scheduler_addTimer(const char *name, int periodMs, Scheduler_taskFunction function, void *pContext);
+
+// Change a timer task's period, restarting it from now; 0 stops it.
+void Scheduler_setPeriod(int taskId, int periodMs);
+
+// Add a task run whenever fd is readable (it must make fd unreadable again, e.g. by
+// reading it). Returns a task id.
+int Scheduler_addFd(const char *name, int fd, Scheduler_taskFunction function, void *pContext);
+
+// Remove a task. Tasks are added and removed before Scheduler_run(), after it
+// returns, or from tasks.
+void Scheduler_remove(int taskId);
+
+// Run tasks on the calling thread until Scheduler_stop().
+void Scheduler_run(void);
+
+// Make Scheduler_run() return once the running task (if any) is done. Any thread.
+void Scheduler_stop(void);
+
+// Copy the statistics of up to maxTasks tasks into pStats; returns how many.
+int Scheduler_getStatistics(Scheduler_taskStatistics_t *pStats, int maxTasks);
+
+#endif
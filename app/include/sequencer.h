@@ -0,0 +1,90 @@
+/* sequencer.h
+ *
+ * This module plays compiled pattern timelines (see pattern.h) with sample-accurate
+ * timing, by scheduling each hit at an exact frame of the audio mixer's clock.
+ *
+ * Sequencer_setPattern(), Sequencer_setGroove(), Sequencer_setBpm() and
+ * Sequencer_rampBpm() may be called from any thread. A new pattern is compiled by the
+ * caller's thread into a spare timeline and handed to the playing thread lock-free; it
+ * takes effect at the next bar boundary. Tempo changes take effect at the first step
+ * boundary that has not been scheduled yet, so every step is played at one tempo.
+ *
+ * Sequencer_scheduleUntil() must be called periodically by a single thread (the beat
+ * thread). It walks a cursor through the active timeline and triggers every event that
+ * starts before the given horizon, so the horizon must stay far enough ahead of the
+ * mixer that each hit is queued before its block is rendered. The events of a step
+ * which is already over when it is reached (e.g. after the caller was delayed) are
+ * dropped rather than played late, and counted by AudioMixer_countDroppedSound().
+ */
+
+#ifndef _SEQUENCER_H_
+#define _SEQUENCER_H_
+
+#include "pattern.h"
+
+// Called for each event: play `sound` at `gain`, starting at output frame `frame`.
+// `expectedFrame` is where the event belongs, worked out apart from `frame`: its step
+// on the ideal grid (whole steps at the applied tempo), plus its swing and humanize
+// offset. The two only differ if the sequencer got `frame` wrong.
+typedef void (*Sequencer_triggerFn)(int sound, float gain, long long frame, long long expectedFrame);
+
+// How the tempo moves between its start and end values during a ramp.
+typedef enum {
+    SEQUENCER_RAMP_LINEAR,       // Equal BPM change every step
+    SEQUENCER_RAMP_EXPONENTIAL,  // Equal BPM ratio every step
+} Sequencer_rampShape;
+
+// Initialize/clean up the module. Playback starts stopped (empty pattern).
+void Sequencer_init(Sequencer_triggerFn trigger, int bpm);
+void Sequencer_cleanup(void);
+
+// Play pPattern from the next bar on; NULL stops playback at the end of the bar.
+void Sequencer_setPattern(const Pattern_t *pPattern);
+
+// Generation of the playing pattern: it changes with every Sequencer_setPattern(), but
+// not with groove changes or edits. Lock-free, so it may be read on a live hit's path.
+unsigned int Sequencer_getPatternGeneration(void);
+
+// Edit the playing pattern in place: edit is called on it, with the writers' lock
+// held, and returns true if it changed it; the pattern is then recompiled and played
+// from the next bar. Nothing is called, and false is returned, while stopped or once
+// the generation is no longer `generation` (another pattern was chosen meanwhile).
+// edit may call Sequencer_locateFrame(), but no other sequencer function.
+typedef bool (*Sequencer_editFn)(Pattern_t *pPattern, void *pContext);
+bool Sequencer_editPattern(unsigned int generation, Sequencer_editFn edit, void *pContext);
+
+// Change the groove (swing/humanize) of the playing pattern until the next
+// Sequencer_setPattern(); values are clamped to their valid ranges. The pattern is
+// recompiled by the caller's thread and takes effect at the next bar boundary.
+void Sequencer_setGroove(const Pattern_groove_t *pGroove);
+Pattern_groove_t Sequencer_getGroove(void);
+
+// Change the tempo at the next step boundary, cancelling any ramp.
+// Returns an id for the request (see Sequencer_getAppliedTempo()).
+unsigned int Sequencer_setBpm(int bpm);
+
+// Move the tempo from its current value to targetBpm over numBars bars of the
+// playing pattern, changing it at every step. Replaces any ramp in progress.
+// Returns an id for the request.
+unsigned int Sequencer_rampBpm(int targetBpm, int numBars, Sequencer_rampShape shape);
+
+// Id of the newest tempo request the player has applied, and the audio frame of the
+// first step played with it. A request replaced before it was applied is never
+// applied itself, so compare ids with (int)(applied - request) >= 0.
+// Must be called from the thread calling Sequencer_scheduleUntil().
+void Sequencer_getAppliedTempo(unsigned int *pRequest, long long *pFrame);
+
+// Tempo of the step being scheduled (follows ramps), rounded to a whole BPM.
+int Sequencer_getBpm(void);
+
+// Trigger every event that starts before horizonFrame. nowFrame is the current
+// position of the audio clock; steps that are already entirely in the past (e.g. after
+// the caller was delayed) are skipped rather than played late.
+void Sequencer_scheduleUntil(long long nowFrame, long long horizonFrame);
+
+// Find where a recent audio frame fell in the playing pattern: the number of the bar
+// (counting from init) and the position in that bar, in steps. Returns false if the
+// frame is older than the remembered steps. May be called from any thread.
+bool Sequencer_locateFrame(long long frame, long long *pBar, double *pStepPos);
+
+#endif
@@ -10,6 +10,9 @@
 // Calculate time difference in milliseconds
 long time_diff_ms(struct timespec *start, struct timespec *end);
 
+// Current CLOCK_MONOTONIC time in nanoseconds (the clock of GPIO event timestamps)
+long long getTimeInNs(void);
+
 // Sleep for a given number of milliseconds
 void sleepForMs(long long delayInMs);
 
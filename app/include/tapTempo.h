@@ -0,0 +1,48 @@
+/* tapTempo.h
+ *
+ * This module estimates a tempo from the times of consecutive taps (joystick presses
+ * or accelerometer knocks).
+ *
+ * The estimate uses the intervals between the last TAPTEMPO_WINDOW + 1 taps: the
+ * median interval is found, intervals more than TAPTEMPO_TOLERANCE_PERCENT away from it
+ * are rejected as outliers (a missed or doubled tap), and the rest are averaged.
+ * A pause longer than TAPTEMPO_TIMEOUT_MS starts a new sequence of taps.
+ *
+ * The module also keeps statistics of the tap-to-applied latency: from a tap to the
+ * moment the tempo estimated from it starts playing.
+ */
+
+#ifndef _TAP_TEMPO_H_
+#define _TAP_TEMPO_H_
+
+#include <stdbool.h>
+
+#define TAPTEMPO_WINDOW 8
+#define TAPTEMPO_TOLERANCE_PERCENT 20
+#define TAPTEMPO_TIMEOUT_MS 2000
+
+typedef struct {
+    double minLatencyInMs;
+    double maxLatencyInMs;
+    double avgLatencyInMs;
+    double lastLatencyInMs;
+    int numSamples;
+} TapTempo_statistics_t;
+
+// Initialize/clean up the module.
+void TapTempo_init(void);
+void TapTempo_cleanup(void);
+
+// Forget all previous taps.
+void TapTempo_reset(void);
+
+// Add a tap at timestampNs (CLOCK_MONOTONIC). Returns true, with the new estimate in
+// *pBpm, once there are enough consistent taps to estimate a tempo.
+// Taps must come from one thread at a time.
+bool TapTempo_tap(long long timestampNs, int *pBpm);
+
+// Record one tap-to-applied latency measurement, and read the statistics.
+void TapTempo_recordLatency(long long latencyNs);
+TapTempo_statistics_t TapTempo_getStatistics(void);
+
+#endif
@@ -1,26 +1,43 @@
 /* terminalOutput.h
  * This module is responsible for outputting periodic statistics to the terminal.
  * 
- * It record and printout the following information every second via a thread, including:
+ * It record and printout the following information every second via a scheduler task, including:
  * - Beat mode (as "M0", "M1", etc.)
  * - Current tempo (in format "90bpm")
  * - Current volume (in format "vol:80")
  * - Time between refilling the audio playback buffer, with statistics like minimum, maximum, average times, and the number of samples.
  * - Time between samples of the accelerometer, with similar statistics.
+ * - While tap tempo is on, the tap-to-applied latency in ms, with similar statistics.
+ * - How far from the ideal grid the sequencer's hits started in the audio output: their
+ *   error histogram, the hits dropped for being too late, and the drift of the average
+ *   error over the last BEAT_DRIFT_SECONDS seconds.
+ * - Then every registered probe (see probes.h), one per line.
+ * It also closes each second's probe window (Probes_collect()).
  * 
  * The periodic output format is as follows:
  * M0 90bpm vol:80 Audio[16.283, 16.942] avg 16.667/61 Accel[12.276, 13.965] avg 12.998/77
+ *    beat err avg 0.000 max 0.000 ms/12 hist 12/0/0/0/0 dropped 0 drift +0.000 ms/min
+ *    audio period[16.283, 16.942] avg 16.667/61 sd 0.102 p 16.640/16.768/16.896/16.896
  */
 
 #ifndef _TERMINAL_OUTPUT_H_
 #define _TERMINAL_OUTPUT_H_
-#include "periodTimer.h"
+#include "probes.h"
+#include "hal/audioMixer.h"
+
+#define BEAT_DRIFT_SECONDS 30
+
+typedef struct {
+    AudioMixer_startStatistics_t lastSecond;
+    double driftInMsPerMinute;  // Slope of the average error over BEAT_DRIFT_SECONDS
+} TerminalOutput_beatTiming_t;
 
 // Initialize/Clean up the moduule
 void TerminalOutput_init(void);
 void TerminalOutput_cleanup(void);
 
 // The helper function for other module to access the colleced stat about audioMixer and Accelerometer
-Period_statistics_t TerminalOutput_getAccelStats();
-Period_statistics_t TerminalOutput_getAudioStats();
+Probe_statistics_t TerminalOutput_getAccelStats();
+Probe_statistics_t TerminalOutput_getAudioStats();
+TerminalOutput_beatTiming_t TerminalOutput_getBeatTiming(void);
 #endif
@@ -0,0 +1,46 @@
+/* trace.h
+ *
+ * This module records spans (a named piece of work on a thread, with its begin and
+ * end times) so they can be viewed on a timeline, to see for example which thread
+ * was busy when an audio block was late.
+ *
+ * Each thread records into its own buffer, a ring of its newest TRACE_BUFFER_SPANS
+ * spans, claimed the first time it records. Recording takes no lock and never waits,
+ * so it is safe in the audio path; a full ring overwrites its oldest spans.
+ *
+ * Trace_dump() writes the spans which ended in the last few seconds as Chrome
+ * trace-event JSON: open it in chrome://tracing or https://ui.perfetto.dev.
+ * A dump is also written to TRACE_DEFAULT_FILE on SIGUSR1 (kill -USR1 <pid>).
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#define TRACE_MAX_THREADS 16
+#define TRACE_BUFFER_SPANS 4096     // Per thread; a power of 2
+#define TRACE_DEFAULT_FILE "beatbox-trace.json"
+#define TRACE_DEFAULT_SECONDS 5
+
+// Initialize/clean up the module. Initialize after the scheduler (the signal is
+// handled by a scheduler task) and before starting any thread, so that they all
+// leave SIGUSR1 to it.
+void Trace_init(void);
+void Trace_cleanup(void);
+
+// Name the calling thread (up to 15 characters), as the trace shows it. Call it
+// before the thread's first span.
+void Trace_nameThread(const char *name);
+
+// Record a span: call Trace_begin() when the work starts, and pass its return value
+// to Trace_end() when it ends. name must stay valid (a string literal).
+long long Trace_begin(void);
+void Trace_end(const char *name, long long beginNs);
+
+// Record a span which was timed already, with CLOCK_MONOTONIC times in ns.
+void Trace_record(const char *name, long long beginNs, long long endNs);
+
+// Write the spans which ended in the last numSeconds to the file at path, as Chrome
+// trace-event JSON. Returns the number of spans written, or -1 on error.
+int Trace_dump(const char *path, int numSeconds);
+
+#endif
@@ -4,15 +4,33 @@
  * - "mode <value>" to set the current beat mode.
  * - "volume <value>" to adjust the volume.
  * - "tempo <value>" to set the tempo.
+ * - "ramp <value> <bars> [lin|exp]" to ramp the tempo over a number of bars.
  * - "play <song_number>" to play a specific sound (e.g., Base Drum, Hi-Hat, Snare).
+ * - "kit <value>" to switch between sampled (0) and synthesized (1) drums.
+ * - "tune <song_number> <param> <value>" to adjust a synthesized drum.
+ * - "bench" to report the mixing cost of sampled vs synthesized drums.
+ * - "swing <percent>" and "humanize <timing> <velocity> [seed]" to change the groove.
+ * - "loop rec|stop|undo|grid <steps>" to record live hits into the playing pattern.
+ * - "tap <source>" to take tap tempo from the joystick or accelerometer, and report
+ *   the tap-to-applied latency.
+ * - "pattern <text>" to upload a whole pattern in one datagram and play it.
+ * - "accel <mode>" to sample the accelerometer by polling, from its FIFO, or by
+ *   waiting for its tap interrupt; "accel trace <file>" and "accel stats" record
+ *   samples (in the beatbox-traces directory) and report the hit detector's rate
+ *   and latency; "accel replay <file>" runs a recorded trace through a new detector.
+ * - "i2c" to report I2C latency and error statistics per device.
+ * - "sched" to report the run time and lateness of each scheduler task.
+ * - "stats" to report the last second's statistics of every probe.
+ * - "trace [seconds] [file]" to write the last seconds of trace spans as Chrome
+ *   trace-event JSON (in the beatbox-traces directory).
  * - "stop" to stop the beat player.
  * 
- * The module uses a separate thread to listen for commands and respond to the client.
- * UDP packets are received, parsed, and appropriate responses are sent back.
+ * The module runs as a scheduler task (scheduler.h), woken when a datagram arrives,
+ * and responds to the client. "stop" stops the scheduler, which ends the program.
  * 
  * Functions:
- * - UdpListener_init() : Initializes the UDP socket and starts the listener thread.
- * - UdpListener_cleanup() : Cleans up resources by joining the listener thread and closing the socket.
+ * - UdpListener_init() : Initializes the UDP socket and adds the listener task.
+ * - UdpListener_cleanup() : Cleans up resources by removing the listener task and closing the socket.
  * - UdpListener_isRunning() : Checks if the UDP listener is still running.
  */
 
@@ -23,10 +41,10 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
-// start thread to listen for UDP messages
+// add a scheduler task to listen for UDP messages
 void UdpListener_init(void);
 
-// clean up thread
+// clean up task
 void UdpListener_cleanup(void);
 
 //return stop running flag
@@ -1,13 +1,18 @@
 /* updateLcd.h
  * 
  * This module handles the LCD screen output, it start a thread and repeately display periodic statistics.
- * It has three screens:
+ * It has four screens:
  * 
  * Screen 1: Displays the current beat name, volume (bottom-left), and BPM (bottom-right).
- * Screen 2: Displays audio timing statistics, including min, max, and avg ms for buffer refills.
+ * Screen 2: Displays audio timing statistics, including min, max, avg and percentiles in ms for
+ *           buffer refills, and how late the beats started (see TerminalOutput_getBeatTiming()).
  * Screen 3: Displays accelerometer timing stats, including min, max, and avg ms between samples.
+ * Screen 4: Displays every probe (see probes.h).
  * 
  * The LCD screens can be cycled through by pressing the center button in joystick.
+ *
+ * Each frame only repaints the pieces of text which changed, and sends just the areas
+ * they cover to the LCD; a new screen is painted and sent whole.
  */
 #ifndef _UPDATELCD_H_
 #define _UPDATELCD_H_
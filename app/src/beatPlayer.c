@@ -7,93 +7,136 @@
  */
 
 #include "hal/audioMixer.h"
+#include "hal/drumSynth.h"
 #include "beatPlayer.h"
 #include <stdio.h>
 #include <assert.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <unistd.h>
-#include <periodTimer.h>
+#include <probes.h>
 #include <stdatomic.h>
 #include <hal/rotary_encoder_statemachine.h>
 #include <hal/rotary_btn_statemachine.h>
 #include <sleep_timer_helper.h>
 #include "hal/joystick.h"
 #include "hal/accelerometer.h"
+#include "hal/accelSampler.h"
 #include <math.h>
 #include "hal/gpio.h"
 #include "hal/i2c.h"
+#include "hal/inputEvents.h"
+#include "pattern.h"
+#include "sequencer.h"
+#include "looper.h"
+#include "tapTempo.h"
+#include "onsetDetector.h"
+#include "scheduler.h"
+#include <string.h>
+#include <stdlib.h>
 
 #define DEFAULT_BPM 120
 #define MIN_BPM 40
 #define MAX_BPM 300
 #define DEFAULT_DELAY_MS 10
-#define DELAY_100_MS 100
+#define VOLUME_REPEAT_MS 100    // Volume step interval while the joystick is held
+#define VOLUME_STEP 5
+#define MAX_INPUT_EVENTS 16
 
 #define DEFAULT_VOLUME 80
 #define MIN_VOLUME 0
 #define MAX_VOLUME 100
 #define BPM_PER_SPIN 5
-#define MIN_COUNTER_ROTARY_ENCODER -16
-#define MAX_COUNTER_ROTARY_ENCODER 36
-#define HALF_BEAT_RATIO ((60*1000)/2)
-#define ROCK_BEAT_STRUCT_SIZE 8
-#define CUSTOM_BEAT_STRUCT_SIZE 4
+#define PERCENT_PER_SPIN 2
+#define SCHEDULE_SLACK_FRAMES 441 // 10ms
 
-#define xy_THRESHOLD 0.6 
-#define z_THRESHOLD 0.5
-#define DEBOUNCE_TIME_MS 150
+#define BENCHMARK_BLOCKS 200
+#define NS_PER_US 1000.0
+#define NS_PER_SECOND 1000000000LL
 
-static double prev_x = 0.0, prev_y = 0.0, prev_z = 0.0;
-static struct timespec last_x_time, last_y_time, last_z_time;
+#define ACCEL_WATERMARK 8       // 20ms of samples at ACCELEROMETER_STREAM_ODR_HZ
+#define MIN_HIT_GAIN 0.3f       // Gain of the softest accelerometer hit
+#define ACCEL_NO_MODE -1        // Accelerometer not set up for any ACCEL_ mode yet
+#define NS_PER_MS 1000000LL
+#define MAX_CLICK_FAILURES 5    // Failed click waits in a row before falling back to polling
+
+static AccelSampler_reader_t accelReader;
+static pthread_mutex_t onsetLock = PTHREAD_MUTEX_INITIALIZER;
+static OnsetDetector_t onsetDetector;   // Protected by onsetLock
+static FILE *pAccelTrace = NULL;        // Protected by onsetLock
+static atomic_int accelMode = ACCEL_STREAM_MODE;
 
 static atomic_int volume = DEFAULT_VOLUME;
 static atomic_int bpm = DEFAULT_BPM;
-static atomic_int beatMode = 1; // 1 = Rock, 2 = Custom, 0 = None
+static atomic_int beatMode = 1; // 0 = None, n = patterns[n - 1]
 static bool isRunning = true;
 static pthread_t beatThread;
-static pthread_t bmpThread;
-static pthread_t volumeThread;
 static pthread_t accelThread;
-static wavedata_t hiHat;
-static wavedata_t baseDrum;
-static wavedata_t snare;
+static wavedata_t sampleSounds[NUM_SOUNDS];
+static wavedata_t synthSounds[NUM_SOUNDS];
+static DrumSynth_voice synthVoices[NUM_SOUNDS];
+static atomic_int kit = SAMPLE_KIT;
 static bool isInitialized = false;
-static atomic_int halfBeatTimeMs = 0;
-
-
-// {Hi-Hat, Base Drum, Snare}
-static Beat rockBeat[ROCK_BEAT_STRUCT_SIZE] = {
-    {true,  true,  false}, // 1   - Hi-Hat & Bass Drum
-    {true,  false, false}, // 1.5 - Hi-Hat
-    {true,  false, true }, // 2   - Hi-Hat & Snare
-    {true,  false, false}, // 2.5 - Hi-Hat
-    {true,  true,  false}, // 3   - Hi-Hat & Bass Drum
-    {true,  false, false}, // 3.5 - Hi-Hat
-    {true,  false, true }, // 4   - Hi-Hat & Snare
-    {true,  false, false}  // 4.5 - Hi-Hat
-};
-
-// {Hi-Hat, Base Drum, Snare}
-static Beat customBeat[CUSTOM_BEAT_STRUCT_SIZE] = {
-    {false, true,  false}, // 1   - Bass Drum
-    {false, false, true }, // 1.5 - Snare
-    {true,  false, false}, // 2   - Hi-Hat
-    {true,  true,  false}  // 2.5 - Hi-Hat & Bass Drum
-};
+static Pattern_t patterns[MAX_PATTERNS];
+static int numPatterns = 0;
+
+// Name of the uploaded pattern while it is playing (until the beat mode changes).
+// patternLock orders beat mode changes and uploads, so the last one requested plays.
+static atomic_bool isUploadPlaying = false;
+static char uploadName[PATTERN_MAX_NAME];
+static pthread_mutex_t patternLock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int knobTarget = KNOB_BPM;
+static atomic_int tapSource = TAP_OFF;
+
+// Input dispatch tasks (on the scheduler)
+static int inputTask = -1;
+static int volumeRepeatTask = -1;
+static JoystickDirection heldDirection = JOYSTICK_CENTER;
+
+// Newest tempo set from taps, until it is applied (for the latency measurement)
+static atomic_bool hasPendingTap = false;
+static atomic_llong pendingTapNs = 0;
+static atomic_uint pendingTapRequest = 0;
 
 static void* beatThreadFunction(void* args);
-static void* beatThreadDetectBPM(void* args);
-static void* beatThreadSetVolume(void* args);
+static void BeatPlayer_playBeatMode(int mode);
+static void BeatPlayer_dispatchInput(void *pContext);
+static void BeatPlayer_repeatVolume(void *pContext);
 static void* beatTheadeDetectAccel(void* args);
-static void BeatPlayer_playRockBeat();
-static void BeatPlayer_playCustomBeat();
-static void BeatPlayer_detectRotarySpin();
+static void BeatPlayer_onKnobTurn(int detents, int acceleratedDetents);
+static void BeatPlayer_stepKnobTarget(int direction);
+static void BeatPlayer_triggerSound(int sound, float gain, long long frame, long long expectedFrame);
+static void BeatPlayer_playLive(int sound, float gain);
+static void BeatPlayer_publishAccelHit(int axis, float velocity, long long timestampNs);
+static void BeatPlayer_onAccelHit(int axis, float velocity, long long timestampNs);
+static void BeatPlayer_onTap(long long timestampNs);
+static void BeatPlayer_measureTapLatency(long long nowFrame, long long nowNs);
+
+static char *soundFiles[NUM_SOUNDS] = {
+    [BASE_DRUM_SOUND] = BASE_DRUM_FILE,
+    [HI_HAT_SOUND] = HI_HAT_FILE,
+    [SNARE_SOUND] = SNARE_FILE,
+};
+static const DrumSynth_model synthModels[NUM_SOUNDS] = {
+    [BASE_DRUM_SOUND] = DRUMSYNTH_KICK,
+    [HI_HAT_SOUND] = DRUMSYNTH_HIHAT,
+    [SNARE_SOUND] = DRUMSYNTH_SNARE,
+};
+static const char *soundNames[NUM_SOUNDS] = {
+    [BASE_DRUM_SOUND] = "bass",
+    [HI_HAT_SOUND] = "hihat",
+    [SNARE_SOUND] = "snare",
+};
 
 void BeatPlayer_init() {
     assert(!isInitialized);
     beatMode = 1;
-    halfBeatTimeMs = (HALF_BEAT_RATIO / bpm); 
+    numPatterns = Pattern_loadDirectory(PATTERN_DIRECTORY, patterns, MAX_PATTERNS);
+    if (numPatterns == 0) {
+        fprintf(stderr, "ERROR: No drum patterns found in %s.\n", PATTERN_DIRECTORY);
+        exit(EXIT_FAILURE);
+    }
+    InputEvents_init();
     Gpio_initialize();
     Ic2_initialize();
     AudioMixer_init();
@@ -102,12 +145,19 @@ void BeatPlayer_init() {
     Joystick_initialize();
     Accelerometer_initialize();
     isInitialized = true;
-    AudioMixer_readWaveFileIntoMemory(HI_HAT_FILE, &hiHat);
-    AudioMixer_readWaveFileIntoMemory(BASE_DRUM_FILE, &baseDrum);
-    AudioMixer_readWaveFileIntoMemory(SNARE_FILE, &snare);
+    for (int i = 0; i < NUM_SOUNDS; i++) {
+        AudioMixer_readWaveFileIntoMemory(soundFiles[i], &sampleSounds[i]);
+        DrumSynth_initVoice(&synthVoices[i], synthModels[i]);
+        AudioMixer_initSynthSound(&synthVoices[i], &synthSounds[i]);
+    }
+    BtnStateMachine_setNumValues(BeatPlayer_getNumBeatModes());
+    Sequencer_init(&BeatPlayer_triggerSound, bpm);
+    Looper_init();
+    TapTempo_init();
+    BeatPlayer_playBeatMode(beatMode);
     pthread_create(&beatThread, NULL, &beatThreadFunction, NULL);
-    pthread_create(&bmpThread, NULL, &beatThreadDetectBPM, NULL);
-    pthread_create(&volumeThread, NULL, &beatThreadSetVolume, NULL);
+    inputTask = Scheduler_addFd("input", InputEvents_getFd(), &BeatPlayer_dispatchInput, NULL);
+    volumeRepeatTask = Scheduler_addTimer("volume repeat", 0, &BeatPlayer_repeatVolume, NULL);
     pthread_create(&accelThread, NULL, &beatTheadeDetectAccel, NULL);
 }
 
@@ -115,12 +165,17 @@ void BeatPlayer_cleanup() {
     assert(isInitialized);
     isRunning = false;
     pthread_join(beatThread, NULL);
-    pthread_join(bmpThread, NULL);
-    pthread_join(volumeThread, NULL);
+    Scheduler_remove(inputTask);
+    Scheduler_remove(volumeRepeatTask);
     pthread_join(accelThread, NULL);
-    AudioMixer_freeWaveFileData(&hiHat);
-    AudioMixer_freeWaveFileData(&baseDrum);
-    AudioMixer_freeWaveFileData(&snare);
+    BeatPlayer_setAccelTrace(NULL);
+    TapTempo_cleanup();
+    Looper_cleanup();
+    Sequencer_cleanup();
+    for (int i = 0; i < NUM_SOUNDS; i++) {
+        AudioMixer_freeWaveFileData(&sampleSounds[i]);
+        DrumSynth_cleanupVoice(&synthVoices[i]);
+    }
     AudioMixer_cleanup();
     RotaryEncoderStateMachine_cleanup();
     BtnStateMachine_cleanup();
@@ -128,112 +183,329 @@ void BeatPlayer_cleanup() {
     Accelerometer_cleanUp();
     Gpio_cleanup();
     Ic2_cleanUp();
+    InputEvents_cleanup();
     isInitialized = false;
 }
 
+// Keep the sequencer scheduled far enough ahead of the mixer that every hit is
+// queued before the block it starts in is rendered, even if this thread wakes late.
 static void* beatThreadFunction(void* args) {
     (void) args;
     assert(isInitialized);
+    long long lookaheadFrames = 2 * AudioMixer_getBlockFrames() + SCHEDULE_SLACK_FRAMES
+        + DEFAULT_DELAY_MS * AUDIOMIXER_SAMPLE_RATE / 1000;
     while (isRunning) {
-        beatMode = BtnStateMachine_getValue();
-        if (beatMode == ROCK_MODE) { // Rock Beat
-            BeatPlayer_playRockBeat();
-        } else if (beatMode == CUSTOM_MODE) { // Custom Beat
-            BeatPlayer_playCustomBeat();
-        } else {
-            sleepForMs(DELAY_100_MS);
-        }
+        long long now = AudioMixer_getFramePosition();
+        long long nowNs = getTimeInNs();
+        Sequencer_scheduleUntil(now, now + lookaheadFrames);
+        BeatPlayer_measureTapLatency(now, nowNs);
+        sleepForMs(DEFAULT_DELAY_MS);
     }
     return NULL;
 }
 
-static void *beatThreadDetectBPM(void *args) {
-    (void) args;
-    assert(isInitialized);
-    while (isRunning) {
-        BeatPlayer_detectRotarySpin();
-        sleepForMs(DELAY_100_MS);
+static void BeatPlayer_stepVolume(JoystickDirection direction) {
+    if (direction == JOYSTICK_UP) {
+        BeatPlayer_setVolume(volume + VOLUME_STEP);
+    } else if (direction == JOYSTICK_DOWN) {
+        BeatPlayer_setVolume(volume - VOLUME_STEP);
     }
-    return NULL;
 }
 
+// While the joystick is held up or down, the volume keeps stepping
+static void BeatPlayer_repeatVolume(void *pContext) {
+    (void) pContext;
+    BeatPlayer_stepVolume(heldDirection);
+}
 
-static void* beatThreadSetVolume(void* args) {
-    (void) args;
-    assert(isInitialized);
-    while (isRunning) {
-        JoystickDirection data = getJoystickDirection();
-        if (data == JOYSTICK_UP) {
-            int new_volume = atomic_load(&volume) + 5;
-            if (new_volume <= 100) atomic_store(&volume, new_volume);
-            BeatPlayer_setVolume(new_volume);
-        } else if (data == JOYSTICK_DOWN) {
-            int new_volume = atomic_load(&volume) - 5;
-            if (new_volume >= 0) atomic_store(&volume, new_volume);
-            BeatPlayer_setVolume(new_volume);
+static void BeatPlayer_onJoystickMove(JoystickDirection direction) {
+    // Left/right pick what the rotary encoder adjusts, once per push
+    if (direction == JOYSTICK_LEFT) {
+        BeatPlayer_stepKnobTarget(-1);
+    } else if (direction == JOYSTICK_RIGHT) {
+        BeatPlayer_stepKnobTarget(1);
+    }
+    BeatPlayer_stepVolume(direction);
+    heldDirection = direction;
+    bool isHeld = direction == JOYSTICK_UP || direction == JOYSTICK_DOWN;
+    Scheduler_setPeriod(volumeRepeatTask, isHeld ? VOLUME_REPEAT_MS : 0);
+}
+
+static void BeatPlayer_onInput(const InputEvent *pEvent) {
+    switch (pEvent->type) {
+        case INPUT_EVENT_ENCODER:
+            BeatPlayer_onKnobTurn(pEvent->encoder.detents, pEvent->encoder.acceleratedDetents);
+            break;
+        case INPUT_EVENT_ENCODER_BUTTON:
+            BeatPlayer_playBeatMode(pEvent->button.value);
+            break;
+        case INPUT_EVENT_JOYSTICK_BUTTON:
+            if (tapSource == TAP_JOYSTICK) {
+                BeatPlayer_onTap(pEvent->timestampNs);
+            } else {
+                Joystick_nextPage();
+            }
+            break;
+        case INPUT_EVENT_JOYSTICK_MOVE:
+            BeatPlayer_onJoystickMove(pEvent->joystick.direction);
+            break;
+        case INPUT_EVENT_ACCEL_HIT:
+            BeatPlayer_onAccelHit(pEvent->accelHit.axis, pEvent->accelHit.velocity, pEvent->timestampNs);
+            break;
+    }
+}
+
+// Scheduler task: act on the inputs published since the last run, as soon as they
+// are published.
+static void BeatPlayer_dispatchInput(void *pContext) {
+    (void) pContext;
+    InputEvent events[MAX_INPUT_EVENTS];
+    int count = InputEvents_take(events, MAX_INPUT_EVENTS);
+    for (int i = 0; i < count; i++) {
+        BeatPlayer_onInput(&events[i]);
+    }
+}
+
+// Run a batch of samples through the onset detector and play the hits it finds.
+// With a trace open, each sample is also written to it with the axes which hit.
+static void BeatPlayer_detectAccelHits(const AccelerometerSample *pSamples, int count) {
+    pthread_mutex_lock(&onsetLock);
+    {
+        for (int i = 0; i < count; i++) {
+            OnsetDetector_hit_t hits[ONSET_NUM_AXES];
+            int numHits = OnsetDetector_process(&onsetDetector, &pSamples[i], hits);
+            int axes = 0;
+            for (int j = 0; j < numHits; j++) {
+                BeatPlayer_publishAccelHit(hits[j].axis, hits[j].velocity, hits[j].timestampNs);
+                axes |= 1 << hits[j].axis;
+            }
+            if (pAccelTrace) {
+                fprintf(pAccelTrace, "%lld,%.4f,%.4f,%.4f,%d\n", pSamples[i].timestampNs,
+                    pSamples[i].data.x, pSamples[i].data.y, pSamples[i].data.z, axes);
+            }
         }
-        sleepForMs(DELAY_100_MS);
     }
-    return NULL;
+    pthread_mutex_unlock(&onsetLock);
+}
+
+// Hand a hit on an axis (an ONSET_AXIS_) to the input dispatcher.
+static void BeatPlayer_publishAccelHit(int axis, float velocity, long long timestampNs) {
+    InputEvent event = {
+        .type = INPUT_EVENT_ACCEL_HIT,
+        .timestampNs = timestampNs,
+        .accelHit = {.axis = axis, .velocity = velocity},
+    };
+    InputEvents_publish(&event);
+}
+
+// Play the sound of the axis which saw a hit (an ONSET_AXIS_).
+static void BeatPlayer_onAccelHit(int axis, float velocity, long long timestampNs) {
+    float gain = MIN_HIT_GAIN + (1.0f - MIN_HIT_GAIN) * velocity;
+    if (axis == ONSET_AXIS_X) {
+        BeatPlayer_playLive(HI_HAT_SOUND, gain);
+    } else if (axis == ONSET_AXIS_Y) {
+        BeatPlayer_playLive(SNARE_SOUND, gain);
+    } else if (tapSource == TAP_ACCEL) {
+        BeatPlayer_onTap(timestampNs);
+    } else {
+        BeatPlayer_playLive(BASE_DRUM_SOUND, gain);
+    }
+}
+
+// Start the onset detector over for samples arriving at sampleRateHz.
+static void BeatPlayer_resetOnsetDetector(int sampleRateHz) {
+    OnsetDetector_config_t config;
+    OnsetDetector_getDefaultConfig(&config, sampleRateHz);
+    pthread_mutex_lock(&onsetLock);
+    {
+        OnsetDetector_init(&onsetDetector, &config);
+    }
+    pthread_mutex_unlock(&onsetLock);
+}
+
+// Switch the accelerometer from sampling mode `from` to `to`.
+static void BeatPlayer_switchAccelMode(int from, int to) {
+    if (from == ACCEL_POLL_MODE) {
+        AccelSampler_stop();
+    } else if (from == ACCEL_STREAM_MODE) {
+        Accelerometer_setStreaming(false, 0);
+    } else if (from == ACCEL_CLICK_MODE) {
+        Accelerometer_setClickDetection(false);
+    }
+    if (to == ACCEL_POLL_MODE) {
+        BeatPlayer_resetOnsetDetector(ACCELSAMPLER_DEFAULT_ODR_HZ);
+        AccelSampler_start(ACCELSAMPLER_DEFAULT_ODR_HZ);
+        AccelSampler_initReader(&accelReader);
+    } else if (to == ACCEL_STREAM_MODE) {
+        BeatPlayer_resetOnsetDetector(ACCELEROMETER_STREAM_ODR_HZ);
+        Accelerometer_setStreaming(true, ACCEL_WATERMARK);
+    } else if (to == ACCEL_CLICK_MODE) {
+        Accelerometer_setClickDetection(true);
+    }
 }
 
 static void* beatTheadeDetectAccel(void* args) {
     (void) args;
     assert(isInitialized);
-    clock_gettime(CLOCK_MONOTONIC, &last_x_time);
-    clock_gettime(CLOCK_MONOTONIC, &last_y_time);
-    clock_gettime(CLOCK_MONOTONIC, &last_z_time);
 
+    int activeMode = ACCEL_NO_MODE;
+    int numClickFailures = 0;
     while (isRunning) {
-        AccelerometerData data = Accelerometer_getReading();
-
-        double dx = fabs(data.x - prev_x);
-        double dy = fabs(data.y - prev_y);
-        double dz = fabs(data.z - prev_z);
+        int mode = accelMode;
+        if (mode != activeMode) {
+            BeatPlayer_switchAccelMode(activeMode, mode);
+            activeMode = mode;
+        }
 
-        struct timespec now;
-        clock_gettime(CLOCK_MONOTONIC, &now);
-        if (dx > xy_THRESHOLD  && time_diff_ms(&last_x_time, &now) > DEBOUNCE_TIME_MS) {
-            BeatPlayer_playHiHat();
-            last_x_time = now;
+        if (activeMode == ACCEL_CLICK_MODE) {
+            // Sleeps until the accelerometer reports a tap (or for at most 1s)
+            AccelerometerClick click;
+            int result = Accelerometer_waitForClick(&click);
+            if (result == 1) {
+                // The chip's click engine has its own threshold and latency
+                int axis = (click.axes & ACCELEROMETER_CLICK_Z) ? ONSET_AXIS_Z
+                         : (click.axes & ACCELEROMETER_CLICK_Y) ? ONSET_AXIS_Y : ONSET_AXIS_X;
+                BeatPlayer_publishAccelHit(axis, 1.0f, click.timestampNs);
+            }
+            if (result >= 0) {
+                numClickFailures = 0;
+            } else if (++numClickFailures < MAX_CLICK_FAILURES) {
+                sleepForMs(DEFAULT_DELAY_MS);
+            } else {
+                fprintf(stderr, "ERROR: Accelerometer click events keep failing; polling instead\n");
+                numClickFailures = 0;
+                accelMode = ACCEL_POLL_MODE;
+            }
+        } else if (activeMode == ACCEL_STREAM_MODE) {
+            AccelerometerBatch batch;
+            int count = Accelerometer_readBatch(&batch);
+            BeatPlayer_detectAccelHits(batch.samples, count);
+        } else {
+            // The sampler thread keeps the period; catch up on what it has taken
+            AccelerometerSample samples[ACCELSAMPLER_RING_SIZE];
+            int count = AccelSampler_read(&accelReader, samples, ACCELSAMPLER_RING_SIZE);
+            BeatPlayer_detectAccelHits(samples, count);
+            sleepForMs(DEFAULT_DELAY_MS);
         }
-        if (dy > xy_THRESHOLD  && time_diff_ms(&last_y_time, &now) > DEBOUNCE_TIME_MS) {
-            BeatPlayer_playSnare();
-            last_y_time = now;
+    }
+    BeatPlayer_switchAccelMode(activeMode, ACCEL_NO_MODE);
+    return NULL;
+}
+
+int BeatPlayer_getAccelMode() {
+    assert(isInitialized);
+    return accelMode;
+}
+
+void BeatPlayer_setAccelMode(int mode) {
+    assert(isInitialized);
+    accelMode = (mode >= ACCEL_POLL_MODE && mode < NUM_ACCEL_MODES) ? mode : ACCEL_POLL_MODE;
+}
+
+bool BeatPlayer_setAccelTrace(const char *path) {
+    assert(isInitialized);
+    FILE *pFile = NULL;
+    if (path) {
+        pFile = fopen(path, "w");
+        if (!pFile) {
+            return false;
         }
-        if (dz > z_THRESHOLD && time_diff_ms(&last_z_time, &now) > DEBOUNCE_TIME_MS) {
-            BeatPlayer_playBaseDrum();
-            last_z_time = now;
+        fprintf(pFile, "timestamp_ns,x,y,z,hits\n");
+    }
+    pthread_mutex_lock(&onsetLock);
+    {
+        if (pAccelTrace) {
+            fclose(pAccelTrace);
         }
+        pAccelTrace = pFile;
+    }
+    pthread_mutex_unlock(&onsetLock);
+    return true;
+}
 
-        prev_x = data.x;
-        prev_y = data.y;
-        prev_z = data.z;
-       
-       sleepForMs(DEFAULT_DELAY_MS);
+void BeatPlayer_getOnsetStatistics(OnsetDetector_statistics_t *pStats, double *pHitsPerMinute) {
+    assert(isInitialized);
+    pthread_mutex_lock(&onsetLock);
+    {
+        *pStats = onsetDetector.stats;
+        *pHitsPerMinute = OnsetDetector_getHitsPerMinute(&onsetDetector);
     }
-    return NULL;
+    pthread_mutex_unlock(&onsetLock);
+}
+
+
+static wavedata_t* BeatPlayer_getSound(int sound) {
+    return kit == SYNTH_KIT ? &synthSounds[sound] : &sampleSounds[sound];
+}
+
+static void BeatPlayer_triggerSound(int sound, float gain, long long frame, long long expectedFrame) {
+    AudioMixer_queueTimedSound(BeatPlayer_getSound(sound), gain, frame, expectedFrame);
+}
+
+int BeatPlayer_findSound(const char *name) {
+    for (int i = 0; i < NUM_SOUNDS; i++) {
+        if (strcmp(name, soundNames[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
 }
 
+// Play a hit right away, and hand it to the looper in case it is recording.
+static void BeatPlayer_playLive(int sound, float gain) {
+    long long frame = AudioMixer_getFramePosition();
+    AudioMixer_queueSoundAt(BeatPlayer_getSound(sound), gain, 0);
+    Looper_captureHit(sound, gain, frame);
+}
 
 void BeatPlayer_playHiHat() {
     assert(isInitialized);
-    AudioMixer_queueSound(&hiHat);
+    BeatPlayer_playLive(HI_HAT_SOUND, 1.0f);
 }
 
 void BeatPlayer_playBaseDrum() {
     assert(isInitialized);
-    AudioMixer_queueSound(&baseDrum);
+    BeatPlayer_playLive(BASE_DRUM_SOUND, 1.0f);
 }
 
 void BeatPlayer_playSnare() {
     assert(isInitialized);
-    AudioMixer_queueSound(&snare);
+    BeatPlayer_playLive(SNARE_SOUND, 1.0f);
+}
+
+int BeatPlayer_getKit() {
+    assert(isInitialized);
+    return kit;
+}
+
+void BeatPlayer_setKit(int newKit) {
+    assert(isInitialized);
+    kit = (newKit == SYNTH_KIT) ? SYNTH_KIT : SAMPLE_KIT;
+}
+
+bool BeatPlayer_tuneSynth(int sound, const char *param, float value) {
+    assert(isInitialized);
+    if (sound < 0 || sound >= NUM_SOUNDS) {
+        return false;
+    }
+    return DrumSynth_setParamByName(&synthVoices[sound], param, value);
+}
+
+void BeatPlayer_benchmarkKits(char *buff, int size) {
+    assert(isInitialized);
+    int used = 0;
+    buff[0] = '\0';
+    for (int i = 0; i < NUM_SOUNDS && used < size; i++) {
+        long long sampleNs = AudioMixer_benchmarkSound(&sampleSounds[i], BENCHMARK_BLOCKS);
+        long long synthNs = AudioMixer_benchmarkSound(&synthSounds[i], BENCHMARK_BLOCKS);
+        used += snprintf(buff + used, size - used, "%s%s sample %.1fus synth %.1fus",
+            i == 0 ? "" : ", ", soundNames[i], sampleNs / NS_PER_US, synthNs / NS_PER_US);
+    }
 }
 
 int BeatPlayer_getBpm() {
     assert(isInitialized);
-    return bpm;
+    return Sequencer_getBpm();
 }
 
 int BeatPlayer_getVolume() {
@@ -254,8 +526,23 @@ void BeatPlayer_setVolume(int newVolume) {
 
 void BeatPlayer_setBeatMode(int mode) {
     assert(isInitialized);
+    if (mode < NONE_MODE || mode > numPatterns) {
+        mode = NONE_MODE;
+    }
     BtnStateMachine_setValue(mode);
-    beatMode = mode;
+    BeatPlayer_playBeatMode(mode);
+}
+
+// Switch to a loaded pattern (or to none), replacing any uploaded one.
+static void BeatPlayer_playBeatMode(int mode) {
+    pthread_mutex_lock(&patternLock);
+    {
+        beatMode = mode;
+        Sequencer_setPattern(mode == NONE_MODE ? NULL : &patterns[mode - 1]);
+        isUploadPlaying = false;
+        Looper_reset();
+    }
+    pthread_mutex_unlock(&patternLock);
 }
 
 int BeatPlayer_getBeatMode() {
@@ -263,76 +550,202 @@ int BeatPlayer_getBeatMode() {
     return beatMode;
 }
 
-static void BeatPlayer_detectRotarySpin() {
+int BeatPlayer_getNumBeatModes() {
     assert(isInitialized);
-    int rotaryEncouderCounter = RotaryEncoderStateMachine_getValue();
-    int new_bpm = DEFAULT_BPM + rotaryEncouderCounter * BPM_PER_SPIN;
-    if (new_bpm < MIN_BPM) {
-        bpm = MIN_BPM;
-        RotaryEncoderStateMachine_setValue(MIN_COUNTER_ROTARY_ENCODER);
-    } else if (new_bpm > MAX_BPM) {
-        bpm = MAX_BPM;
-        RotaryEncoderStateMachine_setValue(MAX_COUNTER_ROTARY_ENCODER);
-    } else {
-        bpm = new_bpm;
+    return numPatterns + 1;
+}
+
+bool BeatPlayer_playUploadedPattern(const char *text, char *errorBuff, int errorBuffSize) {
+    assert(isInitialized);
+    Pattern_t pattern;
+    if (!Pattern_parse(text, &pattern, errorBuff, errorBuffSize)) {
+        return false;
+    }
+    pthread_mutex_lock(&patternLock);
+    {
+        snprintf(uploadName, sizeof(uploadName), "%s", pattern.name);
+        // Compiled here, in the caller's thread; the sequencer swaps it in at the next bar
+        Sequencer_setPattern(&pattern);
+        isUploadPlaying = true;
+        Looper_reset();
     }
-    halfBeatTimeMs = (HALF_BEAT_RATIO / bpm);
+    pthread_mutex_unlock(&patternLock);
+    return true;
 }
 
-void BeatPlayer_setBPM(int newBpm) {
+void BeatPlayer_getPlayingName(char *buff, int size) {
     assert(isInitialized);
-    if (newBpm < MIN_BPM) {
-        newBpm = MIN_BPM;
-    } else if (newBpm > MAX_BPM) {
-        newBpm = MAX_BPM;
+    if (!isUploadPlaying) {
+        snprintf(buff, size, "%s", BeatPlayer_getBeatName(beatMode));
+        return;
     }
-    bpm = newBpm;
-    halfBeatTimeMs = (HALF_BEAT_RATIO / bpm);
-    RotaryEncoderStateMachine_setValue((bpm - DEFAULT_BPM) / BPM_PER_SPIN);
+    pthread_mutex_lock(&patternLock);
+    {
+        snprintf(buff, size, "%s", uploadName);
+    }
+    pthread_mutex_unlock(&patternLock);
 }
 
-static void BeatPlayer_playRockBeat() {
+const char* BeatPlayer_getBeatName(int mode) {
     assert(isInitialized);
-    for (int i = 0; i < ROCK_BEAT_STRUCT_SIZE; i++) {
-        // Play Hi-Hat if specified
-        if (rockBeat[i].playHiHat) {
-            BeatPlayer_playHiHat();
-        }
+    if (mode <= NONE_MODE || mode > numPatterns) {
+        return "None";
+    }
+    return patterns[mode - 1].name;
+}
 
-        // Play Bass Drum if specified
-        if (rockBeat[i].playBaseDrum) {
-            BeatPlayer_playBaseDrum();
-        }
+// Apply a turn of the rotary encoder to the knob's target.
+static void BeatPlayer_onKnobTurn(int spins, int acceleratedSpins) {
+    assert(isInitialized);
+    Pattern_groove_t groove = Sequencer_getGroove();
+    switch (knobTarget) {
+        case KNOB_BPM:
+            // The tempo follows spin speed, so a fast spin covers the BPM range
+            BeatPlayer_setBPM(bpm + acceleratedSpins * BPM_PER_SPIN);
+            break;
+        case KNOB_SWING:
+            BeatPlayer_setSwing(groove.swingPercent + spins * PERCENT_PER_SPIN);
+            break;
+        case KNOB_HUMANIZE_TIMING:
+            BeatPlayer_setHumanize(groove.humanizeTimingPercent + spins * PERCENT_PER_SPIN,
+                groove.humanizeVelocityPercent);
+            break;
+        case KNOB_HUMANIZE_VELOCITY:
+            BeatPlayer_setHumanize(groove.humanizeTimingPercent,
+                groove.humanizeVelocityPercent + spins * PERCENT_PER_SPIN);
+            break;
+    }
+}
 
-        // Play Snare if specified
-        if (rockBeat[i].playSnare) {
-            BeatPlayer_playSnare();
-        }
+static void BeatPlayer_stepKnobTarget(int direction) {
+    knobTarget = (knobTarget + direction + NUM_KNOB_TARGETS) % NUM_KNOB_TARGETS;
+}
+
+int BeatPlayer_getKnobTarget() {
+    assert(isInitialized);
+    return knobTarget;
+}
+
+void BeatPlayer_setKnobTarget(int target) {
+    assert(isInitialized);
+    if (target >= 0 && target < NUM_KNOB_TARGETS) {
+        knobTarget = target;
+    }
+}
 
-        // Sleep for the calculated half-beat time
-        sleepForMs(halfBeatTimeMs);
+const char* BeatPlayer_getKnobTargetName(int target) {
+    static const char *names[NUM_KNOB_TARGETS] = {
+        [KNOB_BPM] = "BPM",
+        [KNOB_SWING] = "Swing",
+        [KNOB_HUMANIZE_TIMING] = "Hum.T",
+        [KNOB_HUMANIZE_VELOCITY] = "Hum.V",
+    };
+    if (target < 0 || target >= NUM_KNOB_TARGETS) {
+        return "None";
     }
+    return names[target];
 }
 
-static void BeatPlayer_playCustomBeat() {
+// Feed a tap to the tap tempo estimator, and apply its estimate.
+static void BeatPlayer_onTap(long long timestampNs) {
+    int tappedBpm;
+    if (!TapTempo_tap(timestampNs, &tappedBpm)) {
+        return;
+    }
+    if (tappedBpm < MIN_BPM) {
+        tappedBpm = MIN_BPM;
+    } else if (tappedBpm > MAX_BPM) {
+        tappedBpm = MAX_BPM;
+    }
+    bpm = tappedBpm;
+    pendingTapNs = timestampNs;
+    pendingTapRequest = Sequencer_setBpm(bpm);
+    hasPendingTap = true;
+}
+
+// Once the newest tapped tempo has been applied, record how long after its tap the
+// first step at that tempo starts (at the mixer; the playback buffer adds a constant).
+static void BeatPlayer_measureTapLatency(long long nowFrame, long long nowNs) {
+    if (!hasPendingTap) {
+        return;
+    }
+    unsigned int appliedRequest;
+    long long appliedFrame;
+    Sequencer_getAppliedTempo(&appliedRequest, &appliedFrame);
+    if ((int)(appliedRequest - pendingTapRequest) < 0) {
+        return;
+    }
+    hasPendingTap = false;
+    long long appliedNs = nowNs + (appliedFrame - nowFrame) * NS_PER_SECOND / AUDIOMIXER_SAMPLE_RATE;
+    TapTempo_recordLatency(appliedNs - pendingTapNs);
+}
+
+int BeatPlayer_getTapSource() {
     assert(isInitialized);
-    for (int i = 0; i < CUSTOM_BEAT_STRUCT_SIZE; i++) {
-        // Play Hi-Hat if specified
-        if (customBeat[i].playHiHat) {
-            BeatPlayer_playHiHat();
-        }
+    return tapSource;
+}
 
-        // Play Bass Drum if specified
-        if (customBeat[i].playBaseDrum) {
-            BeatPlayer_playBaseDrum();
-        }
+void BeatPlayer_setTapSource(int source) {
+    assert(isInitialized);
+    if (source != TAP_JOYSTICK && source != TAP_ACCEL) {
+        source = TAP_OFF;
+    }
+    tapSource = source;
+    TapTempo_reset();
+}
 
-        // Play Snare if specified
-        if (customBeat[i].playSnare) {
-            BeatPlayer_playSnare();
-        }
+int BeatPlayer_getSwing() {
+    assert(isInitialized);
+    return Sequencer_getGroove().swingPercent;
+}
 
-        // Sleep for the calculated half-beat time
-        sleepForMs(halfBeatTimeMs);
+void BeatPlayer_setSwing(int swingPercent) {
+    assert(isInitialized);
+    Pattern_groove_t groove = Sequencer_getGroove();
+    groove.swingPercent = swingPercent;
+    Sequencer_setGroove(&groove);
+}
+
+void BeatPlayer_getHumanize(int *pTimingPercent, int *pVelocityPercent) {
+    assert(isInitialized);
+    Pattern_groove_t groove = Sequencer_getGroove();
+    *pTimingPercent = groove.humanizeTimingPercent;
+    *pVelocityPercent = groove.humanizeVelocityPercent;
+}
+
+void BeatPlayer_setHumanize(int timingPercent, int velocityPercent) {
+    assert(isInitialized);
+    Pattern_groove_t groove = Sequencer_getGroove();
+    groove.humanizeTimingPercent = timingPercent;
+    groove.humanizeVelocityPercent = velocityPercent;
+    Sequencer_setGroove(&groove);
+}
+
+void BeatPlayer_setHumanizeSeed(unsigned int seed) {
+    assert(isInitialized);
+    Pattern_groove_t groove = Sequencer_getGroove();
+    groove.seed = seed;
+    Sequencer_setGroove(&groove);
+}
+
+void BeatPlayer_setBPM(int newBpm) {
+    assert(isInitialized);
+    if (newBpm < MIN_BPM) {
+        newBpm = MIN_BPM;
+    } else if (newBpm > MAX_BPM) {
+        newBpm = MAX_BPM;
     }
-}
\ No newline at end of file
+    bpm = newBpm;
+    Sequencer_setBpm(bpm);
+}
+
+void BeatPlayer_rampBPM(int targetBpm, int numBars, bool isExponential) {
+    assert(isInitialized);
+    if (targetBpm < MIN_BPM) {
+        targetBpm = MIN_BPM;
+    } else if (targetBpm > MAX_BPM) {
+        targetBpm = MAX_BPM;
+    }
+    bpm = targetBpm;
+    Sequencer_rampBpm(bpm, numBars, isExponential ? SEQUENCER_RAMP_EXPONENTIAL : SEQUENCER_RAMP_LINEAR);
+}
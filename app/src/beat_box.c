@@ -13,23 +13,31 @@
 #include "terminalOutput.h"
 #include "udp_listener.h"
 #include "sleep_timer_helper.h"
+#include "scheduler.h"
+#include "trace.h"
 #include <stdio.h>
 #include <unistd.h>
 
 
 int main(void)
 {
-    Period_init();
+    Probes_init();
+    Scheduler_init();
+    Trace_init();
     BeatPlayer_init();
     TerminalOutput_init();
     Lcd_init();
     UdpListener_init();
 
-    // UDP clean up will block until UDP server stop
+    // Run the input, terminal and UDP tasks until the UDP "stop" command
+    Scheduler_run();
+
     UdpListener_cleanup();
     Lcd_cleanup();
     TerminalOutput_cleanup();
     BeatPlayer_cleanup();
-    Period_cleanup();
+    Trace_cleanup();
+    Scheduler_cleanup();
+    Probes_cleanup();
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,330 @@
+/* looper.c
+ *
+ * This file implements the live looper declared in looper.h.
+ *
+ * The capture buffer is a bounded multi-producer, single-consumer queue: each slot
+ * carries a sequence number saying whether it is free for the producer claiming that
+ * position or holds a hit for the consumer. Producers claim positions with a
+ * compare-and-swap, so capturing a hit never blocks.
+ *
+ * Everything else (the undo history and the current pass) is only touched by the
+ * looper task, on the scheduler thread. Each hit carries the sequencer's pattern
+ * generation from when it was captured; hits are merged by Sequencer_editPattern(),
+ * which refuses them once another pattern has been chosen. The undo history belongs
+ * to one generation too, and is forgotten when the pattern changes.
+ */
+
+#include "looper.h"
+#include "sequencer.h"
+#include "pattern.h"
+#include "scheduler.h"
+#include <assert.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#define CAPTURE_SIZE 64             // Must be a power of 2
+#define CAPTURE_MASK (CAPTURE_SIZE - 1)
+#define DEFAULT_GRID 1
+#define NO_PASS -1
+
+typedef struct {
+    int sound;
+    float gain;
+    long long frame;
+    unsigned int generation;    // Of the pattern playing when the hit was captured
+} Looper_hit_t;
+
+// Consecutive hits of one generation, merged with a single pattern edit
+typedef struct {
+    const Looper_hit_t *pHits;
+    int numHits;
+} HitBatch_t;
+
+typedef struct {
+    atomic_uint sequence;
+    Looper_hit_t hit;
+} CaptureSlot_t;
+
+static bool isInitialized = false;
+static atomic_bool isRecording = false;
+static atomic_int grid = DEFAULT_GRID;
+static atomic_int numDropped = 0;
+static atomic_int undoRequests = 0;
+static atomic_bool isResetRequested = false;
+static int looperTask = -1;
+
+// Capture buffer
+static CaptureSlot_t slots[CAPTURE_SIZE];
+static atomic_uint enqueuePos = 0;
+static unsigned int dequeuePos = 0;         // Owned by the consumer
+
+// Consumer state
+static long long currentPass = NO_PASS;
+static Pattern_t undoHistory[LOOPER_MAX_UNDO];
+static int numUndo = 0;
+static int nextUndo = 0;
+static unsigned int undoGeneration = 0;     // Of the pattern the history was saved from
+
+static void processTask(void *pContext);
+static bool takeHit(Looper_hit_t *pHit);
+static bool mergeHits(Pattern_t *pPattern, void *pContext);
+static bool mergeHit(Pattern_t *pPattern, const Looper_hit_t *pHit);
+static bool restorePattern(Pattern_t *pPattern, void *pContext);
+static void applyUndo(void);
+static void clearHistory(void);
+
+void Looper_init(void)
+{
+    assert(!isInitialized);
+    for (unsigned int i = 0; i < CAPTURE_SIZE; i++) {
+        atomic_init(&slots[i].sequence, i);
+    }
+    enqueuePos = 0;
+    dequeuePos = 0;
+    isRecording = false;
+    grid = DEFAULT_GRID;
+    numDropped = 0;
+    undoRequests = 0;
+    currentPass = NO_PASS;
+    numUndo = 0;
+    nextUndo = 0;
+    isInitialized = true;
+    looperTask = Scheduler_addTimer("looper", LOOPER_PERIOD_MS, &processTask, NULL);
+}
+
+void Looper_cleanup(void)
+{
+    assert(isInitialized);
+    Scheduler_remove(looperTask);
+    isInitialized = false;
+}
+
+void Looper_setRecording(bool recording)
+{
+    assert(isInitialized);
+    isRecording = recording;
+}
+
+bool Looper_isRecording(void)
+{
+    assert(isInitialized);
+    return isRecording;
+}
+
+void Looper_setGrid(int steps)
+{
+    assert(isInitialized);
+    grid = (steps < 1) ? 1 : (steps > PATTERN_MAX_STEPS ? PATTERN_MAX_STEPS : steps);
+}
+
+int Looper_getGrid(void)
+{
+    assert(isInitialized);
+    return grid;
+}
+
+void Looper_undo(void)
+{
+    assert(isInitialized);
+    atomic_fetch_add(&undoRequests, 1);
+}
+
+void Looper_reset(void)
+{
+    assert(isInitialized);
+    isResetRequested = true;
+}
+
+int Looper_getNumDropped(void)
+{
+    assert(isInitialized);
+    return numDropped;
+}
+
+bool Looper_captureHit(int sound, float gain, long long frame)
+{
+    assert(isInitialized);
+    if (!atomic_load_explicit(&isRecording, memory_order_relaxed)) {
+        return true;
+    }
+
+    unsigned int pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+    CaptureSlot_t *pSlot;
+    while (true) {
+        pSlot = &slots[pos & CAPTURE_MASK];
+        unsigned int sequence = atomic_load_explicit(&pSlot->sequence, memory_order_acquire);
+        int difference = (int)(sequence - pos);
+        if (difference == 0) {
+            // Slot is free for this position: try to claim it
+            if (atomic_compare_exchange_weak_explicit(&enqueuePos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // The consumer has not freed this slot yet: buffer is full
+            atomic_fetch_add_explicit(&numDropped, 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+        }
+    }
+    pSlot->hit.sound = sound;
+    pSlot->hit.gain = gain;
+    pSlot->hit.frame = frame;
+    pSlot->hit.generation = Sequencer_getPatternGeneration();
+    atomic_store_explicit(&pSlot->sequence, pos + 1, memory_order_release);
+    return true;
+}
+
+// Take the oldest captured hit, if any.
+static bool takeHit(Looper_hit_t *pHit)
+{
+    CaptureSlot_t *pSlot = &slots[dequeuePos & CAPTURE_MASK];
+    unsigned int sequence = atomic_load_explicit(&pSlot->sequence, memory_order_acquire);
+    if ((int)(sequence - (dequeuePos + 1)) < 0) {
+        return false;
+    }
+    *pHit = pSlot->hit;
+    atomic_store_explicit(&pSlot->sequence, dequeuePos + CAPTURE_SIZE, memory_order_release);
+    dequeuePos++;
+    return true;
+}
+
+// Merge captured hits into the playing pattern and apply undo requests.
+static void processTask(void *pContext)
+{
+    (void)pContext;
+    if (atomic_exchange(&isResetRequested, false)) {
+        clearHistory();
+    }
+    if (atomic_load(&undoRequests) > 0) {
+        applyUndo();
+    }
+
+    Looper_hit_t hits[CAPTURE_SIZE];
+    int numHits = 0;
+    while (numHits < CAPTURE_SIZE && takeHit(&hits[numHits])) {
+        numHits++;
+    }
+    int first = 0;
+    while (first < numHits) {
+        int end = first + 1;
+        while (end < numHits && hits[end].generation == hits[first].generation) {
+            end++;
+        }
+        HitBatch_t batch = {&hits[first], end - first};
+        if (!Sequencer_editPattern(hits[first].generation, &mergeHits, &batch)) {
+            // Played before another pattern was chosen (or playback stopped): drop the
+            // hits, and the undo history of that pattern with them
+            clearHistory();
+        }
+        first = end;
+    }
+}
+
+// Sequencer_editPattern() callback: merge a batch of hits into the playing pattern.
+static bool mergeHits(Pattern_t *pPattern, void *pContext)
+{
+    const HitBatch_t *pBatch = pContext;
+    unsigned int generation = pBatch->pHits[0].generation;
+    if (generation != undoGeneration) {
+        clearHistory();
+        undoGeneration = generation;
+    }
+    bool isChanged = false;
+    for (int i = 0; i < pBatch->numHits; i++) {
+        if (mergeHit(pPattern, &pBatch->pHits[i])) {
+            isChanged = true;
+        }
+    }
+    return isChanged;
+}
+
+// Quantize a hit and add it to pPattern. The first hit of each pass saves the
+// pattern as it was before the pass into the undo history.
+static bool mergeHit(Pattern_t *pPattern, const Looper_hit_t *pHit)
+{
+    long long pass;
+    double stepPos;
+    if (!Sequencer_locateFrame(pHit->frame, &pass, &stepPos)) {
+        return false;
+    }
+    int gridSteps = grid;
+    int step = (int)lround(stepPos / gridSteps) * gridSteps;
+    if (step >= pPattern->numSteps) {
+        // Rounded up past the end of the bar: it belongs on the next pass's first step
+        step = 0;
+    }
+
+    if (pass != currentPass) {
+        currentPass = pass;
+        undoHistory[nextUndo] = *pPattern;
+        nextUndo = (nextUndo + 1) % LOOPER_MAX_UNDO;
+        if (numUndo < LOOPER_MAX_UNDO) {
+            numUndo++;
+        }
+    }
+
+    // Find the sound's track, adding one if the pattern does not play it yet
+    Pattern_track_t *pTrack = NULL;
+    for (int i = 0; i < pPattern->numTracks; i++) {
+        if (pPattern->tracks[i].sound == pHit->sound) {
+            pTrack = &pPattern->tracks[i];
+            break;
+        }
+    }
+    if (pTrack == NULL) {
+        if (pPattern->numTracks >= PATTERN_MAX_TRACKS) {
+            return false;
+        }
+        pTrack = &pPattern->tracks[pPattern->numTracks++];
+        memset(pTrack, 0, sizeof(*pTrack));
+        pTrack->sound = pHit->sound;
+    }
+
+    int velocity = (int)lroundf(pHit->gain * PATTERN_MAX_VELOCITY);
+    if (velocity < 1) {
+        velocity = 1;
+    } else if (velocity > PATTERN_MAX_VELOCITY) {
+        velocity = PATTERN_MAX_VELOCITY;
+    }
+    if (velocity > pTrack->velocity[step]) {
+        pTrack->velocity[step] = velocity;
+    }
+    return true;
+}
+
+// Sequencer_editPattern() callback: put back the steps (tracks, length, resolution)
+// of a saved pattern, keeping the groove currently played.
+static bool restorePattern(Pattern_t *pPattern, void *pContext)
+{
+    const Pattern_t *pSaved = pContext;
+    Pattern_groove_t groove = pPattern->groove;
+    *pPattern = *pSaved;
+    pPattern->groove = groove;
+    return true;
+}
+
+// Restore the pattern saved before the newest pass that has not been undone.
+static void applyUndo(void)
+{
+    atomic_fetch_sub(&undoRequests, 1);
+    if (numUndo == 0) {
+        return;
+    }
+    nextUndo = (nextUndo - 1 + LOOPER_MAX_UNDO) % LOOPER_MAX_UNDO;
+    numUndo--;
+    if (!Sequencer_editPattern(undoGeneration, &restorePattern, &undoHistory[nextUndo])) {
+        // Saved from a pattern which is no longer playing
+        clearHistory();
+    }
+    // Hits after an undo start a new pass
+    currentPass = NO_PASS;
+}
+
+static void clearHistory(void)
+{
+    numUndo = 0;
+    currentPass = NO_PASS;
+}
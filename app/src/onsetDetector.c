@@ -0,0 +1,286 @@
+/* onsetDetector.c
+ *
+ * This file implements the onset detector declared in onsetDetector.h.
+ *
+ * Samples are converted to integer milli-g once; the filters use Q15 coefficients
+ * computed when the detector is set up, so processing a sample is integer-only.
+ */
+
+#include "onsetDetector.h"
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define Q15_ONE 32768
+#define Q8_SHIFT 8
+#define MG_PER_G 1000
+#define NS_PER_MS 1000000LL
+#define NS_PER_MINUTE (60 * 1000 * NS_PER_MS)
+#define NS_PER_SECOND (1000 * NS_PER_MS)
+#define MAX_TRACE_LINE 128
+
+// Replay: the unmatched recorded and replayed hits on one axis
+typedef struct {
+    bool hasRecorded;
+    long long recordedNs;
+    bool hasReplayed;
+    long long replayedNs;
+} ReplayAxis_t;
+
+static int toQ15(double value)
+{
+    return (int)lround(value * Q15_ONE);
+}
+
+static int mulQ15(int value, int coefQ15)
+{
+    return (int)(((int64_t)value * coefQ15) >> 15);
+}
+
+void OnsetDetector_getDefaultConfig(OnsetDetector_config_t *pConfig, int sampleRateHz)
+{
+    pConfig->sampleRateHz = sampleRateHz;
+    pConfig->highPassHz = ONSET_DEFAULT_HIGH_PASS_HZ;
+    pConfig->releaseMs = ONSET_DEFAULT_RELEASE_MS;
+    pConfig->floorMs = ONSET_DEFAULT_FLOOR_MS;
+    pConfig->thresholdRatio = ONSET_DEFAULT_THRESHOLD_RATIO;
+    pConfig->minThresholdMg = ONSET_DEFAULT_MIN_THRESHOLD_MG;
+    pConfig->fullScaleMg = ONSET_DEFAULT_FULL_SCALE_MG;
+    pConfig->refractoryMs = ONSET_DEFAULT_REFRACTORY_MS;
+}
+
+void OnsetDetector_init(OnsetDetector_t *pDetector, const OnsetDetector_config_t *pConfig)
+{
+    assert(pConfig->sampleRateHz > 0);
+    memset(pDetector, 0, sizeof(*pDetector));
+    pDetector->config = *pConfig;
+
+    double dt = 1.0 / pConfig->sampleRateHz;
+    double rc = 1.0 / (2 * M_PI * pConfig->highPassHz);
+    pDetector->highPassCoefQ15 = toQ15(rc / (rc + dt));
+    pDetector->releaseCoefQ15 = toQ15(exp(-dt * 1000 / pConfig->releaseMs));
+    pDetector->floorCoefQ15 = toQ15(1 - exp(-dt * 1000 / pConfig->floorMs));
+    pDetector->refractoryNs = pConfig->refractoryMs * NS_PER_MS;
+    for (int i = 0; i < ONSET_NUM_AXES; i++) {
+        pDetector->axes[i].isArmed = true;
+    }
+}
+
+// Run one axis's input (in milli-g). Returns true, and fills pHit, on a hit.
+static bool processAxis(OnsetDetector_t *pDetector, OnsetDetector_axis_t *pAxis, int input,
+                        long long timestampNs, OnsetDetector_hit_t *pHit)
+{
+    const OnsetDetector_config_t *pConfig = &pDetector->config;
+
+    pAxis->highPass = mulQ15(pAxis->highPass + input - pAxis->previousInput, pDetector->highPassCoefQ15);
+    pAxis->previousInput = input;
+
+    int rectified = abs(pAxis->highPass);
+    if (rectified > pAxis->envelope) {
+        if (!pAxis->isRising) {
+            pAxis->isRising = true;
+            pAxis->riseStartNs = timestampNs;
+        }
+        pAxis->envelope = rectified;
+    } else {
+        pAxis->isRising = false;
+        pAxis->envelope = mulQ15(pAxis->envelope, pDetector->releaseCoefQ15);
+    }
+
+    int threshold = (pAxis->floorQ8 >> Q8_SHIFT) * pConfig->thresholdRatio;
+    if (threshold < pConfig->minThresholdMg) {
+        threshold = pConfig->minThresholdMg;
+    }
+    pAxis->floorQ8 += mulQ15((pAxis->envelope << Q8_SHIFT) - pAxis->floorQ8, pDetector->floorCoefQ15);
+
+    if (!pAxis->isArmed) {
+        if (pAxis->envelope < threshold / 2) {
+            pAxis->isArmed = true;
+        }
+        return false;
+    }
+    if (pAxis->envelope < threshold) {
+        return false;
+    }
+    if (pAxis->hasHit && timestampNs - pAxis->lastHitNs < pDetector->refractoryNs) {
+        return false;
+    }
+
+    pAxis->isArmed = false;
+    pAxis->hasHit = true;
+    pAxis->lastHitNs = timestampNs;
+    int range = pConfig->fullScaleMg - threshold;
+    int excess = pAxis->envelope - threshold;
+    pHit->velocity = (range <= 0 || excess >= range) ? 1.0f : (float)excess / range;
+    pHit->timestampNs = timestampNs;
+    pHit->latencyNs = pAxis->isRising ? timestampNs - pAxis->riseStartNs : 0;
+    return true;
+}
+
+int OnsetDetector_process(OnsetDetector_t *pDetector, const AccelerometerSample *pSample,
+                          OnsetDetector_hit_t pHits[ONSET_NUM_AXES])
+{
+    int inputs[ONSET_NUM_AXES] = {
+        (int)lround(pSample->data.x * MG_PER_G),
+        (int)lround(pSample->data.y * MG_PER_G),
+        (int)lround(pSample->data.z * MG_PER_G),
+    };
+    OnsetDetector_statistics_t *pStats = &pDetector->stats;
+    if (!pDetector->hasInput) {
+        // Start the filters from the first sample, not from a jump from zero
+        for (int i = 0; i < ONSET_NUM_AXES; i++) {
+            pDetector->axes[i].previousInput = inputs[i];
+        }
+        pDetector->hasInput = true;
+        pStats->firstNs = pSample->timestampNs;
+    }
+    pStats->numSamples++;
+    pStats->lastNs = pSample->timestampNs;
+
+    int numHits = 0;
+    for (int i = 0; i < ONSET_NUM_AXES; i++) {
+        OnsetDetector_hit_t *pHit = &pHits[numHits];
+        if (processAxis(pDetector, &pDetector->axes[i], inputs[i], pSample->timestampNs, pHit)) {
+            pHit->axis = i;
+            pStats->numHits[i]++;
+            pStats->totalLatencyNs += pHit->latencyNs;
+            if (pHit->latencyNs > pStats->maxLatencyNs) {
+                pStats->maxLatencyNs = pHit->latencyNs;
+            }
+            numHits++;
+        }
+    }
+    return numHits;
+}
+
+double OnsetDetector_getHitsPerMinute(const OnsetDetector_t *pDetector)
+{
+    const OnsetDetector_statistics_t *pStats = &pDetector->stats;
+    long long durationNs = pStats->lastNs - pStats->firstNs;
+    if (durationNs < NS_PER_MINUTE / 60) {
+        return 0;
+    }
+    long long numHits = 0;
+    for (int i = 0; i < ONSET_NUM_AXES; i++) {
+        numHits += pStats->numHits[i];
+    }
+    return (double)numHits * NS_PER_MINUTE / durationNs;
+}
+
+// Read the next sample row of a trace, skipping the header. Returns false at the end.
+static bool readTraceRow(FILE *pFile, AccelerometerSample *pSample, int *pAxes)
+{
+    char line[MAX_TRACE_LINE];
+    while (fgets(line, sizeof(line), pFile)) {
+        if (sscanf(line, "%lld,%lf,%lf,%lf,%d", &pSample->timestampNs, &pSample->data.x,
+                &pSample->data.y, &pSample->data.z, pAxes) == 5) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Count an axis's hits which waited longer than windowNs for a match as unmatched.
+static void expireReplayHits(ReplayAxis_t *pAxis, long long timestampNs, long long windowNs,
+                             OnsetDetector_replay_t *pResult)
+{
+    if (pAxis->hasRecorded && timestampNs - pAxis->recordedNs > windowNs) {
+        pAxis->hasRecorded = false;
+        pResult->numMissed++;
+    }
+    if (pAxis->hasReplayed && timestampNs - pAxis->replayedNs > windowNs) {
+        pAxis->hasReplayed = false;
+        pResult->numExtra++;
+    }
+}
+
+bool OnsetDetector_replay(const char *path, const OnsetDetector_config_t *pConfig,
+                          OnsetDetector_replay_t *pResult)
+{
+    FILE *pFile = fopen(path, "r");
+    if (!pFile) {
+        return false;
+    }
+    // First pass: the sample rate, which the detector's filters are set up for
+    AccelerometerSample sample;
+    int recordedAxes;
+    long long numSamples = 0;
+    long long firstNs = 0;
+    long long lastNs = 0;
+    while (readTraceRow(pFile, &sample, &recordedAxes)) {
+        if (numSamples == 0) {
+            firstNs = sample.timestampNs;
+        }
+        lastNs = sample.timestampNs;
+        numSamples++;
+    }
+    if (numSamples < 2 || lastNs <= firstNs) {
+        fclose(pFile);
+        return false;
+    }
+
+    memset(pResult, 0, sizeof(*pResult));
+    pResult->sampleRateHz = (int)llround((double)(numSamples - 1) * NS_PER_SECOND / (lastNs - firstNs));
+    OnsetDetector_config_t config = *pConfig;
+    config.sampleRateHz = pResult->sampleRateHz > 0 ? pResult->sampleRateHz : 1;
+    OnsetDetector_t detector;
+    OnsetDetector_init(&detector, &config);
+    const long long windowNs = detector.refractoryNs / 2;
+
+    // Second pass: detect, and pair each replayed hit with a recorded one
+    ReplayAxis_t axes[ONSET_NUM_AXES] = {0};
+    long long totalOffsetNs = 0;
+    long long maxOffsetNs = 0;
+    rewind(pFile);
+    while (readTraceRow(pFile, &sample, &recordedAxes)) {
+        OnsetDetector_hit_t hits[ONSET_NUM_AXES];
+        int numHits = OnsetDetector_process(&detector, &sample, hits);
+        for (int i = 0; i < ONSET_NUM_AXES; i++) {
+            expireReplayHits(&axes[i], sample.timestampNs, windowNs, pResult);
+            if (recordedAxes & (1 << i)) {
+                if (axes[i].hasRecorded) {
+                    pResult->numMissed++;
+                }
+                axes[i].hasRecorded = true;
+                axes[i].recordedNs = sample.timestampNs;
+                pResult->numRecordedHits++;
+            }
+        }
+        for (int j = 0; j < numHits; j++) {
+            ReplayAxis_t *pAxis = &axes[hits[j].axis];
+            if (pAxis->hasReplayed) {
+                pResult->numExtra++;
+            }
+            pAxis->hasReplayed = true;
+            pAxis->replayedNs = hits[j].timestampNs;
+        }
+        for (int i = 0; i < ONSET_NUM_AXES; i++) {
+            if (axes[i].hasRecorded && axes[i].hasReplayed) {
+                long long offsetNs = axes[i].replayedNs - axes[i].recordedNs;
+                totalOffsetNs += offsetNs;
+                if (llabs(offsetNs) > maxOffsetNs) {
+                    maxOffsetNs = llabs(offsetNs);
+                }
+                pResult->numMatched++;
+                axes[i].hasRecorded = false;
+                axes[i].hasReplayed = false;
+            }
+        }
+    }
+    fclose(pFile);
+
+    for (int i = 0; i < ONSET_NUM_AXES; i++) {
+        pResult->numMissed += axes[i].hasRecorded;
+        pResult->numExtra += axes[i].hasReplayed;
+    }
+    pResult->stats = detector.stats;
+    pResult->hitsPerMinute = OnsetDetector_getHitsPerMinute(&detector);
+    if (pResult->numMatched > 0) {
+        pResult->avgOffsetInMs = (double)totalOffsetNs / pResult->numMatched / NS_PER_MS;
+    }
+    pResult->maxOffsetInMs = (double)maxOffsetNs / NS_PER_MS;
+    return true;
+}
@@ -0,0 +1,332 @@
+/* pattern.c
+ *
+ * This file implements loading, parsing and compiling of drum patterns as
+ * described in pattern.h.
+ */
+
+#include "pattern.h"
+#include "beatPlayer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <math.h>
+
+#define MAX_LINE_LENGTH 256
+#define MAX_FILE_SIZE 4096
+#define MAX_FILE_NAME 256
+#define MAX_PATTERN_FILES 32
+#define ERROR_BUFFER_SIZE 128
+#define PATTERN_FILE_EXTENSION ".pat"
+#define PERCENT 100.0f
+#define DEFAULT_SEED 1
+
+static bool parseDirective(char *line, Pattern_t *pPattern, char *errorBuff, int errorBuffSize);
+static bool parseTrack(char *args, Pattern_t *pPattern, char *errorBuff, int errorBuffSize);
+static float randomUnit(unsigned int *pState);
+static int compareEvents(const void *a, const void *b);
+static int compareNames(const void *a, const void *b);
+
+bool Pattern_parse(const char *text, Pattern_t *pPattern, char *errorBuff, int errorBuffSize)
+{
+    memset(pPattern, 0, sizeof(*pPattern));
+    snprintf(pPattern->name, PATTERN_MAX_NAME, "Custom");
+    pPattern->stepsPerBeat = 2;
+    pPattern->groove.swingPercent = PATTERN_STRAIGHT_SWING;
+    pPattern->groove.seed = DEFAULT_SEED;
+
+    // Split into directives on newlines and ';'
+    const char *pos = text;
+    while (*pos != '\0') {
+        size_t length = strcspn(pos, "\n;");
+        if (length >= MAX_LINE_LENGTH) {
+            snprintf(errorBuff, errorBuffSize, "line too long");
+            return false;
+        }
+        char line[MAX_LINE_LENGTH];
+        memcpy(line, pos, length);
+        line[length] = '\0';
+        pos += length;
+        if (*pos != '\0') {
+            pos++;
+        }
+
+        // Strip comments
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        if (!parseDirective(line, pPattern, errorBuff, errorBuffSize)) {
+            return false;
+        }
+    }
+
+    if (pPattern->numSteps == 0) {
+        snprintf(errorBuff, errorBuffSize, "missing 'steps'");
+        return false;
+    }
+    if (pPattern->numTracks == 0) {
+        snprintf(errorBuff, errorBuffSize, "no tracks");
+        return false;
+    }
+    Pattern_clampGroove(&pPattern->groove);
+    return true;
+}
+
+static bool parseDirective(char *line, Pattern_t *pPattern, char *errorBuff, int errorBuffSize)
+{
+    char keyword[MAX_LINE_LENGTH];
+    int consumed = 0;
+    if (sscanf(line, "%255s%n", keyword, &consumed) != 1) {
+        return true;  // Blank line
+    }
+    char *args = line + consumed;
+
+    if (strcmp(keyword, "name") == 0) {
+        while (isspace((unsigned char)*args)) {
+            args++;
+        }
+        snprintf(pPattern->name, PATTERN_MAX_NAME, "%s", args);
+        // Trim trailing whitespace
+        for (int i = strlen(pPattern->name) - 1; i >= 0 && isspace((unsigned char)pPattern->name[i]); i--) {
+            pPattern->name[i] = '\0';
+        }
+    } else if (strcmp(keyword, "steps") == 0) {
+        if (pPattern->numTracks > 0) {
+            snprintf(errorBuff, errorBuffSize, "'steps' must come before the tracks");
+            return false;
+        }
+        int steps = atoi(args);
+        if (steps < 1 || steps > PATTERN_MAX_STEPS) {
+            snprintf(errorBuff, errorBuffSize, "steps must be 1..%d", PATTERN_MAX_STEPS);
+            return false;
+        }
+        pPattern->numSteps = steps;
+    } else if (strcmp(keyword, "resolution") == 0) {
+        int stepsPerBeat = atoi(args);
+        if (stepsPerBeat < 1 || stepsPerBeat > PATTERN_MAX_STEPS) {
+            snprintf(errorBuff, errorBuffSize, "resolution must be 1..%d", PATTERN_MAX_STEPS);
+            return false;
+        }
+        pPattern->stepsPerBeat = stepsPerBeat;
+    } else if (strcmp(keyword, "track") == 0) {
+        return parseTrack(args, pPattern, errorBuff, errorBuffSize);
+    } else if (strcmp(keyword, "swing") == 0) {
+        pPattern->groove.swingPercent = atoi(args);
+    } else if (strcmp(keyword, "humanize") == 0) {
+        if (sscanf(args, "%d %d", &pPattern->groove.humanizeTimingPercent,
+                &pPattern->groove.humanizeVelocityPercent) != 2) {
+            snprintf(errorBuff, errorBuffSize, "humanize needs a timing and velocity percentage");
+            return false;
+        }
+    } else if (strcmp(keyword, "seed") == 0) {
+        pPattern->groove.seed = strtoul(args, NULL, 0);
+    } else {
+        snprintf(errorBuff, errorBuffSize, "unknown directive '%s'", keyword);
+        return false;
+    }
+    return true;
+}
+
+static bool parseTrack(char *args, Pattern_t *pPattern, char *errorBuff, int errorBuffSize)
+{
+    if (pPattern->numSteps == 0) {
+        snprintf(errorBuff, errorBuffSize, "'steps' must come before the tracks");
+        return false;
+    }
+    if (pPattern->numTracks >= PATTERN_MAX_TRACKS) {
+        snprintf(errorBuff, errorBuffSize, "too many tracks (max %d)", PATTERN_MAX_TRACKS);
+        return false;
+    }
+
+    char soundName[MAX_LINE_LENGTH];
+    int consumed = 0;
+    if (sscanf(args, "%255s%n", soundName, &consumed) != 1) {
+        snprintf(errorBuff, errorBuffSize, "track needs a sound name");
+        return false;
+    }
+    int sound = BeatPlayer_findSound(soundName);
+    if (sound < 0) {
+        snprintf(errorBuff, errorBuffSize, "unknown sound '%s'", soundName);
+        return false;
+    }
+
+    Pattern_track_t *pTrack = &pPattern->tracks[pPattern->numTracks];
+    pTrack->sound = sound;
+    int step = 0;
+    for (const char *pChar = args + consumed; *pChar != '\0'; pChar++) {
+        char c = *pChar;
+        if (isspace((unsigned char)c) || c == '|') {
+            continue;
+        }
+        if (step >= pPattern->numSteps) {
+            snprintf(errorBuff, errorBuffSize, "track '%s' has more than %d steps", soundName, pPattern->numSteps);
+            return false;
+        }
+        if (c == '.' || c == '-' || c == '0') {
+            pTrack->velocity[step] = 0;
+        } else if (c == 'x' || c == 'X') {
+            pTrack->velocity[step] = PATTERN_MAX_VELOCITY;
+        } else if (c >= '1' && c <= '9') {
+            pTrack->velocity[step] = c - '0';
+        } else {
+            snprintf(errorBuff, errorBuffSize, "bad step '%c' in track '%s'", c, soundName);
+            return false;
+        }
+        step++;
+    }
+    if (step != pPattern->numSteps) {
+        snprintf(errorBuff, errorBuffSize, "track '%s' has %d steps, expected %d", soundName, step, pPattern->numSteps);
+        return false;
+    }
+
+    pPattern->numTracks++;
+    return true;
+}
+
+int Pattern_loadDirectory(const char *directory, Pattern_t *patterns, int maxPatterns)
+{
+    DIR *pDir = opendir(directory);
+    if (pDir == NULL) {
+        fprintf(stderr, "ERROR: Unable to open pattern directory %s.\n", directory);
+        return 0;
+    }
+
+    // Collect the pattern file names so they load in a predictable order
+    char fileNames[MAX_PATTERN_FILES][MAX_FILE_NAME];
+    int numFiles = 0;
+    struct dirent *pEntry;
+    while ((pEntry = readdir(pDir)) != NULL && numFiles < MAX_PATTERN_FILES) {
+        size_t length = strlen(pEntry->d_name);
+        size_t extLength = strlen(PATTERN_FILE_EXTENSION);
+        if (length > extLength && length < MAX_FILE_NAME
+                && strcmp(pEntry->d_name + length - extLength, PATTERN_FILE_EXTENSION) == 0) {
+            snprintf(fileNames[numFiles], MAX_FILE_NAME, "%s", pEntry->d_name);
+            numFiles++;
+        }
+    }
+    closedir(pDir);
+    qsort(fileNames, numFiles, sizeof(fileNames[0]), compareNames);
+
+    int numLoaded = 0;
+    for (int i = 0; i < numFiles && numLoaded < maxPatterns; i++) {
+        char path[MAX_FILE_NAME * 2];
+        snprintf(path, sizeof(path), "%s/%s", directory, fileNames[i]);
+
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            fprintf(stderr, "ERROR: Unable to open pattern file %s.\n", path);
+            continue;
+        }
+        char text[MAX_FILE_SIZE];
+        size_t length = fread(text, 1, sizeof(text) - 1, file);
+        fclose(file);
+        text[length] = '\0';
+
+        char error[ERROR_BUFFER_SIZE];
+        if (Pattern_parse(text, &patterns[numLoaded], error, sizeof(error))) {
+            numLoaded++;
+        } else {
+            fprintf(stderr, "ERROR: Pattern file %s: %s.\n", path, error);
+        }
+    }
+    return numLoaded;
+}
+
+void Pattern_compile(const Pattern_t *pPattern, Pattern_timeline_t *pTimeline)
+{
+    pTimeline->numEvents = 0;
+    if (pPattern == NULL) {
+        pTimeline->numSteps = 0;
+        pTimeline->stepsPerBeat = 1;
+        return;
+    }
+
+    const Pattern_groove_t *pGroove = &pPattern->groove;
+    // Swing delays the second step of each pair by this fraction of a step
+    const float swingDelay = (pGroove->swingPercent - PATTERN_STRAIGHT_SWING) / (float)PATTERN_STRAIGHT_SWING;
+    const float timingSpread = pGroove->humanizeTimingPercent / PERCENT;
+    const float velocitySpread = pGroove->humanizeVelocityPercent / PERCENT;
+    unsigned int randomState = pGroove->seed != 0 ? pGroove->seed : DEFAULT_SEED;
+    // The latest position still inside the bar
+    const float lastStepPos = nextafterf((float)pPattern->numSteps, 0.0f);
+
+    pTimeline->numSteps = pPattern->numSteps;
+    pTimeline->stepsPerBeat = pPattern->stepsPerBeat;
+    for (int step = 0; step < pPattern->numSteps; step++) {
+        for (int track = 0; track < pPattern->numTracks; track++) {
+            const Pattern_track_t *pTrack = &pPattern->tracks[track];
+            if (pTrack->velocity[step] == 0) {
+                continue;
+            }
+            float stepPos = step;
+            if (step % 2 == 1) {
+                stepPos += swingDelay;
+            }
+            stepPos += timingSpread * randomUnit(&randomState);
+            // Keep every hit inside its bar; the last step keeps its swing
+            if (stepPos < 0) {
+                stepPos = 0;
+            } else if (stepPos >= lastStepPos) {
+                stepPos = lastStepPos;
+            }
+
+            float gain = (float)pTrack->velocity[step] / PATTERN_MAX_VELOCITY;
+            gain *= 1.0f + velocitySpread * randomUnit(&randomState);
+            if (gain > 1.0f) {
+                gain = 1.0f;
+            }
+
+            Pattern_event_t *pEvent = &pTimeline->events[pTimeline->numEvents++];
+            pEvent->stepPos = stepPos;
+            pEvent->step = step;
+            pEvent->sound = pTrack->sound;
+            pEvent->gain = gain;
+        }
+    }
+    qsort(pTimeline->events, pTimeline->numEvents, sizeof(pTimeline->events[0]), compareEvents);
+}
+
+void Pattern_clampGroove(Pattern_groove_t *pGroove)
+{
+    if (pGroove->swingPercent < PATTERN_STRAIGHT_SWING) {
+        pGroove->swingPercent = PATTERN_STRAIGHT_SWING;
+    } else if (pGroove->swingPercent > PATTERN_MAX_SWING) {
+        pGroove->swingPercent = PATTERN_MAX_SWING;
+    }
+    if (pGroove->humanizeTimingPercent < 0) {
+        pGroove->humanizeTimingPercent = 0;
+    } else if (pGroove->humanizeTimingPercent > PATTERN_MAX_HUMANIZE) {
+        pGroove->humanizeTimingPercent = PATTERN_MAX_HUMANIZE;
+    }
+    if (pGroove->humanizeVelocityPercent < 0) {
+        pGroove->humanizeVelocityPercent = 0;
+    } else if (pGroove->humanizeVelocityPercent > PATTERN_MAX_HUMANIZE) {
+        pGroove->humanizeVelocityPercent = PATTERN_MAX_HUMANIZE;
+    }
+}
+
+// Uniform random number in [-1, 1] from a xorshift32 generator.
+static float randomUnit(unsigned int *pState)
+{
+    unsigned int x = *pState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *pState = x;
+    return (float)((double)x / UINT_MAX * 2.0 - 1.0);
+}
+
+static int compareEvents(const void *a, const void *b)
+{
+    const Pattern_event_t *pA = a;
+    const Pattern_event_t *pB = b;
+    return (pA->stepPos > pB->stepPos) - (pA->stepPos < pB->stepPos);
+}
+
+static int compareNames(const void *a, const void *b)
+{
+    return strcmp(a, b);
+}
@@ -0,0 +1,365 @@
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "probes.h"
+
+// Grown from Brian Fraser's period timer
+//
+// Each period and duration probe keeps running totals instead of its samples: a
+// sample is added to the totals and to a log-bucketed histogram, with relaxed atomic
+// adds and no lock. The totals only ever grow (wrapping harmlessly: only differences
+// are used), so Probes_collect() gets a window's statistics as the difference from
+// its previous snapshot, and never has to clear anything the recorders write. Only
+// the min/max are reset, by exchanging them; a recorder racing with that retries its
+// compare-and-swap. Counters are handled the same way.
+//
+// Probes are only ever added, into a fixed array: a probe is filled in before the
+// count of probes is raised past it, so readers can enumerate without the
+// registration lock.
+//
+// Histogram buckets are in us: values below PROBE_SUB_BUCKETS have a bucket
+// each; above that, each power of 2 is split into PROBE_SUB_BUCKETS buckets, so a
+// bucket is at most 1/PROBE_SUB_BUCKETS (6%) of its value wide.
+#define PROBE_SUB_BUCKET_BITS 4
+#define PROBE_SUB_BUCKETS (1 << PROBE_SUB_BUCKET_BITS)
+#define PROBE_MAX_EXPONENT 35           // Samples up to 2^36 us (19 hours)
+#define PROBE_NUM_BUCKETS ((PROBE_MAX_EXPONENT - PROBE_SUB_BUCKET_BITS + 2) * PROBE_SUB_BUCKETS)
+#define NS_PER_US 1000
+#define NS_PER_SECOND 1000000000.0
+#define MS_PER_NS (1000*1000.0)
+#define US_PER_MS 1000.0
+
+struct Probe {
+    const char *name;
+    Probe_type type;
+
+    // Only the period marker uses this: the previous timestamp of the event.
+    long long prevTimestampInNs;
+
+    // Running totals, added to by the recorders
+    atomic_ullong count;
+    atomic_ullong sumNs;
+    atomic_ullong sumSquaresUs;         // Samples in us, so a window cannot overflow
+    atomic_ullong buckets[PROBE_NUM_BUCKETS];
+    atomic_llong value;                 // Counters and gauges
+    // Reset each window
+    atomic_llong minNs;
+    atomic_llong maxNs;
+
+    // Protected by s_readLock: the totals at the end of the previous window,
+    // and that window's statistics
+    unsigned long long prevCount;
+    unsigned long long prevSumNs;
+    unsigned long long prevSumSquaresUs;
+    unsigned long long prevBuckets[PROBE_NUM_BUCKETS];
+    long long prevValue;
+    Probe_statistics_t window;
+};
+static Probe s_probes[PROBES_MAX];
+static atomic_int s_numProbes = 0;
+
+// Serializes registration; recorders and readers never take it.
+static pthread_mutex_t s_registerLock = PTHREAD_MUTEX_INITIALIZER;
+// Serializes collecting and reading windows; recorders never take it.
+static pthread_mutex_t s_readLock = PTHREAD_MUTEX_INITIALIZER;
+static long long s_lastCollectNs = 0;
+static bool s_initialized = false;
+
+
+// Prototypes
+static int getBucket(unsigned long long sampleInUs);
+static double getBucketValueInMs(int bucket);
+static long long getTimeInNanoS(void);
+
+
+void Probes_init(void)
+{
+    atomic_store(&s_numProbes, 0);
+    s_lastCollectNs = getTimeInNanoS();
+    s_initialized = true;
+}
+void Probes_cleanup(void)
+{
+    // nothing
+    s_initialized = false;
+}
+
+Probe *Probe_register(const char *name, Probe_type type)
+{
+    assert (s_initialized);
+    assert (strlen(name) < PROBE_MAX_NAME);
+    Probe *pProbe = NULL;
+    pthread_mutex_lock(&s_registerLock);
+    {
+        int numProbes = atomic_load(&s_numProbes);
+        for (int i = 0; i < numProbes && !pProbe; i++) {
+            if (strcmp(s_probes[i].name, name) == 0) {
+                assert (s_probes[i].type == type);
+                pProbe = &s_probes[i];
+            }
+        }
+        if (!pProbe) {
+            if (numProbes == PROBES_MAX) {
+                fprintf(stderr, "ERROR: Too many probes (registering %s)\n", name);
+                exit(EXIT_FAILURE);
+            }
+            pProbe = &s_probes[numProbes];
+            pProbe->name = name;
+            pProbe->type = type;
+            pProbe->prevTimestampInNs = 0;
+            atomic_init(&pProbe->count, 0);
+            atomic_init(&pProbe->sumNs, 0);
+            atomic_init(&pProbe->sumSquaresUs, 0);
+            for (int j = 0; j < PROBE_NUM_BUCKETS; j++) {
+                atomic_init(&pProbe->buckets[j], 0);
+                pProbe->prevBuckets[j] = 0;
+            }
+            atomic_init(&pProbe->value, 0);
+            atomic_init(&pProbe->minNs, LLONG_MAX);
+            atomic_init(&pProbe->maxNs, 0);
+            pProbe->prevCount = 0;
+            pProbe->prevSumNs = 0;
+            pProbe->prevSumSquaresUs = 0;
+            pProbe->prevValue = 0;
+            memset(&pProbe->window, 0, sizeof(pProbe->window));
+            pProbe->window.name = name;
+            pProbe->window.type = type;
+            // Publish it to readers
+            atomic_store_explicit(&s_numProbes, numProbes + 1, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&s_registerLock);
+    return pProbe;
+}
+
+// Add a period or duration to the probe's totals.
+static void recordSample(Probe *pProbe, long long sampleInNs)
+{
+    unsigned long long sampleInUs = sampleInNs / NS_PER_US;
+    atomic_fetch_add_explicit(&pProbe->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pProbe->sumNs, sampleInNs, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pProbe->sumSquaresUs, sampleInUs * sampleInUs, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pProbe->buckets[getBucket(sampleInUs)], 1, memory_order_relaxed);
+
+    long long minNs = atomic_load_explicit(&pProbe->minNs, memory_order_relaxed);
+    while (sampleInNs < minNs && !atomic_compare_exchange_weak_explicit(&pProbe->minNs,
+            &minNs, sampleInNs, memory_order_relaxed, memory_order_relaxed)) {
+    }
+    long long maxNs = atomic_load_explicit(&pProbe->maxNs, memory_order_relaxed);
+    while (sampleInNs > maxNs && !atomic_compare_exchange_weak_explicit(&pProbe->maxNs,
+            &maxNs, sampleInNs, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void Probe_markPeriod(Probe *pProbe)
+{
+    assert (pProbe && pProbe->type == PROBE_PERIOD);
+
+    long long nowInNs = getTimeInNanoS();
+    long long prevInNs = pProbe->prevTimestampInNs;
+    pProbe->prevTimestampInNs = nowInNs;
+    if (prevInNs == 0) {
+        // Startup: no period yet
+        return;
+    }
+    recordSample(pProbe, nowInNs - prevInNs);
+}
+
+long long Probe_beginDuration(void)
+{
+    return getTimeInNanoS();
+}
+
+void Probe_endDuration(Probe *pProbe, long long beginNs)
+{
+    assert (pProbe && pProbe->type == PROBE_DURATION);
+    recordSample(pProbe, getTimeInNanoS() - beginNs);
+}
+
+void Probe_add(Probe *pProbe, long long amount)
+{
+    assert (pProbe && pProbe->type == PROBE_COUNTER);
+    atomic_fetch_add_explicit(&pProbe->value, amount, memory_order_relaxed);
+}
+
+void Probe_setGauge(Probe *pProbe, long long value)
+{
+    assert (pProbe && pProbe->type == PROBE_GAUGE);
+    atomic_store_explicit(&pProbe->value, value, memory_order_relaxed);
+}
+
+// The value below which fraction of the window's samples fall, from its bucket counts.
+static double getPercentileInMs(const unsigned long long *pCounts, unsigned long long total, double fraction)
+{
+    unsigned long long rank = (unsigned long long)ceil(fraction * total);
+    if (rank == 0) {
+        rank = 1;
+    }
+    unsigned long long seen = 0;
+    for (int i = 0; i < PROBE_NUM_BUCKETS; i++) {
+        seen += pCounts[i];
+        if (seen >= rank) {
+            return getBucketValueInMs(i);
+        }
+    }
+    return 0;
+}
+
+// Close the probe's window: its statistics are the change in its totals.
+static void collectProbe(Probe *pProbe, double windowInSeconds)
+{
+    Probe_statistics_t *pStats = &pProbe->window;
+    if (pProbe->type == PROBE_COUNTER || pProbe->type == PROBE_GAUGE) {
+        long long value = atomic_load_explicit(&pProbe->value, memory_order_relaxed);
+        pStats->value = value;
+        pStats->ratePerSecond = windowInSeconds > 0 ? (value - pProbe->prevValue) / windowInSeconds : 0;
+        pProbe->prevValue = value;
+        return;
+    }
+
+    // Snapshot the totals, and take this window's share of each
+    unsigned long long count = atomic_load_explicit(&pProbe->count, memory_order_relaxed);
+    unsigned long long sumNs = atomic_load_explicit(&pProbe->sumNs, memory_order_relaxed);
+    unsigned long long sumSquaresUs = atomic_load_explicit(&pProbe->sumSquaresUs, memory_order_relaxed);
+    long long minNs = atomic_exchange_explicit(&pProbe->minNs, LLONG_MAX, memory_order_relaxed);
+    long long maxNs = atomic_exchange_explicit(&pProbe->maxNs, 0, memory_order_relaxed);
+    unsigned long long windowBuckets[PROBE_NUM_BUCKETS];
+    unsigned long long bucketTotal = 0;
+    for (int i = 0; i < PROBE_NUM_BUCKETS; i++) {
+        unsigned long long bucket = atomic_load_explicit(&pProbe->buckets[i], memory_order_relaxed);
+        windowBuckets[i] = bucket - pProbe->prevBuckets[i];
+        pProbe->prevBuckets[i] = bucket;
+        bucketTotal += windowBuckets[i];
+    }
+    unsigned long long windowCount = count - pProbe->prevCount;
+    unsigned long long windowSumNs = sumNs - pProbe->prevSumNs;
+    unsigned long long windowSumSquaresUs = sumSquaresUs - pProbe->prevSumSquaresUs;
+    pProbe->prevCount = count;
+    pProbe->prevSumNs = sumNs;
+    pProbe->prevSumSquaresUs = sumSquaresUs;
+
+    // Save stats
+    memset(pStats, 0, sizeof(*pStats));
+    pStats->name = pProbe->name;
+    pStats->type = pProbe->type;
+    pStats->numSamples = (int)windowCount;
+    if (windowCount > 0) {
+        double meanInUs = (double)windowSumNs / windowCount / NS_PER_US;
+        double variance = (double)windowSumSquaresUs / windowCount - meanInUs * meanInUs;
+        pStats->minInMs = minNs == LLONG_MAX ? 0 : minNs / MS_PER_NS;
+        pStats->maxInMs = maxNs / MS_PER_NS;
+        pStats->avgInMs = windowSumNs / windowCount / MS_PER_NS;
+        pStats->stdDevInMs = variance > 0 ? sqrt(variance) / US_PER_MS : 0;
+    }
+    if (bucketTotal > 0) {
+        pStats->p50InMs = getPercentileInMs(windowBuckets, bucketTotal, 0.50);
+        pStats->p90InMs = getPercentileInMs(windowBuckets, bucketTotal, 0.90);
+        pStats->p99InMs = getPercentileInMs(windowBuckets, bucketTotal, 0.99);
+        pStats->p999InMs = getPercentileInMs(windowBuckets, bucketTotal, 0.999);
+    }
+}
+
+void Probes_collect(void)
+{
+    assert (s_initialized);
+    int numProbes = atomic_load_explicit(&s_numProbes, memory_order_acquire);
+    pthread_mutex_lock(&s_readLock);
+    {
+        long long nowNs = getTimeInNanoS();
+        double windowInSeconds = (nowNs - s_lastCollectNs) / NS_PER_SECOND;
+        s_lastCollectNs = nowNs;
+        for (int i = 0; i < numProbes; i++) {
+            collectProbe(&s_probes[i], windowInSeconds);
+        }
+    }
+    pthread_mutex_unlock(&s_readLock);
+}
+
+void Probe_getStatistics(Probe *pProbe, Probe_statistics_t *pStats)
+{
+    assert (s_initialized);
+    assert (pProbe);
+    pthread_mutex_lock(&s_readLock);
+    {
+        *pStats = pProbe->window;
+    }
+    pthread_mutex_unlock(&s_readLock);
+}
+
+int Probes_getStatistics(Probe_statistics_t *pStats, int maxProbes)
+{
+    assert (s_initialized);
+    int numProbes = atomic_load_explicit(&s_numProbes, memory_order_acquire);
+    if (numProbes > maxProbes) {
+        numProbes = maxProbes;
+    }
+    pthread_mutex_lock(&s_readLock);
+    {
+        for (int i = 0; i < numProbes; i++) {
+            pStats[i] = s_probes[i].window;
+        }
+    }
+    pthread_mutex_unlock(&s_readLock);
+    return numProbes;
+}
+
+int Probe_format(const Probe_statistics_t *pStats, char *buffer, int size)
+{
+    switch (pStats->type) {
+        case PROBE_COUNTER:
+            return snprintf(buffer, size, "%s %lld (%.1f/s)", pStats->name, pStats->value, pStats->ratePerSecond);
+        case PROBE_GAUGE:
+            return snprintf(buffer, size, "%s %lld", pStats->name, pStats->value);
+        default:
+            return snprintf(buffer, size, "%s[%.3f, %.3f] avg %.3f/%d sd %.3f p %.3f/%.3f/%.3f/%.3f",
+                pStats->name, pStats->minInMs, pStats->maxInMs, pStats->avgInMs, pStats->numSamples,
+                pStats->stdDevInMs, pStats->p50InMs, pStats->p90InMs, pStats->p99InMs, pStats->p999InMs);
+    }
+}
+
+static int getBucket(unsigned long long sampleInUs)
+{
+    if (sampleInUs < PROBE_SUB_BUCKETS) {
+        return (int)sampleInUs;
+    }
+    int exponent = 63 - __builtin_clzll(sampleInUs);
+    if (exponent > PROBE_MAX_EXPONENT) {
+        return PROBE_NUM_BUCKETS - 1;
+    }
+    int subBucket = (sampleInUs >> (exponent - PROBE_SUB_BUCKET_BITS)) & (PROBE_SUB_BUCKETS - 1);
+    return (exponent - PROBE_SUB_BUCKET_BITS + 1) * PROBE_SUB_BUCKETS + subBucket;
+}
+
+// The middle of a bucket's range of samples.
+static double getBucketValueInMs(int bucket)
+{
+    if (bucket < PROBE_SUB_BUCKETS) {
+        return bucket / US_PER_MS;
+    }
+    int exponent = bucket / PROBE_SUB_BUCKETS + PROBE_SUB_BUCKET_BITS - 1;
+    int subBucket = bucket % PROBE_SUB_BUCKETS;
+    unsigned long long width = 1ULL << (exponent - PROBE_SUB_BUCKET_BITS);
+    unsigned long long lowInUs = (unsigned long long)(PROBE_SUB_BUCKETS + subBucket) * width;
+    return (lowInUs + width / 2.0) / US_PER_MS;
+}
+
+
+
+// Timing function
+static long long getTimeInNanoS(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_BOOTTIME, &spec);
+    long long seconds = spec.tv_sec;
+    long long nanoSeconds = spec.tv_nsec + seconds * 1000*1000*1000;
+	assert(nanoSeconds > 0);
+
+    return nanoSeconds;
+}
@@ -0,0 +1,272 @@
+/* scheduler.c
+ *
+ * This file implements the cooperative scheduler declared in scheduler.h.
+ *
+ * Every task has an epoll registration keyed by its id: a timer task owns a timerfd
+ * armed with absolute deadlines, an fd task registers the caller's fd. A timerfd
+ * read returns how many deadlines have passed, so a task which wakes late knows how
+ * many it missed, and the deadline it is running for.
+ */
+
+#include "scheduler.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NS_PER_MS 1000000LL
+#define NS_PER_SECOND 1000000000LL
+#define STOP_KEY UINT32_MAX
+
+typedef struct {
+    bool isUsed;
+    bool isTimer;
+    const char *name;
+    int fd;
+    Scheduler_taskFunction function;
+    void *pContext;
+    long long periodNs;
+    long long nextDeadlineNs;
+    // Statistics, protected by statsLock
+    long long numRuns;
+    long long numMissed;
+    long long totalRunNs;
+    long long maxRunNs;
+    long long totalLatenessNs;
+    long long maxLatenessNs;
+} Task_t;
+
+static bool isInitialized = false;
+static Task_t tasks[SCHEDULER_MAX_TASKS];
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static int epollFd = -1;
+static int stopFd = -1;
+static volatile bool isStopping = false;
+
+static long long getNowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+static struct timespec toTimespec(long long ns)
+{
+    struct timespec time = {ns / NS_PER_SECOND, ns % NS_PER_SECOND};
+    return time;
+}
+
+void Scheduler_init(void)
+{
+    assert(!isInitialized);
+    memset(tasks, 0, sizeof(tasks));
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd == -1 || stopFd == -1) {
+        perror("ERROR: Unable to create scheduler");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event stopEvent = {.events = EPOLLIN, .data.u32 = STOP_KEY};
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &stopEvent);
+    isStopping = false;
+    isInitialized = true;
+}
+
+void Scheduler_cleanup(void)
+{
+    assert(isInitialized);
+    for (int i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+        if (tasks[i].isUsed) {
+            Scheduler_remove(i);
+        }
+    }
+    close(stopFd);
+    close(epollFd);
+    isInitialized = false;
+}
+
+static int addTask(const char *name, bool isTimer, int fd, Scheduler_taskFunction function, void *pContext)
+{
+    int taskId = -1;
+    for (int i = 0; i < SCHEDULER_MAX_TASKS && taskId == -1; i++) {
+        if (!tasks[i].isUsed) {
+            taskId = i;
+        }
+    }
+    if (taskId == -1) {
+        fprintf(stderr, "ERROR: Too many scheduler tasks (adding %s)\n", name);
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_lock(&statsLock);
+    {
+        Task_t *pTask = &tasks[taskId];
+        memset(pTask, 0, sizeof(*pTask));
+        pTask->isUsed = true;
+        pTask->isTimer = isTimer;
+        pTask->name = name;
+        pTask->fd = fd;
+        pTask->function = function;
+        pTask->pContext = pContext;
+    }
+    pthread_mutex_unlock(&statsLock);
+    struct epoll_event event = {.events = EPOLLIN, .data.u32 = taskId};
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("ERROR: Unable to add scheduler task");
+        exit(EXIT_FAILURE);
+    }
+    return taskId;
+}
+
+int Scheduler_addTimer(const char *name, int periodMs, Scheduler_taskFunction function, void *pContext)
+{
+    assert(isInitialized);
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timerFd == -1) {
+        perror("ERROR: Unable to create scheduler timer");
+        exit(EXIT_FAILURE);
+    }
+    int taskId = addTask(name, true, timerFd, function, pContext);
+    Scheduler_setPeriod(taskId, periodMs);
+    return taskId;
+}
+
+void Scheduler_setPeriod(int taskId, int periodMs)
+{
+    assert(isInitialized);
+    assert(taskId >= 0 && taskId < SCHEDULER_MAX_TASKS && tasks[taskId].isTimer);
+    Task_t *pTask = &tasks[taskId];
+    pTask->periodNs = periodMs * NS_PER_MS;
+    pTask->nextDeadlineNs = getNowNs() + pTask->periodNs;
+    // An all-zero it_value disarms the timer
+    struct itimerspec deadline = {
+        .it_interval = toTimespec(pTask->periodNs),
+        .it_value = periodMs > 0 ? toTimespec(pTask->nextDeadlineNs) : toTimespec(0),
+    };
+    if (timerfd_settime(pTask->fd, TFD_TIMER_ABSTIME, &deadline, NULL) == -1) {
+        perror("ERROR: Unable to set scheduler timer");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int Scheduler_addFd(const char *name, int fd, Scheduler_taskFunction function, void *pContext)
+{
+    assert(isInitialized);
+    return addTask(name, false, fd, function, pContext);
+}
+
+void Scheduler_remove(int taskId)
+{
+    assert(isInitialized);
+    assert(taskId >= 0 && taskId < SCHEDULER_MAX_TASKS && tasks[taskId].isUsed);
+    Task_t *pTask = &tasks[taskId];
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, pTask->fd, NULL);
+    if (pTask->isTimer) {
+        close(pTask->fd);
+    }
+    pthread_mutex_lock(&statsLock);
+    {
+        pTask->isUsed = false;
+    }
+    pthread_mutex_unlock(&statsLock);
+}
+
+// Run a task whose fd is ready, and record its statistics.
+static void runTask(Task_t *pTask)
+{
+    long long startNs = getNowNs();
+    long long latenessNs = 0;
+    long long numMissed = 0;
+    if (pTask->isTimer) {
+        uint64_t numExpirations;
+        if (read(pTask->fd, &numExpirations, sizeof(numExpirations)) != sizeof(numExpirations)
+                || numExpirations == 0) {
+            return;     // Re-armed since it became ready
+        }
+        // Run once for the newest deadline; the ones before it are missed
+        numMissed = numExpirations - 1;
+        long long deadlineNs = pTask->nextDeadlineNs + numMissed * pTask->periodNs;
+        pTask->nextDeadlineNs = deadlineNs + pTask->periodNs;
+        latenessNs = startNs - deadlineNs;
+    }
+
+    pTask->function(pTask->pContext);
+
+    long long runNs = getNowNs() - startNs;
+    pthread_mutex_lock(&statsLock);
+    {
+        pTask->numRuns++;
+        pTask->numMissed += numMissed;
+        pTask->totalRunNs += runNs;
+        if (runNs > pTask->maxRunNs) {
+            pTask->maxRunNs = runNs;
+        }
+        pTask->totalLatenessNs += latenessNs;
+        if (latenessNs > pTask->maxLatenessNs) {
+            pTask->maxLatenessNs = latenessNs;
+        }
+    }
+    pthread_mutex_unlock(&statsLock);
+}
+
+void Scheduler_run(void)
+{
+    assert(isInitialized);
+    struct epoll_event ready[SCHEDULER_MAX_TASKS + 1];
+    while (!isStopping) {
+        int numReady = epoll_wait(epollFd, ready, SCHEDULER_MAX_TASKS + 1, -1);
+        for (int i = 0; i < numReady && !isStopping; i++) {
+            uint32_t key = ready[i].data.u32;
+            if (key == STOP_KEY) {
+                isStopping = true;
+            } else if (tasks[key].isUsed) {
+                // (A task may have removed one which was also ready)
+                runTask(&tasks[key]);
+            }
+        }
+    }
+}
+
+void Scheduler_stop(void)
+{
+    assert(isInitialized);
+    uint64_t stop = 1;
+    if (write(stopFd, &stop, sizeof(stop)) != sizeof(stop)) {
+        perror("ERROR: Unable to stop scheduler");
+    }
+}
+
+int Scheduler_getStatistics(Scheduler_taskStatistics_t *pStats, int maxTasks)
+{
+    assert(isInitialized);
+    int count = 0;
+    pthread_mutex_lock(&statsLock);
+    {
+        for (int i = 0; i < SCHEDULER_MAX_TASKS && count < maxTasks; i++) {
+            Task_t *pTask = &tasks[i];
+            if (!pTask->isUsed) {
+                continue;
+            }
+            long long numRuns = pTask->numRuns > 0 ? pTask->numRuns : 1;
+            pStats[count++] = (Scheduler_taskStatistics_t) {
+                .name = pTask->name,
+                .isTimer = pTask->isTimer,
+                .numRuns = pTask->numRuns,
+                .avgRunInMs = (double)pTask->totalRunNs / numRuns / NS_PER_MS,
+                .maxRunInMs = (double)pTask->maxRunNs / NS_PER_MS,
+                .avgLatenessInMs = (double)pTask->totalLatenessNs / numRuns / NS_PER_MS,
+                .maxLatenessInMs = (double)pTask->maxLatenessNs / NS_PER_MS,
+                .numMissed = pTask->numMissed,
+            };
+        }
+    }
+    pthread_mutex_unlock(&statsLock);
+    return count;
+}
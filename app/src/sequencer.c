@@ -0,0 +1,412 @@
+/* sequencer.c
+ *
+ * This file implements the pattern sequencer declared in sequencer.h.
+ *
+ * Compiled timelines are passed from the writers (any thread calling
+ * Sequencer_setPattern()) to the player (the thread calling Sequencer_scheduleUntil())
+ * through a triple buffer: the player owns the active timeline, writers own the back
+ * timeline, and the third one is the "pending" hand-over slot, swapped with an atomic
+ * exchange. The player never blocks and nothing is allocated after init.
+ *
+ * The player keeps time one step at a time: each step starts where the previous one
+ * ended and its length is fixed when it starts, so a tempo change never splits a step.
+ * Tempo requests reach the player through a sequence lock, which it only ever reads.
+ * Ramps are evaluated from the number of steps since the ramp started rather than by
+ * accumulating per-step changes, so they always land exactly on their target.
+ * The history of recent steps is published through a second sequence lock, so other
+ * threads can locate frames in it.
+ */
+
+#include "sequencer.h"
+#include "hal/audioMixer.h"
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define NUM_TIMELINES 3
+#define INDEX_MASK 0x3
+#define FRESH_FLAG 0x4
+#define SECONDS_PER_MINUTE 60.0
+#define STEP_HISTORY_SIZE 64
+
+// Where and how long a step was, for Sequencer_locateFrame()
+typedef struct {
+    double startFrame;
+    double framesPerStep;
+    long long bar;
+    int stepInBar;
+} StepRecord_t;
+
+typedef struct {
+    int targetBpm;
+    int numBars;                // 0 = change at the next step
+    Sequencer_rampShape shape;
+} TempoRequest_t;
+
+static bool isInitialized = false;
+static Sequencer_triggerFn triggerSound = NULL;
+
+static Pattern_timeline_t timelines[NUM_TIMELINES];
+static int activeIndex = 0;                 // Owned by the player
+static int backIndex = 1;                   // Owned by writers (under writerLock)
+static atomic_int pendingIndex = 2;         // Hand-over slot, plus FRESH_FLAG when new
+static pthread_mutex_t writerLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Writer-side copy of the playing pattern, so its groove can be changed and the
+// pattern recompiled without the caller keeping it around (under writerLock)
+static Pattern_t currentPattern;
+static bool hasPattern = false;
+static atomic_uint patternGeneration = 0;   // Written under writerLock
+
+// Latest tempo request. Written under writerLock; tempoSequence is odd while a write
+// is in progress and changes with every request.
+static TempoRequest_t tempoRequest;
+static atomic_uint tempoSequence = 0;
+static atomic_int playingBpm = 0;
+
+// Player state
+static unsigned int seenTempoSequence = 0;
+static long long appliedTempoFrame = 0;
+static double stepStartFrame = 0;
+static double framesPerStep = 0;
+static int stepInBar = 0;
+static int cursor = 0;
+static long long barCount = 0;
+static long long stepCount = 0;             // Steps started since playback started
+// The ideal grid: steps are framesPerStep apart from gridStartFrame, the frame of step
+// gridStartStep, where the applied tempo last changed
+static double gridStartFrame = 0;
+static long long gridStartStep = 0;
+static StepRecord_t stepHistory[STEP_HISTORY_SIZE];
+static int numStepRecords = 0;
+static int nextStepRecord = 0;
+static atomic_uint historySequence = 0;     // Odd while the player writes the history
+
+// Player tempo (ramp) state
+static double currentBpm = 0;
+static double rampStartBpm = 0;
+static double rampEndBpm = 0;
+static Sequencer_rampShape rampShape = SEQUENCER_RAMP_LINEAR;
+static long long rampSteps = 0;
+static long long rampStep = 0;
+
+static bool takePendingTimeline(void);
+static void publishCurrentPattern(void);
+static unsigned int requestTempo(int targetBpm, int numBars, Sequencer_rampShape shape);
+static void startStep(const Pattern_timeline_t *pTimeline);
+
+void Sequencer_init(Sequencer_triggerFn trigger, int initialBpm)
+{
+    assert(!isInitialized);
+    assert(trigger);
+    triggerSound = trigger;
+    for (int i = 0; i < NUM_TIMELINES; i++) {
+        Pattern_compile(NULL, &timelines[i]);
+    }
+    activeIndex = 0;
+    backIndex = 1;
+    pendingIndex = 2;
+    cursor = 0;
+    stepInBar = 0;
+    barCount = 0;
+    stepCount = 0;
+    numStepRecords = 0;
+    nextStepRecord = 0;
+    hasPattern = false;
+    currentBpm = initialBpm;
+    rampEndBpm = initialBpm;
+    rampSteps = 0;
+    rampStep = 0;
+    playingBpm = initialBpm;
+    seenTempoSequence = tempoSequence;
+    isInitialized = true;
+}
+
+void Sequencer_cleanup(void)
+{
+    assert(isInitialized);
+    isInitialized = false;
+}
+
+void Sequencer_setPattern(const Pattern_t *pPattern)
+{
+    assert(isInitialized);
+    pthread_mutex_lock(&writerLock);
+    {
+        hasPattern = (pPattern != NULL);
+        if (hasPattern) {
+            currentPattern = *pPattern;
+        }
+        atomic_fetch_add(&patternGeneration, 1);
+        publishCurrentPattern();
+    }
+    pthread_mutex_unlock(&writerLock);
+}
+
+void Sequencer_setGroove(const Pattern_groove_t *pGroove)
+{
+    assert(isInitialized);
+    pthread_mutex_lock(&writerLock);
+    {
+        currentPattern.groove = *pGroove;
+        Pattern_clampGroove(&currentPattern.groove);
+        if (hasPattern) {
+            publishCurrentPattern();
+        }
+    }
+    pthread_mutex_unlock(&writerLock);
+}
+
+unsigned int Sequencer_getPatternGeneration(void)
+{
+    assert(isInitialized);
+    return atomic_load_explicit(&patternGeneration, memory_order_relaxed);
+}
+
+bool Sequencer_editPattern(unsigned int generation, Sequencer_editFn edit, void *pContext)
+{
+    assert(isInitialized);
+    bool isCurrent;
+    pthread_mutex_lock(&writerLock);
+    {
+        isCurrent = hasPattern && generation == atomic_load(&patternGeneration);
+        if (isCurrent && edit(&currentPattern, pContext)) {
+            publishCurrentPattern();
+        }
+    }
+    pthread_mutex_unlock(&writerLock);
+    return isCurrent;
+}
+
+Pattern_groove_t Sequencer_getGroove(void)
+{
+    assert(isInitialized);
+    Pattern_groove_t groove;
+    pthread_mutex_lock(&writerLock);
+    {
+        groove = currentPattern.groove;
+    }
+    pthread_mutex_unlock(&writerLock);
+    return groove;
+}
+
+// Compile the current pattern into the back timeline and hand it to the player.
+// Must hold writerLock.
+static void publishCurrentPattern(void)
+{
+    Pattern_compile(hasPattern ? &currentPattern : NULL, &timelines[backIndex]);
+    backIndex = atomic_exchange(&pendingIndex, backIndex | FRESH_FLAG) & INDEX_MASK;
+}
+
+unsigned int Sequencer_setBpm(int newBpm)
+{
+    assert(isInitialized);
+    return requestTempo(newBpm, 0, SEQUENCER_RAMP_LINEAR);
+}
+
+unsigned int Sequencer_rampBpm(int targetBpm, int numBars, Sequencer_rampShape shape)
+{
+    assert(isInitialized);
+    return requestTempo(targetBpm, numBars < 0 ? 0 : numBars, shape);
+}
+
+void Sequencer_getAppliedTempo(unsigned int *pRequest, long long *pFrame)
+{
+    assert(isInitialized);
+    *pRequest = seenTempoSequence;
+    *pFrame = appliedTempoFrame;
+}
+
+int Sequencer_getBpm(void)
+{
+    assert(isInitialized);
+    return playingBpm;
+}
+
+static unsigned int requestTempo(int targetBpm, int numBars, Sequencer_rampShape shape)
+{
+    unsigned int request;
+    pthread_mutex_lock(&writerLock);
+    {
+        atomic_fetch_add(&tempoSequence, 1);
+        tempoRequest.targetBpm = targetBpm;
+        tempoRequest.numBars = numBars;
+        tempoRequest.shape = shape;
+        request = atomic_fetch_add(&tempoSequence, 1) + 1;
+    }
+    pthread_mutex_unlock(&writerLock);
+    return request;
+}
+
+// Swap in the newest timeline from the writers, if there is one.
+static bool takePendingTimeline(void)
+{
+    if ((atomic_load(&pendingIndex) & FRESH_FLAG) == 0) {
+        return false;
+    }
+    activeIndex = atomic_exchange(&pendingIndex, activeIndex) & INDEX_MASK;
+    return true;
+}
+
+// Pick up any new tempo request (a torn read is simply retried at the next step).
+static void readTempoRequest(const Pattern_timeline_t *pTimeline)
+{
+    unsigned int sequence = atomic_load(&tempoSequence);
+    if (sequence == seenTempoSequence || (sequence & 1) != 0) {
+        return;
+    }
+    TempoRequest_t request = tempoRequest;
+    // Keep the copy above ahead of the re-check, so a write it overlapped is caught
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&tempoSequence, memory_order_relaxed) != sequence) {
+        return;
+    }
+    seenTempoSequence = sequence;
+    appliedTempoFrame = llround(stepStartFrame);
+
+    rampStartBpm = currentBpm;
+    rampEndBpm = request.targetBpm;
+    rampShape = request.shape;
+    rampSteps = (long long)request.numBars * pTimeline->numSteps;
+    rampStep = 0;
+}
+
+// Fix the tempo, and so the length, of the step starting at stepStartFrame.
+static void startStep(const Pattern_timeline_t *pTimeline)
+{
+    readTempoRequest(pTimeline);
+    if (rampStep < rampSteps) {
+        rampStep++;
+        double progress = (double)rampStep / rampSteps;
+        if (rampShape == SEQUENCER_RAMP_EXPONENTIAL) {
+            currentBpm = rampStartBpm * pow(rampEndBpm / rampStartBpm, progress);
+        } else {
+            currentBpm = rampStartBpm + (rampEndBpm - rampStartBpm) * progress;
+        }
+    } else {
+        currentBpm = rampEndBpm;
+    }
+    playingBpm = (int)lround(currentBpm);
+    double newFramesPerStep = AUDIOMIXER_SAMPLE_RATE * SECONDS_PER_MINUTE / (currentBpm * pTimeline->stepsPerBeat);
+    if (newFramesPerStep != framesPerStep) {
+        gridStartFrame = stepStartFrame;
+        gridStartStep = stepCount;
+    }
+    framesPerStep = newFramesPerStep;
+
+    unsigned int sequence = atomic_load_explicit(&historySequence, memory_order_relaxed);
+    atomic_store_explicit(&historySequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    StepRecord_t *pRecord = &stepHistory[nextStepRecord];
+    pRecord->startFrame = stepStartFrame;
+    pRecord->framesPerStep = framesPerStep;
+    pRecord->bar = barCount;
+    pRecord->stepInBar = stepInBar;
+    nextStepRecord = (nextStepRecord + 1) % STEP_HISTORY_SIZE;
+    if (numStepRecords < STEP_HISTORY_SIZE) {
+        numStepRecords++;
+    }
+    atomic_store_explicit(&historySequence, sequence + 2, memory_order_release);
+}
+
+bool Sequencer_locateFrame(long long frame, long long *pBar, double *pStepPos)
+{
+    assert(isInitialized);
+    while (true) {
+        unsigned int sequence = atomic_load_explicit(&historySequence, memory_order_acquire);
+        if ((sequence & 1) != 0) {
+            continue;   // The player is adding a step: it is only a few stores
+        }
+        // Newest first: the frame is in the latest step which started before it
+        bool isFound = false;
+        StepRecord_t record;
+        int numRecords = numStepRecords;
+        int next = nextStepRecord;
+        for (int i = 1; i <= numRecords && !isFound; i++) {
+            record = stepHistory[(next - i + STEP_HISTORY_SIZE) % STEP_HISTORY_SIZE];
+            isFound = record.startFrame <= frame;
+        }
+        // Retry if the player added a step while the history was read
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&historySequence, memory_order_relaxed) != sequence) {
+            continue;
+        }
+        if (isFound) {
+            *pBar = record.bar;
+            *pStepPos = record.stepInBar + (frame - record.startFrame) / record.framesPerStep;
+        }
+        return isFound;
+    }
+}
+
+void Sequencer_scheduleUntil(long long nowFrame, long long horizonFrame)
+{
+    assert(isInitialized);
+    Pattern_timeline_t *pTimeline = &timelines[activeIndex];
+
+    // When stopped, start a new pattern right away rather than on a bar boundary
+    if (pTimeline->numSteps == 0) {
+        if (!takePendingTimeline()) {
+            return;
+        }
+        pTimeline = &timelines[activeIndex];
+        if (pTimeline->numSteps == 0) {
+            return;
+        }
+        stepStartFrame = nowFrame;
+        stepInBar = 0;
+        cursor = 0;
+        barCount++;
+        stepCount = 0;
+        framesPerStep = 0;      // Start the grid here
+        startStep(pTimeline);
+    }
+
+    while (true) {
+        // Queue this step's events that start before the horizon. Steps which are
+        // already over (e.g. after the caller was delayed) are dropped, not played late.
+        bool isLate = stepStartFrame + framesPerStep < nowFrame;
+        double gridFrame = gridStartFrame + (stepCount - gridStartStep) * framesPerStep;
+        while (cursor < pTimeline->numEvents && pTimeline->events[cursor].stepPos < stepInBar + 1) {
+            const Pattern_event_t *pEvent = &pTimeline->events[cursor];
+            long long frame = llround(stepStartFrame + (pEvent->stepPos - stepInBar) * framesPerStep);
+            if (frame >= horizonFrame) {
+                return;
+            }
+            if (isLate) {
+                AudioMixer_countDroppedSound();
+            } else {
+                // Where the event belongs: its own step on the grid (humanize may have
+                // moved it into a neighbour), plus its swing and humanize offset
+                double eventGridFrame = gridFrame + (pEvent->step - stepInBar) * framesPerStep;
+                double grooveFrames = (pEvent->stepPos - pEvent->step) * framesPerStep;
+                triggerSound(pEvent->sound, pEvent->gain, frame, llround(eventGridFrame + grooveFrames));
+            }
+            cursor++;
+        }
+
+        // Move on to the next step once it is due
+        double nextStepFrame = stepStartFrame + framesPerStep;
+        if (nextStepFrame >= horizonFrame) {
+            return;
+        }
+        stepStartFrame = nextStepFrame;
+        stepInBar++;
+        stepCount++;
+        if (stepInBar >= pTimeline->numSteps) {
+            stepInBar = 0;
+            cursor = 0;
+            barCount++;
+            if (takePendingTimeline()) {
+                pTimeline = &timelines[activeIndex];
+                if (pTimeline->numSteps == 0) {
+                    return;
+                }
+            }
+        }
+        startStep(pTimeline);
+    }
+}
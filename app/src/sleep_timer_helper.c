@@ -14,6 +14,13 @@ long time_diff_ms(struct timespec *start, struct timespec *end) {
     return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
 }
 
+long long getTimeInNs(void) {
+    const long long NS_PER_SECOND = 1000000000;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
 void sleepForMs(long long delayInMs) { 
     const long long NS_PER_MS = 1000 * 1000;
     const long long NS_PER_SECOND = 1000000000; 
@@ -0,0 +1,142 @@
+/* tapTempo.c
+ *
+ * This file implements the tap tempo estimator declared in tapTempo.h.
+ */
+
+#include "tapTempo.h"
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NS_PER_MS 1000000LL
+#define NS_PER_MINUTE (60 * 1000 * NS_PER_MS)
+#define MIN_INTERVAL_NS (150 * NS_PER_MS)  // Anything faster is a bounce, not a tap
+#define MIN_INTERVALS 2
+
+static bool isInitialized = false;
+
+// Tap state
+static long long lastTapNs = 0;
+static bool hasLastTap = false;
+static long long intervals[TAPTEMPO_WINDOW];
+static int numIntervals = 0;
+static int nextInterval = 0;
+
+// Latency statistics
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static TapTempo_statistics_t stats;
+static double totalLatencyInMs = 0;
+
+void TapTempo_init(void)
+{
+    assert(!isInitialized);
+    TapTempo_reset();
+    memset(&stats, 0, sizeof(stats));
+    totalLatencyInMs = 0;
+    isInitialized = true;
+}
+
+void TapTempo_cleanup(void)
+{
+    assert(isInitialized);
+    isInitialized = false;
+}
+
+void TapTempo_reset(void)
+{
+    hasLastTap = false;
+    numIntervals = 0;
+    nextInterval = 0;
+}
+
+// Insertion sort; the window is tiny.
+static void sortIntervals(long long *values, int count)
+{
+    for (int i = 1; i < count; i++) {
+        long long value = values[i];
+        int j = i - 1;
+        while (j >= 0 && values[j] > value) {
+            values[j + 1] = values[j];
+            j--;
+        }
+        values[j + 1] = value;
+    }
+}
+
+bool TapTempo_tap(long long timestampNs, int *pBpm)
+{
+    assert(isInitialized);
+    if (!hasLastTap || timestampNs - lastTapNs > TAPTEMPO_TIMEOUT_MS * NS_PER_MS) {
+        TapTempo_reset();
+        hasLastTap = true;
+        lastTapNs = timestampNs;
+        return false;
+    }
+    long long interval = timestampNs - lastTapNs;
+    if (interval < MIN_INTERVAL_NS) {
+        return false;
+    }
+    lastTapNs = timestampNs;
+    intervals[nextInterval] = interval;
+    nextInterval = (nextInterval + 1) % TAPTEMPO_WINDOW;
+    if (numIntervals < TAPTEMPO_WINDOW) {
+        numIntervals++;
+    }
+    if (numIntervals < MIN_INTERVALS) {
+        return false;
+    }
+
+    // Average the intervals close to the median
+    long long sorted[TAPTEMPO_WINDOW];
+    memcpy(sorted, intervals, numIntervals * sizeof(sorted[0]));
+    sortIntervals(sorted, numIntervals);
+    long long median = sorted[numIntervals / 2];
+    long long tolerance = median * TAPTEMPO_TOLERANCE_PERCENT / 100;
+    long long total = 0;
+    int count = 0;
+    for (int i = 0; i < numIntervals; i++) {
+        if (llabs(sorted[i] - median) <= tolerance) {
+            total += sorted[i];
+            count++;
+        }
+    }
+    if (count < MIN_INTERVALS) {
+        return false;
+    }
+    *pBpm = (int)llround((double)NS_PER_MINUTE * count / total);
+    return true;
+}
+
+void TapTempo_recordLatency(long long latencyNs)
+{
+    assert(isInitialized);
+    double latencyInMs = (double)latencyNs / NS_PER_MS;
+    pthread_mutex_lock(&statsLock);
+    {
+        if (stats.numSamples == 0 || latencyInMs < stats.minLatencyInMs) {
+            stats.minLatencyInMs = latencyInMs;
+        }
+        if (stats.numSamples == 0 || latencyInMs > stats.maxLatencyInMs) {
+            stats.maxLatencyInMs = latencyInMs;
+        }
+        stats.numSamples++;
+        totalLatencyInMs += latencyInMs;
+        stats.avgLatencyInMs = totalLatencyInMs / stats.numSamples;
+        stats.lastLatencyInMs = latencyInMs;
+    }
+    pthread_mutex_unlock(&statsLock);
+}
+
+TapTempo_statistics_t TapTempo_getStatistics(void)
+{
+    assert(isInitialized);
+    TapTempo_statistics_t copy;
+    pthread_mutex_lock(&statsLock);
+    {
+        copy = stats;
+    }
+    pthread_mutex_unlock(&statsLock);
+    return copy;
+}
@@ -1,7 +1,7 @@
 /* terminalOutput.c
  * 
- * This file contains the implementation of the terminal output thread. 
- * The thread prints the current beat mode, bpm, volume, audio statistics, and accelerometer statistics to the terminal every second.
+ * This file contains the implementation of the terminal output task. 
+ * The task (on the scheduler) prints the current beat mode, bpm, volume, audio statistics, and accelerometer statistics to the terminal every second.
  *
  */
 
@@ -12,7 +12,7 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <unistd.h>
-#include <periodTimer.h>
+#include <probes.h>
 #include <stdatomic.h>
 #include <hal/rotary_encoder_statemachine.h>
 #include <hal/rotary_btn_statemachine.h>
@@ -22,51 +22,119 @@
 #include "hal/audioMixer.h"
 #include "sleep_timer_helper.h"
 #include "updateLcd.h"
+#include "tapTempo.h"
+#include "scheduler.h"
 
 #define ONE_SECOND_IN_MS 1000
+#define PROBE_LINE_SIZE 128
 static bool isInitialized = false;
-static pthread_t outputThread;
-static bool isRunning = true;
-static Period_statistics_t accelStats;
-static Period_statistics_t audioStats;
+static int outputTask = -1;
+static Probe_statistics_t accelStats;
+static Probe_statistics_t audioStats;
+static TerminalOutput_beatTiming_t beatTiming;
 
-static void* TerminalOutputThread(void* args);
+// Average beat start error of each of the last seconds with hits, and its second
+typedef struct {
+    long long second;
+    double avgErrorInMs;
+} BeatWindow_t;
+static BeatWindow_t beatWindows[BEAT_DRIFT_SECONDS];
+static int numBeatWindows = 0;
+static int nextBeatWindow = 0;
+static long long numSeconds = 0;
+
+static void TerminalOutputTask(void* pContext);
 void TerminalOutput_init() {
     assert(!isInitialized);
     isInitialized = true;
-    pthread_create(&outputThread, NULL, &TerminalOutputThread, NULL);
+    outputTask = Scheduler_addTimer("terminal", ONE_SECOND_IN_MS, &TerminalOutputTask, NULL);
 }
 
 void TerminalOutput_cleanup() {
     assert(isInitialized);
-    isRunning = false;
-    pthread_join(outputThread, NULL);
+    Scheduler_remove(outputTask);
     isInitialized = false;
 }
 
-Period_statistics_t TerminalOutput_getAccelStats() {
+Probe_statistics_t TerminalOutput_getAccelStats() {
     assert(isInitialized);
     return accelStats;
 }
 
-Period_statistics_t TerminalOutput_getAudioStats() {
+Probe_statistics_t TerminalOutput_getAudioStats() {
     assert(isInitialized);
     return audioStats;
 }
 
-static void* TerminalOutputThread(void* args) {
-    (void) args;
+TerminalOutput_beatTiming_t TerminalOutput_getBeatTiming(void) {
     assert(isInitialized);
-    while (isRunning) {
-        accelStats = Accelerometer_getSamplingTime();
-        audioStats = AudioMixer_getAudioStat();
-        int beatMode = BeatPlayer_getBeatMode();
-        int bpm = BeatPlayer_getBpm();
-        int volume = BeatPlayer_getVolume();
-        printf("M%d %dbpm vol:%d  Audio[%.3f, %.3f] avg %.3f/%d  Accel[%.3f, %.3f] avg %.3f/%d\n", beatMode, bpm, volume, 
-            audioStats.minPeriodInMs, audioStats.maxPeriodInMs, audioStats.avgPeriodInMs, audioStats.numSamples,
-            accelStats.minPeriodInMs, accelStats.maxPeriodInMs, accelStats.avgPeriodInMs, accelStats.numSamples);
-        sleepForMs(ONE_SECOND_IN_MS);
+    return beatTiming;
+}
+
+// Take the last second's beat start errors, and fit a line through the average
+// error of the recent seconds: its slope is the drift.
+static void updateBeatTiming(void) {
+    numSeconds++;
+    beatTiming.lastSecond = AudioMixer_getStartStatisticsAndClear();
+    if (beatTiming.lastSecond.numStarts > 0) {
+        beatWindows[nextBeatWindow].second = numSeconds;
+        beatWindows[nextBeatWindow].avgErrorInMs = beatTiming.lastSecond.avgErrorInMs;
+        nextBeatWindow = (nextBeatWindow + 1) % BEAT_DRIFT_SECONDS;
+        if (numBeatWindows < BEAT_DRIFT_SECONDS) {
+            numBeatWindows++;
+        }
+    }
+    // Least squares, over the windows still within BEAT_DRIFT_SECONDS
+    double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+    int count = 0;
+    for (int i = 0; i < numBeatWindows; i++) {
+        const BeatWindow_t *pWindow = &beatWindows[i];
+        if (numSeconds - pWindow->second >= BEAT_DRIFT_SECONDS) {
+            continue;
+        }
+        double x = pWindow->second - numSeconds;
+        sumX += x;
+        sumY += pWindow->avgErrorInMs;
+        sumXX += x * x;
+        sumXY += x * pWindow->avgErrorInMs;
+        count++;
+    }
+    double denominator = count * sumXX - sumX * sumX;
+    beatTiming.driftInMsPerMinute = count > 1 && denominator > 0
+        ? (count * sumXY - sumX * sumY) / denominator * 60 : 0;
+}
+
+static void TerminalOutputTask(void* pContext) {
+    (void) pContext;
+    assert(isInitialized);
+    // Close the last second's window of every probe
+    Probes_collect();
+    updateBeatTiming();
+    accelStats = Accelerometer_getSamplingTime();
+    audioStats = AudioMixer_getAudioStat();
+    int beatMode = BeatPlayer_getBeatMode();
+    int bpm = BeatPlayer_getBpm();
+    int volume = BeatPlayer_getVolume();
+    printf("M%d %dbpm vol:%d  Audio[%.3f, %.3f] avg %.3f/%d  Accel[%.3f, %.3f] avg %.3f/%d", beatMode, bpm, volume, 
+        audioStats.minInMs, audioStats.maxInMs, audioStats.avgInMs, audioStats.numSamples,
+        accelStats.minInMs, accelStats.maxInMs, accelStats.avgInMs, accelStats.numSamples);
+    if (BeatPlayer_getTapSource() != TAP_OFF) {
+        TapTempo_statistics_t tapStats = TapTempo_getStatistics();
+        printf("  Tap[%.1f, %.1f] avg %.1f/%d", tapStats.minLatencyInMs, tapStats.maxLatencyInMs,
+            tapStats.avgLatencyInMs, tapStats.numSamples);
+    }
+    printf("\n");
+    const AudioMixer_startStatistics_t *pStarts = &beatTiming.lastSecond;
+    printf("   beat err avg %.3f max %.3f ms/%d hist %d/%d/%d/%d/%d dropped %d drift %+.3f ms/min\n",
+        pStarts->avgErrorInMs, pStarts->maxErrorInMs, pStarts->numStarts,
+        pStarts->histogram[0], pStarts->histogram[1], pStarts->histogram[2], pStarts->histogram[3],
+        pStarts->histogram[4], pStarts->numDropped, beatTiming.driftInMsPerMinute);
+    // Every probe: periods and durations with their spread (sd, p50/p90/p99/p99.9)
+    Probe_statistics_t probeStats[PROBES_MAX];
+    int numProbes = Probes_getStatistics(probeStats, PROBES_MAX);
+    for (int i = 0; i < numProbes; i++) {
+        char line[PROBE_LINE_SIZE];
+        Probe_format(&probeStats[i], line, sizeof(line));
+        printf("   %s\n", line);
     }
-    return NULL;
 }
@@ -0,0 +1,212 @@
+/* trace.c
+ *
+ * This file implements the span recorder declared in trace.h.
+ *
+ * A thread claims a buffer by advancing numBuffers, and keeps it in a thread-local
+ * pointer. Only its owner writes a buffer: it fills the slot at writeCount and then
+ * publishes it by advancing writeCount (release). A dump copies the newest slots and
+ * then reads writeCount again: any slot the owner may have overwritten meanwhile (it
+ * has lapped it) is discarded, so the dump never needs a lock either.
+ */
+
+#include "trace.h"
+#include "scheduler.h"
+
+#include <assert.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SPAN_MASK (TRACE_BUFFER_SPANS - 1)
+#define NS_PER_SECOND 1000000000LL
+#define NS_PER_US 1000.0
+#define MAX_THREAD_NAME 16
+
+typedef struct {
+    const char *name;
+    long long beginNs;
+    long long endNs;
+} Span_t;
+
+typedef struct {
+    atomic_bool isReady;        // Set once the owner has filled in its thread
+    int threadId;
+    char threadName[MAX_THREAD_NAME];
+    atomic_ullong writeCount;
+    Span_t spans[TRACE_BUFFER_SPANS];
+} Buffer_t;
+
+static bool isInitialized = false;
+static Buffer_t buffers[TRACE_MAX_THREADS];
+static atomic_int numBuffers = 0;
+static _Thread_local Buffer_t *pThreadBuffer = NULL;
+static int signalFd = -1;
+static int signalTask = -1;
+
+static long long getNowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+// Dump on SIGUSR1 (scheduler task).
+static void onSignal(void *pContext)
+{
+    (void)pContext;
+    struct signalfd_siginfo info;
+    if (read(signalFd, &info, sizeof(info)) != sizeof(info)) {
+        return;
+    }
+    int numSpans = Trace_dump(TRACE_DEFAULT_FILE, TRACE_DEFAULT_SECONDS);
+    printf("Trace: wrote %d spans to %s\n", numSpans, TRACE_DEFAULT_FILE);
+}
+
+void Trace_init(void)
+{
+    assert(!isInitialized);
+    // Block SIGUSR1 here, so threads started later inherit it blocked, and take it
+    // from a signalfd instead: the dump then runs as a normal task.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signalFd = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (signalFd == -1) {
+        perror("ERROR: Unable to create trace signal fd");
+        exit(EXIT_FAILURE);
+    }
+    signalTask = Scheduler_addFd("trace signal", signalFd, &onSignal, NULL);
+    isInitialized = true;
+}
+
+void Trace_cleanup(void)
+{
+    assert(isInitialized);
+    Scheduler_remove(signalTask);
+    close(signalFd);
+    isInitialized = false;
+}
+
+// The calling thread's buffer, claimed on its first span; NULL if none are left.
+static Buffer_t *getThreadBuffer(void)
+{
+    if (pThreadBuffer) {
+        return pThreadBuffer;
+    }
+    int index = atomic_fetch_add(&numBuffers, 1);
+    if (index >= TRACE_MAX_THREADS) {
+        // Keep the count at the limit; this thread's spans are not recorded
+        atomic_fetch_sub(&numBuffers, 1);
+        return NULL;
+    }
+    Buffer_t *pBuffer = &buffers[index];
+    pBuffer->threadId = syscall(SYS_gettid);
+    prctl(PR_GET_NAME, pBuffer->threadName);
+    atomic_store_explicit(&pBuffer->writeCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&pBuffer->isReady, true, memory_order_release);
+    pThreadBuffer = pBuffer;
+    return pBuffer;
+}
+
+void Trace_nameThread(const char *name)
+{
+    prctl(PR_SET_NAME, name);
+}
+
+long long Trace_begin(void)
+{
+    return getNowNs();
+}
+
+void Trace_end(const char *name, long long beginNs)
+{
+    Trace_record(name, beginNs, getNowNs());
+}
+
+void Trace_record(const char *name, long long beginNs, long long endNs)
+{
+    Buffer_t *pBuffer = getThreadBuffer();
+    if (!pBuffer) {
+        return;
+    }
+    unsigned long long count = atomic_load_explicit(&pBuffer->writeCount, memory_order_relaxed);
+    Span_t *pSpan = &pBuffer->spans[count & SPAN_MASK];
+    pSpan->name = name;
+    pSpan->beginNs = beginNs;
+    pSpan->endNs = endNs;
+    atomic_store_explicit(&pBuffer->writeCount, count + 1, memory_order_release);
+}
+
+// Write a buffer's spans which ended after sinceNs. Returns how many.
+static int dumpBuffer(FILE *pFile, Buffer_t *pBuffer, long long sinceNs, bool *pIsFirst)
+{
+    static Span_t copy[TRACE_BUFFER_SPANS];
+    unsigned long long endCount = atomic_load_explicit(&pBuffer->writeCount, memory_order_acquire);
+    unsigned long long beginCount = endCount > TRACE_BUFFER_SPANS ? endCount - TRACE_BUFFER_SPANS : 0;
+    for (unsigned long long i = beginCount; i < endCount; i++) {
+        copy[i - beginCount] = pBuffer->spans[i & SPAN_MASK];
+    }
+    // Spans the owner lapped while they were copied may be torn: skip them
+    atomic_thread_fence(memory_order_acquire);
+    unsigned long long laterCount = atomic_load_explicit(&pBuffer->writeCount, memory_order_relaxed);
+    unsigned long long firstValid = laterCount > TRACE_BUFFER_SPANS ? laterCount - TRACE_BUFFER_SPANS : 0;
+
+    int numSpans = 0;
+    for (unsigned long long i = beginCount; i < endCount; i++) {
+        const Span_t *pSpan = &copy[i - beginCount];
+        if (i < firstValid || pSpan->endNs < sinceNs) {
+            continue;
+        }
+        fprintf(pFile, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+            *pIsFirst ? "" : ",", pSpan->name, pSpan->beginNs / NS_PER_US,
+            (pSpan->endNs - pSpan->beginNs) / NS_PER_US, (int)getpid(), pBuffer->threadId);
+        *pIsFirst = false;
+        numSpans++;
+    }
+    return numSpans;
+}
+
+int Trace_dump(const char *path, int numSeconds)
+{
+    assert(isInitialized);
+    FILE *pFile = fopen(path, "w");
+    if (!pFile) {
+        perror("ERROR: Unable to write trace");
+        return -1;
+    }
+    long long sinceNs = getNowNs() - numSeconds * NS_PER_SECOND;
+    int count = atomic_load(&numBuffers);
+    if (count > TRACE_MAX_THREADS) {
+        count = TRACE_MAX_THREADS;
+    }
+
+    fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool isFirst = true;
+    int numSpans = 0;
+    for (int i = 0; i < count; i++) {
+        Buffer_t *pBuffer = &buffers[i];
+        if (!atomic_load_explicit(&pBuffer->isReady, memory_order_acquire)) {
+            continue;
+        }
+        // Name the thread's row on the timeline
+        fprintf(pFile, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            isFirst ? "" : ",", (int)getpid(), pBuffer->threadId, pBuffer->threadName);
+        isFirst = false;
+        numSpans += dumpBuffer(pFile, pBuffer, sinceNs, &isFirst);
+    }
+    fprintf(pFile, "\n]}\n");
+    if (fclose(pFile) != 0) {
+        perror("ERROR: Unable to write trace");
+        return -1;
+    }
+    return numSpans;
+}
@@ -12,7 +12,40 @@
  * - volume null: Get the current volume
  * - tempo <tempo>: Set the tempo to <tempo> (BPM)
  * - tempo null: Get the current tempo
+ * - ramp <tempo> <bars> [lin|exp]: Ramp the tempo to <tempo> over <bars> bars
  * - play <song>: Play the specified song (0 = base drum, 1 = hi-hat, 2 = snare)
+ * - kit <kit>: Play drums from wave files (0) or synthesized voices (1)
+ * - kit null: Get the current kit
+ * - tune <song> <param> <value>: Set a parameter of a drum's synthesized voice
+ * - bench: Report the mixing cost of each drum as a sample and as a synth voice
+ * - swing <percent>: Set the swing of the playing pattern (50 = straight)
+ * - swing null: Get the current swing
+ * - humanize <timing> <velocity> [seed]: Set the random timing (% of a step) and
+ *   velocity (%) variation of the playing pattern
+ * - humanize null: Get the current humanize amounts
+ * - loop rec|stop|undo: Start/stop recording live hits into the pattern, or undo the
+ *   newest recorded pass
+ * - loop grid <steps>: Quantize recorded hits to every <steps> steps
+ * - loop null: Get the looper state
+ * - tap <source>: Take tap tempo taps from nothing (0), joystick presses (1) or
+ *   accelerometer knocks (2)
+ * - tap null: Get the tap source and the tap-to-applied latency statistics
+ * - pattern <text>: Play the pattern in <text> (pattern file format, see pattern.h;
+ *   directives separated by ';' or newlines) from the next bar
+ * - accel <mode>: Sample accelerometer gestures by polling (0), from its FIFO (1),
+ *   or with its interrupt-driven tap detection (2)
+ * - accel trace <file>|off: Record accelerometer samples and detected hits to a CSV file
+ *   in TRACE_DIRECTORY (<file> is a plain file name)
+ * - accel replay <file>: Replay a recorded trace through a new onset detector, and get
+ *   its hit counts, hit rate and latency, and how its hits match the recorded ones
+ * - accel stats: Get the onset detector's hit counts, hit rate and detection latency
+ * - accel null: Get the accelerometer mode
+ * - i2c: Get the I2C transfer count, errors, latency and queueing delay of each device
+ * - sched: Get the run time, lateness and missed deadlines of each scheduler task
+ * - stats: Get the last second's statistics of every probe (see probes.h)
+ * - trace [seconds] [file]: Write the spans of the last seconds (default 5) to file
+ *   (default beatbox-trace.json) in TRACE_DIRECTORY as Chrome trace-event JSON (see
+ *   trace.h); <file> is a plain file name
  * - stop: Stop the listener and exit the program
  * 
  * The listener responds to each command with an acknowledgment message.
@@ -27,18 +60,31 @@
 #include <stdatomic.h> 
 #include <stdbool.h>
 #include <assert.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include "beatPlayer.h"
+#include "looper.h"
+#include "tapTempo.h"
+#include "onsetDetector.h"
+#include "hal/accelerometer.h"
+#include "hal/joystick.h"
+#include "scheduler.h"
+#include "probes.h"
+#include "trace.h"
 
 #define PORT 12345
 #define BUFFER_SIZE 1024
 #define HELP_BUFFER_SIZE 512
 #define SHORT_BUFFER_SIZE 64
+#define NS_PER_MS 1000000.0
 #define MAX_UDP_BUFFER_SIZE 1500
 #define DRUM_NUM 0 
 #define HITHAT_NUM 1
 #define SNARE_NUM 2
+#define TRACE_DIRECTORY "beatbox-traces"
 
-static pthread_t udp_thread;
+static int udp_task = -1;
+static Probe *commandProbe = NULL;
 static int sockfd;
 static struct sockaddr_in server_addr, client_addr;
 static socklen_t addr_len = sizeof(client_addr);
@@ -86,6 +132,17 @@ void handle_tempo(const char* arg, char* response) {
     }
 }
 
+void handle_ramp(const char* arg, char* response) {
+    int tempo, bars;
+    char shape[SHORT_BUFFER_SIZE] = "lin";
+    if (sscanf(arg, "%d %d %63s", &tempo, &bars, shape) < 2) {
+        snprintf(response, BUFFER_SIZE, "Invalid ramp command");
+        return;
+    }
+    BeatPlayer_rampBPM(tempo, bars, strcmp(shape, "exp") == 0);
+    snprintf(response, BUFFER_SIZE, "%d %d %s", tempo, bars, shape);
+}
+
 void handle_play(const char* arg, char* response) {
     int song = atoi(arg);
     snprintf(response, BUFFER_SIZE, "%d", song);
@@ -98,10 +155,237 @@ void handle_play(const char* arg, char* response) {
     }
 }
 
+void handle_kit(const char* arg, char* response) {
+    if (strcmp(arg, "null") == 0) {
+        snprintf(response, BUFFER_SIZE, "%d", BeatPlayer_getKit());
+    } else {
+        BeatPlayer_setKit(atoi(arg));
+        snprintf(response, BUFFER_SIZE, "%d", BeatPlayer_getKit());
+    }
+}
+
+void handle_tune(const char* arg, char* response) {
+    int song;
+    char param[SHORT_BUFFER_SIZE];
+    float value;
+    if (sscanf(arg, "%d %63s %f", &song, param, &value) == 3
+            && BeatPlayer_tuneSynth(song, param, value)) {
+        snprintf(response, BUFFER_SIZE, "%d %s %g", song, param, value);
+    } else {
+        snprintf(response, BUFFER_SIZE, "Invalid tune command");
+    }
+}
+
+void handle_bench(const char* arg, char* response) {
+    (void)arg;  // Unused parameter
+    BeatPlayer_benchmarkKits(response, BUFFER_SIZE);
+}
+
+void handle_swing(const char* arg, char* response) {
+    if (strcmp(arg, "null") != 0) {
+        BeatPlayer_setSwing(atoi(arg));
+    }
+    snprintf(response, BUFFER_SIZE, "%d", BeatPlayer_getSwing());
+}
+
+void handle_humanize(const char* arg, char* response) {
+    int timing, velocity;
+    unsigned int seed;
+    if (strcmp(arg, "null") != 0) {
+        int count = sscanf(arg, "%d %d %u", &timing, &velocity, &seed);
+        if (count < 2) {
+            snprintf(response, BUFFER_SIZE, "Invalid humanize command");
+            return;
+        }
+        if (count == 3) {
+            BeatPlayer_setHumanizeSeed(seed);
+        }
+        BeatPlayer_setHumanize(timing, velocity);
+    }
+    BeatPlayer_getHumanize(&timing, &velocity);
+    snprintf(response, BUFFER_SIZE, "%d %d", timing, velocity);
+}
+
+void handle_loop(const char* arg, char* response) {
+    int gridSteps;
+    if (strcmp(arg, "rec") == 0) {
+        Looper_setRecording(true);
+    } else if (strcmp(arg, "stop") == 0) {
+        Looper_setRecording(false);
+    } else if (strcmp(arg, "undo") == 0) {
+        Looper_undo();
+    } else if (sscanf(arg, "grid %d", &gridSteps) == 1) {
+        Looper_setGrid(gridSteps);
+    } else if (strcmp(arg, "null") != 0) {
+        snprintf(response, BUFFER_SIZE, "Invalid loop command");
+        return;
+    }
+    snprintf(response, BUFFER_SIZE, "%s grid %d dropped %d",
+        Looper_isRecording() ? "rec" : "stop", Looper_getGrid(), Looper_getNumDropped());
+}
+
+void handle_tap(const char* arg, char* response) {
+    if (strcmp(arg, "null") != 0) {
+        BeatPlayer_setTapSource(atoi(arg));
+    }
+    TapTempo_statistics_t stats = TapTempo_getStatistics();
+    snprintf(response, BUFFER_SIZE, "%d latency[%.1f, %.1f] avg %.1f last %.1f ms/%d",
+        BeatPlayer_getTapSource(), stats.minLatencyInMs, stats.maxLatencyInMs,
+        stats.avgLatencyInMs, stats.lastLatencyInMs, stats.numSamples);
+}
+
+void handle_pattern(const char* arg, char* response) {
+    char error[SHORT_BUFFER_SIZE];
+    if (BeatPlayer_playUploadedPattern(arg, error, sizeof(error))) {
+        BeatPlayer_getPlayingName(response, BUFFER_SIZE);
+    } else {
+        snprintf(response, BUFFER_SIZE, "Invalid pattern: %s", error);
+    }
+}
+
+// Files written for a client only go in TRACE_DIRECTORY: write the path of the file
+// called name there into path. Returns false if name is not a plain file name.
+static bool get_trace_path(const char* name, char* path, int size) {
+    if (name[0] == '\0' || strchr(name, '/') || strstr(name, "..")) {
+        return false;
+    }
+    if (mkdir(TRACE_DIRECTORY, 0755) != 0 && errno != EEXIST) {
+        perror("ERROR: Unable to create " TRACE_DIRECTORY);
+        return false;
+    }
+    return snprintf(path, size, "%s/%s", TRACE_DIRECTORY, name) < size;
+}
+
+void handle_accel(const char* arg, char* response) {
+    if (strncmp(arg, "trace ", strlen("trace ")) == 0) {
+        const char *name = arg + strlen("trace ");
+        if (strcmp(name, "off") == 0) {
+            BeatPlayer_setAccelTrace(NULL);
+            snprintf(response, BUFFER_SIZE, "trace off");
+            return;
+        }
+        char path[SHORT_BUFFER_SIZE];
+        if (!get_trace_path(name, path, sizeof(path))) {
+            snprintf(response, BUFFER_SIZE, "Invalid trace file name");
+        } else if (BeatPlayer_setAccelTrace(path)) {
+            snprintf(response, BUFFER_SIZE, "trace %s", path);
+        } else {
+            snprintf(response, BUFFER_SIZE, "Unable to open %s", path);
+        }
+        return;
+    }
+    if (strncmp(arg, "replay ", strlen("replay ")) == 0) {
+        char path[SHORT_BUFFER_SIZE];
+        OnsetDetector_config_t config;
+        OnsetDetector_replay_t replay;
+        OnsetDetector_getDefaultConfig(&config, ACCELEROMETER_STREAM_ODR_HZ);
+        if (!get_trace_path(arg + strlen("replay "), path, sizeof(path))
+                || !OnsetDetector_replay(path, &config, &replay)) {
+            snprintf(response, BUFFER_SIZE, "Unable to replay %s", arg + strlen("replay "));
+            return;
+        }
+        const OnsetDetector_statistics_t *pStats = &replay.stats;
+        long long numHits = pStats->numHits[ONSET_AXIS_X] + pStats->numHits[ONSET_AXIS_Y] + pStats->numHits[ONSET_AXIS_Z];
+        snprintf(response, BUFFER_SIZE, "replay %d Hz: hits %lld/%lld/%lld %.1f/min latency avg %.2f max %.2f ms; "
+            "recorded %lld matched %lld missed %lld extra %lld offset avg %.2f max %.2f ms",
+            replay.sampleRateHz, pStats->numHits[ONSET_AXIS_X], pStats->numHits[ONSET_AXIS_Y],
+            pStats->numHits[ONSET_AXIS_Z], replay.hitsPerMinute,
+            numHits ? (double)pStats->totalLatencyNs / numHits / NS_PER_MS : 0.0,
+            (double)pStats->maxLatencyNs / NS_PER_MS, replay.numRecordedHits, replay.numMatched,
+            replay.numMissed, replay.numExtra, replay.avgOffsetInMs, replay.maxOffsetInMs);
+        return;
+    }
+    if (strcmp(arg, "stats") == 0) {
+        OnsetDetector_statistics_t stats;
+        double hitsPerMinute;
+        BeatPlayer_getOnsetStatistics(&stats, &hitsPerMinute);
+        long long numHits = stats.numHits[ONSET_AXIS_X] + stats.numHits[ONSET_AXIS_Y] + stats.numHits[ONSET_AXIS_Z];
+        snprintf(response, BUFFER_SIZE, "hits %lld/%lld/%lld %.1f/min latency avg %.2f max %.2f ms",
+            stats.numHits[ONSET_AXIS_X], stats.numHits[ONSET_AXIS_Y], stats.numHits[ONSET_AXIS_Z],
+            hitsPerMinute, numHits ? (double)stats.totalLatencyNs / numHits / NS_PER_MS : 0.0,
+            (double)stats.maxLatencyNs / NS_PER_MS);
+        return;
+    }
+    if (strcmp(arg, "null") != 0) {
+        BeatPlayer_setAccelMode(atoi(arg));
+    }
+    snprintf(response, BUFFER_SIZE, "%d", BeatPlayer_getAccelMode());
+}
+
+static int format_bus_statistics(char* response, int size, const char *name, I2cStatistics stats) {
+    return snprintf(response, size, "%s: %lld transfers, %lld errors, latency avg %.3f max %.3f ms, wait max %.3f ms\n",
+        name, stats.numTransfers, stats.numErrors, stats.avgLatencyInMs, stats.maxLatencyInMs, stats.maxWaitInMs);
+}
+
+void handle_i2c(const char* arg, char* response) {
+    (void)arg;  // Unused parameter
+    int length = format_bus_statistics(response, BUFFER_SIZE, "accelerometer", Accelerometer_getBusStatistics());
+    if (length < BUFFER_SIZE) {
+        format_bus_statistics(response + length, BUFFER_SIZE - length, "joystick", Joystick_getBusStatistics());
+    }
+}
+
+void handle_sched(const char* arg, char* response) {
+    (void)arg;  // Unused parameter
+    Scheduler_taskStatistics_t stats[SCHEDULER_MAX_TASKS];
+    int count = Scheduler_getStatistics(stats, SCHEDULER_MAX_TASKS);
+    int length = 0;
+    response[0] = '\0';
+    for (int i = 0; i < count && length < BUFFER_SIZE; i++) {
+        length += snprintf(response + length, BUFFER_SIZE - length,
+            "%s: %lld runs, run avg %.3f max %.3f ms", stats[i].name, stats[i].numRuns,
+            stats[i].avgRunInMs, stats[i].maxRunInMs);
+        if (stats[i].isTimer && length < BUFFER_SIZE) {
+            length += snprintf(response + length, BUFFER_SIZE - length,
+                ", late avg %.3f max %.3f ms, %lld missed", stats[i].avgLatenessInMs,
+                stats[i].maxLatenessInMs, stats[i].numMissed);
+        }
+        if (length < BUFFER_SIZE) {
+            length += snprintf(response + length, BUFFER_SIZE - length, "\n");
+        }
+    }
+}
+
+void handle_stats(const char* arg, char* response) {
+    (void)arg;  // Unused parameter
+    Probe_statistics_t stats[PROBES_MAX];
+    int count = Probes_getStatistics(stats, PROBES_MAX);
+    int length = 0;
+    response[0] = '\0';
+    for (int i = 0; i < count && length < BUFFER_SIZE; i++) {
+        length += Probe_format(&stats[i], response + length, BUFFER_SIZE - length);
+        if (length < BUFFER_SIZE) {
+            length += snprintf(response + length, BUFFER_SIZE - length, "\n");
+        }
+    }
+}
+
+void handle_trace(const char* arg, char* response) {
+    int seconds = TRACE_DEFAULT_SECONDS;
+    char name[SHORT_BUFFER_SIZE] = TRACE_DEFAULT_FILE;
+    char path[SHORT_BUFFER_SIZE];
+    sscanf(arg, "%d %63s", &seconds, name);
+    if (seconds <= 0) {
+        snprintf(response, BUFFER_SIZE, "Invalid trace length");
+        return;
+    }
+    if (!get_trace_path(name, path, sizeof(path))) {
+        snprintf(response, BUFFER_SIZE, "Invalid trace file name");
+        return;
+    }
+    int numSpans = Trace_dump(path, seconds);
+    if (numSpans < 0) {
+        snprintf(response, BUFFER_SIZE, "Unable to write %s", path);
+    } else {
+        snprintf(response, BUFFER_SIZE, "trace: %d spans in %s", numSpans, path);
+    }
+}
+
 void handle_stop(const char* arg, char* response) {
     (void)arg;  // Unused parameter
     snprintf(response, BUFFER_SIZE, "stop");
     running = false;
+    Scheduler_stop();
 }
 
 // Command list
@@ -109,45 +393,68 @@ Command commands[] = {
     {"mode", handle_mode},
     {"volume", handle_volume},
     {"tempo", handle_tempo},
+    {"ramp", handle_ramp},
     {"play", handle_play},
+    {"kit", handle_kit},
+    {"tune", handle_tune},
+    {"bench", handle_bench},
+    {"swing", handle_swing},
+    {"humanize", handle_humanize},
+    {"loop", handle_loop},
+    {"tap", handle_tap},
+    {"pattern", handle_pattern},
+    {"accel", handle_accel},
+    {"i2c", handle_i2c},
+    {"sched", handle_sched},
+    {"stats", handle_stats},
+    {"trace", handle_trace},
     {"stop", handle_stop},
 };
 const int command_count = sizeof(commands) / sizeof(commands[0]);
 
-void* udp_listener_thread(void* arg) {
-    (void)arg;
-    char buffer[BUFFER_SIZE];
+// Scheduler task: runs each time a datagram is waiting on the socket.
+static void udp_listener_task(void* pContext) {
+    (void)pContext;
+    char buffer[MAX_UDP_BUFFER_SIZE];
     char response[BUFFER_SIZE];
     ssize_t received_len;
 
-    while (running) {
-        received_len = recvfrom(sockfd, buffer, BUFFER_SIZE - 1, 0, (struct sockaddr*)&client_addr, &addr_len);
-        if (received_len < 0) {
-            perror("Receive failed");
-            continue;
-        }
-        buffer[received_len] = '\0';
-        buffer[strcspn(buffer, "\r\n")] = '\0';
-        
-        char command[BUFFER_SIZE], arg[BUFFER_SIZE] = "";
-        sscanf(buffer, "%s %s", command, arg);
-
-        bool handled = false;
-        for (int i = 0; i < command_count; i++) {
-            if (strcmp(command, commands[i].command) == 0) {
-                commands[i].handler(arg, response);
-                handled = true;
-                break;
-            }
-        }
-        
-        if (!handled) {
-            snprintf(response, BUFFER_SIZE, "Unknown command");
-        }
+    addr_len = sizeof(client_addr);
+    received_len = recvfrom(sockfd, buffer, MAX_UDP_BUFFER_SIZE - 1, MSG_DONTWAIT, (struct sockaddr*)&client_addr, &addr_len);
+    if (received_len < 0) {
+        perror("Receive failed");
+        return;
+    }
+    // Strip trailing newlines only: a pattern upload may span several lines
+    while (received_len > 0 && (buffer[received_len - 1] == '\n' || buffer[received_len - 1] == '\r')) {
+        received_len--;
+    }
+    buffer[received_len] = '\0';
+    Probe_add(commandProbe, 1);
 
-        sendto(sockfd, response, strlen(response), 0, (struct sockaddr*)&client_addr, addr_len);
+    // Handlers get the rest of the datagram, so commands can take several arguments
+    char command[MAX_UDP_BUFFER_SIZE] = "";
+    int command_len = 0;
+    sscanf(buffer, "%s%n", command, &command_len);
+    const char *arg = buffer + command_len;
+    arg += strspn(arg, " \t\r\n");
+
+    bool handled = false;
+    for (int i = 0; i < command_count; i++) {
+        if (strcmp(command, commands[i].command) == 0) {
+            long long spanNs = Trace_begin();
+            commands[i].handler(arg, response);
+            Trace_end(commands[i].command, spanNs);
+            handled = true;
+            break;
+        }
     }
-    return NULL;
+    
+    if (!handled) {
+        snprintf(response, BUFFER_SIZE, "Unknown command");
+    }
+
+    sendto(sockfd, response, strlen(response), 0, (struct sockaddr*)&client_addr, addr_len);
 }
 
 /*
@@ -251,12 +558,13 @@ void UdpListener_init(void) {
         exit(EXIT_FAILURE);
     }
 
-    pthread_create(&udp_thread, NULL, udp_listener_thread, NULL);
+    commandProbe = Probe_register("udp commands", PROBE_COUNTER);
+    udp_task = Scheduler_addFd("udp", sockfd, &udp_listener_task, NULL);
 }
 
 void UdpListener_cleanup(void) {
     assert(isInitialized);
-    pthread_join(udp_thread, NULL);
+    Scheduler_remove(udp_task);
     close(sockfd);
     isInitialized = false;
 }
@@ -14,14 +14,18 @@
 #include <stdlib.h>		//exit()
 #include <signal.h>     //signal()
 #include <stdbool.h>
+#include <string.h>
 #include <assert.h>
 #include "pthread.h"
 #include "updateLcd.h"
 #include "beatPlayer.h"
-#include "periodTimer.h"
+#include "probes.h"
+#include "pattern.h"
 #include "terminalOutput.h"
 #include "hal/joystick.h"
+#include "hal/accelSampler.h"
 #include "sleep_timer_helper.h"
+#include "trace.h"
 
 #define DELAY_MS 2000
 #define SLEEP_MS 10
@@ -33,13 +37,22 @@
 #define DIPS_X 120
 #define MAX_MS_X 160
 #define VALUE_OFFSET 40
+#define SMALL_NEXTLINE_Y 20
+#define PROBE_LINE_Y 16
+#define TIMING_LINE_Y 24
+#define TIMING_TITLE_Y 30
+#define MAX_WIDGETS 32
+#define MAX_WIDGET_TEXT 40
 #define statBufferSize 12
+#define lineBufferSize 24
 
 static UWORD *s_fb;
 static bool isInitialized = false;
 static char volume[statBufferSize];
-static char beatMode[statBufferSize];
+static char beatMode[PATTERN_MAX_NAME];
 static char bpm[statBufferSize];
+static char knob[lineBufferSize];
+static char groove[lineBufferSize];
 static char minAudioMs[statBufferSize];
 static char maxAudioMs[statBufferSize];
 static char avgAudioMs[statBufferSize]; 
@@ -47,9 +60,40 @@ static char avgAudioMs[statBufferSize];
 static char minAccelMs[statBufferSize];
 static char maxAccelMs[statBufferSize];
 static char avgAccelMs[statBufferSize];
+static char accelReading[lineBufferSize];
+static char percentiles[lineBufferSize];
+static char probeLine[2 * lineBufferSize];
 static pthread_t outputThread;
+static Probe *frameProbe = NULL;    // Time to draw and send a frame
+static Probe *spiProbe = NULL;      // Bytes of pixels sent to the LCD
+
+// The text drawn on the LCD, in drawing order, so a frame only repaints (and sends)
+// the pieces which changed. Each piece of text is a widget; the area it covered
+// before and covers now is damaged and must be sent.
+typedef struct {
+    UWORD xStart, yStart, xEnd, yEnd;   // Ends exclusive
+} Rect_t;
+typedef struct {
+    UWORD x, y;
+    sFONT *pFont;
+    char text[MAX_WIDGET_TEXT];
+    Rect_t area;
+} Widget_t;
+static Widget_t widgets[MAX_WIDGETS];
+static int numShownWidgets = 0;     // Widgets on the LCD
+static int numFrameWidgets = 0;     // Widgets drawn so far this frame
+static Rect_t damage[2 * MAX_WIDGETS];
+static int numDamaged = 0;
+static bool isFullRedraw = true;    // Repaint and send everything (e.g. a new page)
+static int shownPage = 0;
 static bool isRunning = false;
 static void* UpdateLcdThread(void* args);
+static int drawPercentiles(int x, int y, const Probe_statistics_t *pStat);
+static void drawProbes(int x, int y);
+static void drawBeatTiming(int x, int y);
+static void drawText(int x, int y, const char *text, sFONT *pFont);
+static void eraseArea(const Rect_t *pArea, int widget);
+static void flushDamage(void);
 void UpdateLcd_init()
 {
     assert(!isInitialized);
@@ -74,7 +118,10 @@ void UpdateLcd_init()
         perror("Failed to apply for black memory");
         exit(0);
     }
+    Paint_NewImage(s_fb, LCD_1IN54_WIDTH, LCD_1IN54_HEIGHT, 0, WHITE, 16);
     isRunning = true;
+    frameProbe = Probe_register("lcd frame", PROBE_DURATION);
+    spiProbe = Probe_register("lcd spi bytes", PROBE_COUNTER);
     isInitialized = true;
     pthread_create(&outputThread, NULL, &UpdateLcdThread, NULL);
 }
@@ -95,6 +142,7 @@ void UpdateLcd_cleanup()
 static void* UpdateLcdThread(void* args) {
     (void) args;
     assert(isInitialized);
+    Trace_nameThread("lcd");
     while (isRunning) {
         UpdateLcd_withPage(Joystick_getPageCount());
         sleepForMs(SLEEP_MS);
@@ -109,72 +157,269 @@ void UpdateLcd_withPage(int page)
 
     const int x = INITIAL_X;
     int y = INITIAL_Y;
+    long long frameBeginNs = Probe_beginDuration();
+    long long spanNs = Trace_begin();
 
-    // Initialize the RAM frame buffer to be blank (white)
-    Paint_NewImage(s_fb, LCD_1IN54_WIDTH, LCD_1IN54_HEIGHT, 0, WHITE, 16);
-    Paint_Clear(WHITE);
-    Period_statistics_t audioStat = TerminalOutput_getAudioStats();
-    Period_statistics_t accelStat = TerminalOutput_getAccelStats();
-    int beatModeNum = BeatPlayer_getBeatMode();
+    // A new page starts from a blank (white) frame buffer; otherwise only the
+    // widgets which changed are repainted
+    if (page != shownPage) {
+        shownPage = page;
+        isFullRedraw = true;
+    }
+    if (isFullRedraw) {
+        Paint_Clear(WHITE);
+        numShownWidgets = 0;
+    }
+    numFrameWidgets = 0;
+    numDamaged = 0;
+    Probe_statistics_t audioStat = TerminalOutput_getAudioStats();
+    Probe_statistics_t accelStat = TerminalOutput_getAccelStats();
     switch (page)
     {
         case 1: // Status Screen
-            if (beatModeNum == NONE_MODE) {
-                sprintf(beatMode, "%s", "None");
-            } else if (beatModeNum == ROCK_MODE) {
-                sprintf(beatMode, "%s", "Rock");
-            } else {
-                sprintf(beatMode, "%s", "Custom");
-            }
+            BeatPlayer_getPlayingName(beatMode, sizeof(beatMode));
             sprintf(volume, "%d", BeatPlayer_getVolume());
             sprintf(bpm, "%d", BeatPlayer_getBpm());
-            Paint_DrawString_EN(x, y, "Current Beat:", &Font20, WHITE, BLACK);
+            drawText(x, y, "Current Beat:", &Font20);
+            y += NEXTLINE_Y;
+            drawText(x, y, beatMode, &Font24);
             y += NEXTLINE_Y;
-            Paint_DrawString_EN(x, y, beatMode, &Font24, WHITE, BLACK);
+            int humanizeTiming, humanizeVelocity;
+            BeatPlayer_getHumanize(&humanizeTiming, &humanizeVelocity);
+            snprintf(groove, sizeof(groove), "Sw %d%% Hu %d/%d%%",
+                BeatPlayer_getSwing(), humanizeTiming, humanizeVelocity);
+            snprintf(knob, sizeof(knob), "Knob: %s", BeatPlayer_getKnobTargetName(BeatPlayer_getKnobTarget()));
+            drawText(x, y, groove, &Font16);
             y += NEXTLINE_Y;
-            Paint_DrawString_EN(x, LCD_1IN54_HEIGHT - VALUE_OFFSET, "Vol:", &Font16, WHITE, BLACK);
-            Paint_DrawString_EN(x + VALUE_OFFSET, LCD_1IN54_HEIGHT - VALUE_OFFSET, volume, &Font16, WHITE, BLACK);
-            Paint_DrawString_EN(LCD_1IN54_WIDTH - (VALUE_OFFSET * 2), LCD_1IN54_HEIGHT - VALUE_OFFSET, "BPM:", &Font16, WHITE, BLACK);
-            Paint_DrawString_EN(LCD_1IN54_WIDTH - VALUE_OFFSET, LCD_1IN54_HEIGHT - VALUE_OFFSET, bpm, &Font16, WHITE, BLACK);
+            drawText(x, y, knob, &Font16);
+            y += NEXTLINE_Y;
+            drawText(x, LCD_1IN54_HEIGHT - VALUE_OFFSET, "Vol:", &Font16);
+            drawText(x + VALUE_OFFSET, LCD_1IN54_HEIGHT - VALUE_OFFSET, volume, &Font16);
+            drawText(LCD_1IN54_WIDTH - (VALUE_OFFSET * 2), LCD_1IN54_HEIGHT - VALUE_OFFSET, "BPM:", &Font16);
+            drawText(LCD_1IN54_WIDTH - VALUE_OFFSET, LCD_1IN54_HEIGHT - VALUE_OFFSET, bpm, &Font16);
             break;
 
         case 2: // Audio Timing Summary
-            sprintf(minAudioMs, "%.3f ms", audioStat.minPeriodInMs);
-            sprintf(maxAudioMs, "%.3f ms", audioStat.maxPeriodInMs);
-            sprintf(avgAudioMs, "%.3f ms", audioStat.avgPeriodInMs);
-            Paint_DrawString_EN(x, y, "Audio Timing", &Font20, WHITE, BLACK);
-            y += NEXTLINE_Y;
-            Paint_DrawString_EN(x, y, "Min: ", &Font16, WHITE, BLACK);
-            Paint_DrawString_EN(x + VALUE_OFFSET, y, minAudioMs, &Font16, WHITE, BLACK);
-            y += NEXTLINE_Y;
-            Paint_DrawString_EN(x, y, "Max: ", &Font16, WHITE, BLACK);
-            Paint_DrawString_EN(x + VALUE_OFFSET, y, maxAudioMs, &Font16, WHITE, BLACK);
-            y += NEXTLINE_Y;
-            Paint_DrawString_EN(x, y, "Avg: ", &Font16, WHITE, BLACK);
-            Paint_DrawString_EN(x + VALUE_OFFSET, y, avgAudioMs, &Font16, WHITE, BLACK);
+            sprintf(minAudioMs, "%.3f ms", audioStat.minInMs);
+            sprintf(maxAudioMs, "%.3f ms", audioStat.maxInMs);
+            sprintf(avgAudioMs, "%.3f ms", audioStat.avgInMs);
+            // Tighter lines than the other pages, to fit the beat timing below
+            drawText(x, y, "Audio Timing", &Font20);
+            y += TIMING_TITLE_Y;
+            drawText(x, y, "Min: ", &Font16);
+            drawText(x + VALUE_OFFSET, y, minAudioMs, &Font16);
+            y += TIMING_LINE_Y;
+            drawText(x, y, "Max: ", &Font16);
+            drawText(x + VALUE_OFFSET, y, maxAudioMs, &Font16);
+            y += TIMING_LINE_Y;
+            drawText(x, y, "Avg: ", &Font16);
+            drawText(x + VALUE_OFFSET, y, avgAudioMs, &Font16);
+            y = drawPercentiles(x, y + SMALL_NEXTLINE_Y, &audioStat);
+            drawBeatTiming(x, y);
             break;
 
         case 3: // Accelerometer Timing Summary
-            sprintf(minAccelMs, "%.3f ms", accelStat.minPeriodInMs);
-            sprintf(maxAccelMs, "%.3f ms", accelStat.maxPeriodInMs);
-            sprintf(avgAccelMs, "%.3f ms", accelStat.avgPeriodInMs);
-            Paint_DrawString_EN(x, y, "Accel. Timing", &Font20, WHITE, BLACK);
+            sprintf(minAccelMs, "%.3f ms", accelStat.minInMs);
+            sprintf(maxAccelMs, "%.3f ms", accelStat.maxInMs);
+            sprintf(avgAccelMs, "%.3f ms", accelStat.avgInMs);
+            drawText(x, y, "Accel. Timing", &Font20);
             y += NEXTLINE_Y;
-            Paint_DrawString_EN(x, y, "Min: ", &Font16, WHITE, BLACK);
-            Paint_DrawString_EN(x + VALUE_OFFSET, y, minAccelMs, &Font16, WHITE, BLACK);
+            drawText(x, y, "Min: ", &Font16);
+            drawText(x + VALUE_OFFSET, y, minAccelMs, &Font16);
             y += NEXTLINE_Y;
-            Paint_DrawString_EN(x, y, "Max: ", &Font16, WHITE, BLACK);
-            Paint_DrawString_EN(x + VALUE_OFFSET, y, maxAccelMs, &Font16, WHITE, BLACK);
+            drawText(x, y, "Max: ", &Font16);
+            drawText(x + VALUE_OFFSET, y, maxAccelMs, &Font16);
             y += NEXTLINE_Y;
-            Paint_DrawString_EN(x, y, "Avg: ", &Font16, WHITE, BLACK);
-            Paint_DrawString_EN(x + VALUE_OFFSET, y, avgAccelMs, &Font16, WHITE, BLACK);
+            drawText(x, y, "Avg: ", &Font16);
+            drawText(x + VALUE_OFFSET, y, avgAccelMs, &Font16);
+            y = drawPercentiles(x, y + SMALL_NEXTLINE_Y, &accelStat);
+            // Newest sample from the sampler's ring: no extra I2C reads
+            AccelerometerSample latest;
+            if (AccelSampler_isRunning() && AccelSampler_getLatest(&latest)) {
+                snprintf(accelReading, sizeof(accelReading), "%.2f %.2f %.2f g",
+                    latest.data.x, latest.data.y, latest.data.z);
+                drawText(x, y, accelReading, &Font16);
+            }
+            break;
+
+        case 4: // Every probe
+            drawText(x, y, "Probes (ms)", &Font20);
+            drawProbes(x, y + NEXTLINE_Y);
             break;
 
         default:
-            Paint_DrawString_EN(x, y, "Invalid Page", &Font20, WHITE, BLACK);
+            drawText(x, y, "Invalid Page", &Font20);
             break;
     }
 
-    // Send the RAM frame buffer to the LCD (actually display it)
-    LCD_1IN54_Display(s_fb);
+    // Erase widgets from the last frame which were not drawn in this one
+    int numStale = numShownWidgets;
+    numShownWidgets = numFrameWidgets;
+    for (int i = numFrameWidgets; i < numStale; i++) {
+        eraseArea(&widgets[i].area, i);
+        damage[numDamaged++] = widgets[i].area;
+    }
+    Trace_end("lcd paint", spanNs);
+
+    // Send the changed parts of the RAM frame buffer to the LCD (actually display them)
+    spanNs = Trace_begin();
+    flushDamage();
+    Trace_end("lcd flush", spanNs);
+    Probe_endDuration(frameProbe, frameBeginNs);
+}
+
+// Draw the period percentiles on two short lines; returns the y of the next line.
+static int drawPercentiles(int x, int y, const Probe_statistics_t *pStat)
+{
+    snprintf(percentiles, sizeof(percentiles), "p50 %.2f p90 %.2f", pStat->p50InMs, pStat->p90InMs);
+    drawText(x, y, percentiles, &Font16);
+    y += SMALL_NEXTLINE_Y;
+    snprintf(percentiles, sizeof(percentiles), "p99 %.2f .999 %.2f", pStat->p99InMs, pStat->p999InMs);
+    drawText(x, y, percentiles, &Font16);
+    return y + SMALL_NEXTLINE_Y;
+}
+
+// Draw a short line for each probe, as many as fit: the average and p99 of
+// periods and durations, the value of counters and gauges.
+static void drawProbes(int x, int y)
+{
+    Probe_statistics_t stats[PROBES_MAX];
+    int numProbes = Probes_getStatistics(stats, PROBES_MAX);
+    for (int i = 0; i < numProbes && y + PROBE_LINE_Y <= LCD_1IN54_HEIGHT; i++) {
+        switch (stats[i].type) {
+            case PROBE_COUNTER:
+                snprintf(probeLine, sizeof(probeLine), "%-12.12s %lld %.0f/s",
+                    stats[i].name, stats[i].value, stats[i].ratePerSecond);
+                break;
+            case PROBE_GAUGE:
+                snprintf(probeLine, sizeof(probeLine), "%-12.12s %lld", stats[i].name, stats[i].value);
+                break;
+            default:
+                snprintf(probeLine, sizeof(probeLine), "%-12.12s %6.2f p99 %6.2f",
+                    stats[i].name, stats[i].avgInMs, stats[i].p99InMs);
+                break;
+        }
+        drawText(x, y, probeLine, &Font12);
+        y += PROBE_LINE_Y;
+    }
+}
+
+// Draw how far from the grid the last second's beats started (average/max, and the
+// count in each error bucket: on time, up to 1, 5 and 25 ms, over, and dropped) and
+// the drift of that error.
+static void drawBeatTiming(int x, int y)
+{
+    TerminalOutput_beatTiming_t timing = TerminalOutput_getBeatTiming();
+    const AudioMixer_startStatistics_t *pStarts = &timing.lastSecond;
+    snprintf(probeLine, sizeof(probeLine), "Beat %.2f/%.2f ms", pStarts->avgErrorInMs, pStarts->maxErrorInMs);
+    drawText(x, y, probeLine, &Font16);
+    y += SMALL_NEXTLINE_Y;
+    snprintf(probeLine, sizeof(probeLine), "0:%d 1:%d 5:%d 25:%d +:%d x:%d", pStarts->histogram[0],
+        pStarts->histogram[1], pStarts->histogram[2], pStarts->histogram[3], pStarts->histogram[4],
+        pStarts->numDropped);
+    drawText(x, y, probeLine, &Font12);
+    y += PROBE_LINE_Y;
+    snprintf(probeLine, sizeof(probeLine), "drift %+.2f ms/min", timing.driftInMsPerMinute);
+    drawText(x, y, probeLine, &Font12);
+}
+
+// The smallest rectangle covering both a and b.
+static Rect_t unionRect(Rect_t a, Rect_t b)
+{
+    Rect_t result = {
+        a.xStart < b.xStart ? a.xStart : b.xStart,
+        a.yStart < b.yStart ? a.yStart : b.yStart,
+        a.xEnd > b.xEnd ? a.xEnd : b.xEnd,
+        a.yEnd > b.yEnd ? a.yEnd : b.yEnd,
+    };
+    return result;
+}
+
+// Draw text as the next widget of the frame, unless the LCD already shows it there.
+// Text is cut at the right edge of the screen, rather than wrapping, so a widget
+// stays one line.
+static void drawText(int x, int y, const char *text, sFONT *pFont)
+{
+    assert(numFrameWidgets < MAX_WIDGETS);
+    Widget_t *pWidget = &widgets[numFrameWidgets];
+    bool isShown = numFrameWidgets < numShownWidgets;
+    numFrameWidgets++;
+
+    char line[MAX_WIDGET_TEXT];
+    int maxLength = (LCD_1IN54_WIDTH - x) / pFont->Width;
+    if (maxLength > MAX_WIDGET_TEXT - 1) {
+        maxLength = MAX_WIDGET_TEXT - 1;
+    }
+    snprintf(line, sizeof(line), "%.*s", maxLength, text);
+    if (isShown && pWidget->x == x && pWidget->y == y && pWidget->pFont == pFont
+            && strcmp(pWidget->text, line) == 0) {
+        return;
+    }
+
+    Rect_t area = {x, y, x + strlen(line) * pFont->Width, y + pFont->Height};
+    if (isShown) {
+        // Erase what the widget showed before, and send that area too
+        eraseArea(&pWidget->area, numFrameWidgets - 1);
+        damage[numDamaged++] = unionRect(pWidget->area, area);
+    } else {
+        damage[numDamaged++] = area;
+    }
+    Paint_DrawString_EN(x, y, line, pFont, WHITE, BLACK);
+    pWidget->x = x;
+    pWidget->y = y;
+    pWidget->pFont = pFont;
+    strcpy(pWidget->text, line);
+    pWidget->area = area;
+}
+
+static bool isOverlapping(const Rect_t *pA, const Rect_t *pB)
+{
+    return pA->xStart < pB->xEnd && pB->xStart < pA->xEnd
+        && pA->yStart < pB->yEnd && pB->yStart < pA->yEnd;
+}
+
+// Blank an area of the frame buffer, then repaint the other widgets showing there
+// (drawn this frame, or still shown from the last one), which overlap it.
+static void eraseArea(const Rect_t *pArea, int widget)
+{
+    Paint_ClearWindow(pArea->xStart, pArea->yStart, pArea->xEnd, pArea->yEnd, WHITE);
+    int numWidgets = numFrameWidgets > numShownWidgets ? numFrameWidgets : numShownWidgets;
+    for (int i = 0; i < numWidgets; i++) {
+        const Widget_t *pOther = &widgets[i];
+        if (i != widget && isOverlapping(&pOther->area, pArea)) {
+            Paint_DrawString_EN(pOther->x, pOther->y, pOther->text, pOther->pFont, WHITE, BLACK);
+        }
+    }
+}
+
+// Send the damaged areas of the frame buffer: the whole of it after a full redraw,
+// otherwise each area as a window, merging overlapping ones.
+static void flushDamage(void)
+{
+    long long numBytes = 0;
+    if (isFullRedraw) {
+        LCD_1IN54_Display(s_fb);
+        numBytes = LCD_1IN54_WIDTH * LCD_1IN54_HEIGHT * sizeof(UWORD);
+        isFullRedraw = false;
+    } else {
+        for (int i = 0; i < numDamaged; i++) {
+            Rect_t area = damage[i];
+            if (area.xEnd <= area.xStart || area.yEnd <= area.yStart) {
+                continue;
+            }
+            // Absorb any later area which overlaps this one (merging can make it
+            // overlap ones already passed, so start over after each merge)
+            for (int j = i + 1; j < numDamaged; j++) {
+                Rect_t *pOther = &damage[j];
+                if (isOverlapping(pOther, &area)) {
+                    area = unionRect(area, *pOther);
+                    pOther->xEnd = pOther->xStart;  // Now empty
+                    j = i;
+                }
+            }
+            LCD_1IN54_DisplayWindows(area.xStart, area.yStart, area.xEnd, area.yEnd, s_fb);
+            numBytes += (area.xEnd - area.xStart) * (area.yEnd - area.yStart) * sizeof(UWORD);
+        }
+    }
+    Probe_add(spiProbe, numBytes);
 }
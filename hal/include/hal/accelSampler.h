@@ -0,0 +1,49 @@
+/* accelSampler.h
+ *
+ * This module samples the accelerometer on a dedicated thread at a fixed output
+ * data rate (ODR). The thread sleeps on an absolute-deadline timerfd, so the
+ * sampling period does not drift with the time each read takes.
+ *
+ * Every sample is timestamped and pushed into a ring which is written only by the
+ * sampler thread. Each consumer (gesture detection, logging, the LCD) keeps its own
+ * AccelSampler_reader_t and reads at its own rate, without any extra I2C traffic.
+ * A reader which falls more than ACCELSAMPLER_RING_SIZE samples behind skips the
+ * overwritten samples and counts them as lost.
+ */
+
+#ifndef _ACCEL_SAMPLER_H_
+#define _ACCEL_SAMPLER_H_
+
+#include <stdbool.h>
+#include "hal/accelerometer.h"
+
+#define ACCELSAMPLER_RING_SIZE 256      // Must be a power of 2
+#define ACCELSAMPLER_DEFAULT_ODR_HZ 100
+#define ACCELSAMPLER_MAX_ODR_HZ 1000
+
+// A consumer's position in the ring.
+typedef struct {
+    unsigned long long nextIndex;
+    unsigned long long numLost;
+} AccelSampler_reader_t;
+
+// Start/stop the sampler thread. The accelerometer must be initialized and not
+// streaming while the sampler runs. odrHz is clamped to 1..ACCELSAMPLER_MAX_ODR_HZ.
+void AccelSampler_start(int odrHz);
+void AccelSampler_stop(void);
+bool AccelSampler_isRunning(void);
+
+// Position a reader at the newest sample, so it only sees samples taken after this.
+void AccelSampler_initReader(AccelSampler_reader_t *pReader);
+
+// Copy up to maxSamples samples the reader has not seen yet into pSamples, oldest
+// first. Returns the number copied. Each reader must be used by one thread only.
+int AccelSampler_read(AccelSampler_reader_t *pReader, AccelerometerSample *pSamples, int maxSamples);
+
+// Get the newest sample. Returns false if nothing has been sampled yet.
+bool AccelSampler_getLatest(AccelerometerSample *pSample);
+
+// Number of sampling deadlines missed because a read took longer than a period.
+unsigned long long AccelSampler_getNumMissed(void);
+
+#endif
@@ -10,13 +10,43 @@
 #define _ACCELEROMETER_H_
 
 #include <stdint.h>
-#include "periodTimer.h"
+#include <stdbool.h>
+#include "probes.h"
+#include "hal/i2c.h"
 typedef struct {
     double x;
     double y;
     double z;
 } AccelerometerData;
 
+#define ACCELEROMETER_FIFO_SIZE 32
+#define ACCELEROMETER_STREAM_ODR_HZ 400
+
+// A reading with the time it was sampled (CLOCK_MONOTONIC, in ns).
+typedef struct {
+    AccelerometerData data;
+    long long timestampNs;
+} AccelerometerSample;
+
+// Axes of a click (AccelerometerClick.axes)
+#define ACCELEROMETER_CLICK_X 0x01
+#define ACCELEROMETER_CLICK_Y 0x02
+#define ACCELEROMETER_CLICK_Z 0x04
+
+// A tap detected by the accelerometer's click engine.
+typedef struct {
+    int axes;               // ACCELEROMETER_CLICK_ bits of the axes which saw the tap
+    bool isNegative;        // Direction of the tap
+    long long timestampNs;  // Kernel timestamp of the INT1 edge (CLOCK_MONOTONIC)
+} AccelerometerClick;
+
+// Samples read from the FIFO in one burst, oldest first.
+typedef struct {
+    AccelerometerSample samples[ACCELEROMETER_FIFO_SIZE];
+    int numSamples;
+    bool isOverrun;     // The FIFO filled up and older samples were lost
+} AccelerometerBatch;
+
 // Initialize the I2C interface and open the I2C bus. And start the thread to read the accelerometer data.
 void Accelerometer_initialize(void);
 
@@ -26,6 +56,29 @@ void Accelerometer_cleanUp(void);
 // Get the current accelerometer reading.
 AccelerometerData Accelerometer_getReading();
 
-// Get the sampling time of the accelerometer.
-Period_statistics_t Accelerometer_getSamplingTime();
+// Turn the FIFO stream mode on or off. While streaming, the accelerometer samples at
+// ACCELEROMETER_STREAM_ODR_HZ into its FIFO, and Accelerometer_readBatch() returns
+// once `watermark` samples (1..31) are waiting. Use Accelerometer_getReading() only
+// when not streaming.
+void Accelerometer_setStreaming(bool enable, int watermark);
+
+// Turn the click engine on or off. While on, the accelerometer detects taps itself
+// and signals them on its INT1 pin; use Accelerometer_waitForClick() to wait for them.
+void Accelerometer_setClickDetection(bool enable);
+
+// Block until the click engine reports a tap (returns 1, and fills pClick), or until
+// a one second timeout passes (returns 0). Returns -1 if waiting or reading the
+// event failed; the caller may call it again.
+int Accelerometer_waitForClick(AccelerometerClick *pClick);
+
+// Wait for the FIFO to reach its watermark, then read every waiting sample into
+// pBatch with one I2C burst. Returns the number of samples read.
+int Accelerometer_readBatch(AccelerometerBatch *pBatch);
+
+// Get the sampling time of the accelerometer over the last probe window
+// (see Probes_collect()).
+Probe_statistics_t Accelerometer_getSamplingTime();
+
+// Get the accelerometer's I2C transfer statistics
+I2cStatistics Accelerometer_getBusStatistics(void);
 #endif
\ No newline at end of file
@@ -5,14 +5,33 @@
 
 #ifndef AUDIO_MIXER_H
 #define AUDIO_MIXER_H
-#include "periodTimer.h"
+#include "probes.h"
+#include "hal/drumSynth.h"
 
+// A sound the mixer can play: either PCM data loaded from a wave file, or a
+// procedurally synthesized drum (pSynth set, pData NULL).
 typedef struct {
 	int numSamples;
 	short *pData;
+	DrumSynth_voice *pSynth;
 } wavedata_t;
 
 #define AUDIOMIXER_MAX_VOLUME 100
+#define AUDIOMIXER_SAMPLE_RATE 44100
+
+// How far timed sounds (AudioMixer_queueTimedSound()) started from when they were
+// expected: the output frame of their first sample minus expectedFrame. The average
+// is signed (late is positive); the maximum and the histogram are of the error's
+// size, counted in buckets up to 0 (sample accurate), 1, 5 and 25 ms, and over.
+// Sounds dropped by their scheduler for being too late to play are counted apart.
+#define AUDIOMIXER_START_BUCKETS 5
+typedef struct {
+	int numStarts;
+	double avgErrorInMs;
+	double maxErrorInMs;
+	int histogram[AUDIOMIXER_START_BUCKETS];
+	int numDropped;
+} AudioMixer_startStatistics_t;
 
 // init() must be called before any other functions,
 // cleanup() must be called last to stop playback threads and free memory.
@@ -27,9 +46,35 @@ void AudioMixer_readWaveFileIntoMemory(char *fileName, wavedata_t *pSound);
 // Free the memory allocated for the wave file data.
 void AudioMixer_freeWaveFileData(wavedata_t *pSound);
 
+// Set up pSound to play the synthesized drum pVoice instead of PCM data.
+// The voice must outlive pSound; no memory is allocated.
+void AudioMixer_initSynthSound(DrumSynth_voice *pVoice, wavedata_t *pSound);
+
 // Queue up another sound bite to play as soon as possible.
 void AudioMixer_queueSound(wavedata_t *pSound);
 
+// Queue up a sound bite to start exactly at output frame startFrame (see
+// AudioMixer_getFramePosition()), scaled by gain (0..1). A startFrame that has
+// already been rendered plays as soon as possible.
+void AudioMixer_queueSoundAt(wavedata_t *pSound, float gain, long long startFrame);
+
+// Like AudioMixer_queueSoundAt(), and record in the start statistics how far from
+// expectedFrame the sound actually started. The scheduler works out expectedFrame
+// separately from startFrame (e.g. from its ideal grid), so that a wrong startFrame
+// shows up as an error too.
+void AudioMixer_queueTimedSound(wavedata_t *pSound, float gain, long long startFrame,
+                                long long expectedFrame);
+
+// Count a timed sound its scheduler dropped, because it was too late to play.
+void AudioMixer_countDroppedSound(void);
+
+// The audio clock: the number of frames rendered since AudioMixer_init(), i.e. the
+// frame at which the next block of output will start.
+long long AudioMixer_getFramePosition(void);
+
+// Number of frames rendered per block (the playback buffer size).
+int AudioMixer_getBlockFrames(void);
+
 // Get/set the volume.
 // setVolume() function posted by StackOverflow user "trenki" at:
 // http://stackoverflow.com/questions/6787318/set-alsa-master-volume-from-c-code
@@ -38,7 +83,17 @@ int  AudioMixer_getVolume();
 // Set the volume to a value between 0 and 100.
 void AudioMixer_setVolume(int newVolume);
 
-// Get the current audio statistics.
-Period_statistics_t AudioMixer_getAudioStat();
+// Get the time between audio blocks over the last probe window
+// (see Probes_collect()).
+Probe_statistics_t AudioMixer_getAudioStat();
+
+// Get the start statistics of the scheduled sounds started since the last call,
+// and clear them. For one reader (the terminal output).
+AudioMixer_startStatistics_t AudioMixer_getStartStatisticsAndClear(void);
+
+// Measure the CPU cost of mixing pSound: the average time in nanoseconds to mix one
+// playback-buffer-sized block of it, over numBlocks blocks (restarting the sound
+// whenever it ends). Mixes into a scratch buffer, so it is safe while audio plays.
+long long AudioMixer_benchmarkSound(wavedata_t *pSound, int numBlocks);
 
 #endif
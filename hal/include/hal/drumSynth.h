@@ -0,0 +1,100 @@
+/* drumSynth.h
+ * This module procedurally synthesizes simple drum sounds (kick, snare, hi-hat) so they can
+ * be played by the audio mixer without holding any PCM sample data in memory.
+ *
+ * A synthesized drum ("voice") is an oscillator with an exponential pitch sweep plus a
+ * white-noise source, each shaped by its own exponential decay envelope. The voice's
+ * parameters can be changed at any time; the change applies to the next hit.
+ *
+ * Use AudioMixer_initSynthSound() to wrap a voice in a wavedata_t so it can be queued
+ * anywhere a wave file can.
+ */
+
+#ifndef _DRUM_SYNTH_H_
+#define _DRUM_SYNTH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+typedef enum {
+    DRUMSYNTH_KICK,
+    DRUMSYNTH_SNARE,
+    DRUMSYNTH_HIHAT,
+    DRUMSYNTH_NUM_MODELS
+} DrumSynth_model;
+
+// Tunable parameters of a voice.
+typedef struct {
+    float startFreqHz;    // Oscillator frequency at the start of the hit
+    float endFreqHz;      // Frequency the pitch sweep decays towards
+    float pitchDecayMs;   // Time constant of the pitch sweep
+    float toneDecayMs;    // Time constant of the oscillator's amplitude envelope
+    float noiseDecayMs;   // Time constant of the noise's amplitude envelope
+    float toneLevel;      // 0..1
+    float noiseLevel;     // 0..1
+    float noiseHighPass;  // 0..1, how strongly the noise's low end is removed (hats)
+    float lengthMs;       // Total length of the hit
+} DrumSynth_params;
+
+// Per-sample coefficients derived from DrumSynth_params.
+typedef struct {
+    float endFreq;        // cycles per sample
+    float sweepFreq;      // cycles per sample added at the start of the hit
+    float sweepDecay;     // per-sample multipliers
+    float toneDecay;
+    float noiseDecay;
+    float toneGain;       // in PCM units
+    float noiseGain;
+    float noiseHighPass;
+    int numFrames;
+} DrumSynth_coeffs_t;
+
+// A tunable synthesized drum. Treat as opaque; use the functions below.
+typedef struct {
+    pthread_mutex_t lock;
+    DrumSynth_params params;
+    DrumSynth_coeffs_t coeffs;
+} DrumSynth_voice;
+
+// Playback state of one hit of a voice. The mixer keeps one of these for each
+// synthesized sound it is currently playing.
+#define DRUMSYNTH_LANES 4
+typedef struct {
+    DrumSynth_coeffs_t coeffs;
+    float phase;
+    float sweep;
+    float toneEnv;
+    float noiseEnv;
+    uint32_t noiseSeed[DRUMSYNTH_LANES];
+    float prevNoise[DRUMSYNTH_LANES];
+
+    // Frames rendered by the last 4-wide step but not yet consumed.
+    float carry[DRUMSYNTH_LANES];
+    int carryCount;
+} DrumSynth_state;
+
+// Initialize/clean up a voice, starting from the default parameters for the model.
+void DrumSynth_initVoice(DrumSynth_voice *pVoice, DrumSynth_model model);
+void DrumSynth_cleanupVoice(DrumSynth_voice *pVoice);
+
+// Get/set all parameters of a voice. Safe to call while the voice is playing.
+DrumSynth_params DrumSynth_getParams(DrumSynth_voice *pVoice);
+void DrumSynth_setParams(DrumSynth_voice *pVoice, const DrumSynth_params *pParams);
+
+// Set a single parameter by its field name in DrumSynth_params (e.g. "toneDecayMs").
+// Returns false, and changes nothing, if there is no such parameter or value is out
+// of its range: frequencies below Nyquist, decays up to 2000 ms, levels and
+// noiseHighPass 0..1, and lengthMs 1..2000 ms. Non-finite values are rejected.
+bool DrumSynth_setParamByName(DrumSynth_voice *pVoice, const char *name, float value);
+
+// Length of one hit of the voice, in frames.
+int DrumSynth_getNumFrames(DrumSynth_voice *pVoice);
+
+// Start a new hit of the voice, scaled by gain (0..1).
+void DrumSynth_startHit(DrumSynth_voice *pVoice, DrumSynth_state *pState, float gain);
+
+// Render the next numFrames of a hit and add them (saturating) into buff.
+void DrumSynth_mixInto(DrumSynth_state *pState, short *buff, int numFrames);
+
+#endif
@@ -1,10 +1,19 @@
 /* gpio.h
 * Provided file to look for changes in GPIO pins.
+*
+* Lines are requested for edge events once, when opened. Modules can then either
+* block on a line with Gpio_waitFor1LineChange(), or register a handler with
+* Gpio_watchLines(): one reactor thread waits on the event fds of all watched
+* lines with epoll (no timeout), and calls each handler with its lines' events.
+*
+* Buttons can be opened with Gpio_openForDebouncedEvents(), which has the kernel
+* debounce the line (gpio-cdev v2), so bounces never wake a thread. On kernels
+* without it the line is opened normally, and the caller debounces in userspace.
 */
 
 // Low-level GPIO access using gpiod
-#ifndef _GPIO_H_
-#define _GPIO_H_
+#ifndef _HAL_GPIO_H_
+#define _HAL_GPIO_H_
 
 #include <stdbool.h>
 #include <gpiod.h>
@@ -19,26 +28,52 @@ enum eGpioChips {
     GPIO_NUM_CHIPS      // Count of chips
 };
 
+#define GPIO_MAX_WATCHES 8
+#define GPIO_MAX_WATCH_LINES 2
+#define GPIO_MAX_EVENTS 16      // Events per line read in one go
+
+// An edge on a watched line.
+typedef struct {
+    unsigned int lineNumber;
+    bool isRising;
+    long long timestampNs;      // Kernel timestamp of the edge (CLOCK_MONOTONIC)
+} GpioEvent;
+
+// Called on the reactor thread with the new events of a watch's lines, oldest first.
+// Handlers must not block, and must not watch or unwatch lines.
+typedef void (*Gpio_eventHandler)(const GpioEvent *pEvents, int numEvents, void *pContext);
+
 // Must initialize before calling any other functions.
 void Gpio_initialize(void);
 void Gpio_cleanup(void);
 
 
-// Opening a pin gives us a "line" that we later work with.
+// Opening a pin gives us a "line" that we later work with. The line is requested
+// for both edge events here, once.
 //  chip: such as GPIO_CHIP_0
 //  pinNumber: such as 15
 struct GpioLine* Gpio_openForEvents(enum eGpioChips chip, int pinNumber);
 
+// Open a line for both edge events with the kernel debouncing it: an edge is only
+// reported once the line has been stable for debounceUs (and is timestamped then).
+// Falls back to Gpio_openForEvents(); check with Gpio_isKernelDebounced().
+// Not for Gpio_waitFor1LineChange().
+struct GpioLine* Gpio_openForDebouncedEvents(enum eGpioChips chip, int pinNumber, int debounceUs);
+bool Gpio_isKernelDebounced(struct GpioLine* line);
+
+// Call handler with the events of up to GPIO_MAX_WATCH_LINES lines. Events of the
+// lines in one watch are merged in timestamp order. Returns a watch id for
+// Gpio_unwatch(), or -1 if there are too many watches.
+int Gpio_watchLines(struct GpioLine* lines[], int numLines, Gpio_eventHandler handler, void *pContext);
+void Gpio_unwatch(int watchId);
+
 int Gpio_waitFor1LineChange(
     struct GpioLine* line1, 
     struct gpiod_line_bulk *bulkEvents
 );
 
-int Gpio_waitFor2LineChange(
-    struct GpioLine* line1, 
-    struct GpioLine* line2, 
-    struct gpiod_line_bulk *bulkEvents
-);
+// Read the current level of a line opened for events (1 high, 0 low, -1 on error).
+int Gpio_getValue(struct GpioLine* line);
 
 void Gpio_close(struct GpioLine* line);
 
@@ -1,15 +1,109 @@
-/* i2c.h 
- * 
- * This file declares functions for initializing and cleaning up the I2C interface, 
- * opening an I2C bus, and performing 16-bit register read/write operations.
- * 
- * These methods are taken from class guide: I2C Guide
+/* i2c.h
+ *
+ * This file declares functions for initializing and cleaning up the I2C interface,
+ * opening a device on an I2C bus, and reading/writing its registers.
+ *
+ * Register reads are combined transactions: the register address write and the
+ * data read go out as one I2C_RDWR ioctl with a repeated start between them, so
+ * each read is a single syscall and no other transfer can slip in between.
+ * I2c_transfer() and I2c_zip() run several segments in one ioctl, modelled on
+ * lgI2cSegments() and lgI2cZip() in lgpio/lgI2C.c.
+ *
+ * Each bus is owned by one thread, which holds the bus's only file descriptor and
+ * runs transfers one at a time from a priority queue: a device opened with a higher
+ * priority (the accelerometer) is served before waiting lower priority transfers
+ * (the joystick ADC), and transfers of equal priority run in order. I2c_submit()
+ * queues a request and returns at once; I2c_wait() is its future. The synchronous
+ * functions below submit and wait. The bus thread keeps latency and error
+ * statistics per device.
+ *
+ * All functions return I2C_OK (or a byte count) on success and a negative I2C_ERROR_
+ * code on failure; it is up to the caller to decide whether an error is fatal.
  */
 
 #ifndef _I2C_H_
 #define _I2C_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#define I2C_OK 0
+#define I2C_ERROR_NOT_INITIALIZED -1
+#define I2C_ERROR_OPEN -2           // Unable to open the bus
+#define I2C_ERROR_ADDRESS -3        // Unable to select the device address
+#define I2C_ERROR_TRANSFER -4       // The ioctl failed (device did not ACK, bus error)
+#define I2C_ERROR_PARAMETER -5      // Bad length, too many segments, bad zip command
+
+#define I2C_MAX_SEGMENTS 42         // Segments in one transfer (I2C_RDWR_IOCTL_MAX_MSGS)
+#define I2C_MAX_REGISTER_BYTES 64   // Data bytes in one I2c_writeRegisters()
+#define I2C_MAX_BUSES 2
+#define I2C_MAX_PENDING 16          // Queued requests per bus; I2c_submit() waits when full
+
+// Device priorities: higher runs first
+#define I2C_PRIORITY_LOW 0
+#define I2C_PRIORITY_HIGH 1
+
+// Segment flags
+#define I2C_SEGMENT_WRITE 0x0000
+#define I2C_SEGMENT_READ 0x0001
+
+// One segment of a combined transaction; segments after the first are sent after a
+// repeated start, and only the last one ends with a stop.
+typedef struct {
+    uint16_t address;
+    uint16_t flags;     // I2C_SEGMENT_READ or I2C_SEGMENT_WRITE
+    uint16_t length;
+    uint8_t *buffer;
+} I2cSegment;
+
+// I2c_zip() commands
+#define I2C_ZIP_END 0       // Stop processing commands
+#define I2C_ZIP_ADDRESS 2   // <address>: Address of the following segments
+#define I2C_ZIP_READ 4      // <n>: Read n bytes into the output buffer
+#define I2C_ZIP_WRITE 5     // <n> <byte>...: Write the n bytes which follow
+
+typedef struct {
+    long long numTransfers;
+    long long numErrors;
+    double avgLatencyInMs;  // From submit to completion
+    double maxLatencyInMs;
+    double maxWaitInMs;     // From submit to the start of the transfer
+} I2cStatistics;
+
+typedef struct I2cBus I2cBus;
+
+// A device on an open bus. Only touch it through the functions below.
+typedef struct {
+    I2cBus *pBus;
+    uint16_t address;
+    int priority;
+    const char *name;
+    I2cStatistics stats;    // Protected by the bus
+    double totalLatencyInMs;
+} I2cDevice;
+
+typedef struct I2cRequest I2cRequest;
+
+// Called on the bus thread when a request completes, after its status is set. Must be
+// quick, and must not wait for another I2C transfer. The bus never touches the
+// request once the handler is called, so the handler may resubmit or free it.
+typedef void (*I2c_completionHandler)(I2cRequest *pRequest);
+
+// A queued transfer. Fill in the first fields, then pass it to I2c_submit(); it must
+// stay valid (and unmodified) until it completes: until its handler is called if it
+// has one, otherwise until I2c_wait() returns.
+struct I2cRequest {
+    I2cDevice *pDevice;
+    I2cSegment *pSegments;
+    int numSegments;
+    I2c_completionHandler onComplete;   // May be NULL
+    void *pContext;                     // For onComplete
+    // Set by the bus
+    int status;
+    bool isDone;
+    long long submitNs;
+    unsigned long long sequence;
+};
 
 // Initializes the I2C interface
 void Ic2_initialize(void);
@@ -17,20 +111,39 @@ void Ic2_initialize(void);
 // Cleans up the I2C interface
 void Ic2_cleanUp(void);
 
-// Opens an I2C bus with the specified address
-int init_i2c_bus(const char* bus, int address);
+// Opens the device at address on an I2C bus (e.g. "/dev/i2c-1"). The first device
+// opened on a bus starts its bus thread; closing the last one stops it.
+// name (for statistics) must stay valid while the device is open.
+int I2c_open(const char* bus, int address, int priority, const char *name, I2cDevice *pDevice);
+void I2c_close(I2cDevice *pDevice);
+
+// Queue a request, and wait for it to complete (returns its status).
+void I2c_submit(I2cRequest *pRequest);
+int I2c_wait(I2cRequest *pRequest);
+
+// Runs numSegments segments as one combined transaction on the bus of pDevice.
+int I2c_transfer(I2cDevice *pDevice, I2cSegment *pSegments, int numSegments);
+
+// Get a device's transfer statistics.
+I2cStatistics I2c_getStatistics(I2cDevice *pDevice);
+
+// Runs a list of I2C_ZIP_ commands, batching consecutive reads and writes into
+// combined transactions. Returns the number of bytes read into pOutput.
+int I2c_zip(I2cDevice *pDevice, const uint8_t *pCommands, int commandLength,
+            uint8_t *pOutput, int outputLength);
 
-// Writes a 16-bit value to the specified register
-void write_i2c_reg16(int i2c_file_desc, uint8_t reg_addr, uint16_t value);
+// Reads length bytes starting at register reg_addr (in one combined transaction)
+int I2c_readRegisters(I2cDevice *pDevice, uint8_t reg_addr, uint8_t *buffer, int length);
 
-// Reads a 16-bit value from the specified register
-uint16_t read_i2c_reg16(int i2c_file_desc, uint8_t reg_addr);
+// Writes length bytes starting at register reg_addr
+int I2c_writeRegisters(I2cDevice *pDevice, uint8_t reg_addr, const uint8_t *buffer, int length);
 
-// Writes an 8-bit value to the specified register
-void write_i2c_reg8(int i2c_file_desc, uint8_t reg_addr, uint8_t value);
+// Reads/Writes an 8-bit register
+int I2c_readReg8(I2cDevice *pDevice, uint8_t reg_addr, uint8_t *pValue);
+int I2c_writeReg8(I2cDevice *pDevice, uint8_t reg_addr, uint8_t value);
 
-// Burst reads from the spcifiec address and length
-void read_i2c_burst(int i2c_file_desc, uint8_t reg_addr, uint8_t *buffer, int length);
+// Reads/Writes a 16-bit register, least significant byte first on the wire
+int I2c_readReg16(I2cDevice *pDevice, uint8_t reg_addr, uint16_t *pValue);
+int I2c_writeReg16(I2cDevice *pDevice, uint8_t reg_addr, uint16_t value);
 
-uint8_t read_i2c_reg8(int i2c_file_desc, uint8_t reg_addr);
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,73 @@
+/* inputEvents.h
+ *
+ * This module is the input event bus: HAL modules publish a typed, timestamped
+ * InputEvent for each change of an input (a turn of the rotary encoder, a button
+ * press, the joystick moving, an accelerometer hit) and one dispatcher in the app
+ * consumes them, in the order they were published.
+ *
+ * The queue is a bounded lock-free multi-producer single-consumer ring: publishing
+ * never takes a lock, so it is safe from the GPIO reactor, sampler threads and the
+ * audio path alike. Publishing also makes an eventfd readable; the consumer waits
+ * on it (in poll, epoll or the app's scheduler) and takes the queued events, so an
+ * input is acted on as soon as it arrives instead of at the next poll.
+ * When the ring is full, new events are dropped and counted.
+ */
+
+#ifndef _INPUT_EVENTS_H_
+#define _INPUT_EVENTS_H_
+
+#include <stdbool.h>
+
+#define INPUT_EVENTS_QUEUE_SIZE 64  // Must be a power of 2
+
+// Event types
+#define INPUT_EVENT_ENCODER 0           // Rotary encoder turned
+#define INPUT_EVENT_ENCODER_BUTTON 1    // Rotary encoder button released
+#define INPUT_EVENT_JOYSTICK_BUTTON 2   // Joystick pressed
+#define INPUT_EVENT_JOYSTICK_MOVE 3     // Joystick direction changed
+#define INPUT_EVENT_ACCEL_HIT 4         // Accelerometer hit (knock or tap)
+
+typedef struct {
+    int type;                   // An INPUT_EVENT_
+    long long timestampNs;      // When the input happened (CLOCK_MONOTONIC), from the
+                                // kernel or the sensor where they provide it
+    union {
+        struct {
+            int detents;        // Clockwise positive
+            int acceleratedDetents;
+        } encoder;
+        struct {
+            int value;          // The button's new value
+        } button;
+        struct {
+            int direction;      // A JoystickDirection
+        } joystick;
+        struct {
+            int axis;           // 0 = x, 1 = y, 2 = z
+            float velocity;     // 0 to 1
+        } accelHit;
+    };
+} InputEvent;
+
+typedef struct {
+    unsigned long long numPublished;
+    unsigned long long numDropped;  // Published while the queue was full
+} InputEvents_statistics_t;
+
+// Initialize/clean up the bus. Initialize before any module which publishes.
+void InputEvents_init(void);
+void InputEvents_cleanup(void);
+
+// Queue an event, from any thread. Returns false (and drops it) if the queue is full.
+bool InputEvents_publish(const InputEvent *pEvent);
+
+// The fd which is readable while there may be events to take.
+int InputEvents_getFd(void);
+
+// Without waiting, copy up to maxEvents queued events into pEvents, oldest first,
+// and reset the fd. Returns the number copied. Only one thread may consume.
+int InputEvents_take(InputEvent *pEvents, int maxEvents);
+
+InputEvents_statistics_t InputEvents_getStatistics(void);
+
+#endif
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include "hal/i2c.h"
 
 #define LED_FILE_NAME "/sys/class/leds"
 
@@ -28,20 +29,27 @@ typedef enum {
     JOYSTICK_PRESSED
 } JoystickDirection;
 
-// Initializes the joystick and starts thread to sample xy position, and button press
+// Initializes the joystick and starts thread to sample xy position, and button press.
+// Each debounced press publishes an INPUT_EVENT_JOYSTICK_BUTTON with its kernel
+// timestamp, and each change of direction an INPUT_EVENT_JOYSTICK_MOVE (hal/inputEvents.h).
 void Joystick_initialize(void);
 
 // Cleans up the joystick
 void Joystick_cleanUp(void);
 /*
-This function reads the current joystick position and returns the x and y values after scaling.
+This function returns the latest joystick position taken by the sampler thread, without blocking.
     @Return: JoystickData struct containing the x and y values scaled between (-1 and 1) and isPressed.
 */
 struct JoystickData Joystick_getReading();
 
-// Returns the current page number from pressing down on joystick
+// Returns the current page number, and step it (1, 2, ... JOYSTICK_NUM_PAGES, 1, ...) for a press
+#define JOYSTICK_NUM_PAGES 4
 int Joystick_getPageCount();
+void Joystick_nextPage(void);
 
-// Return the current Joystick Direction
+// Get the joystick ADC's I2C transfer statistics
+I2cStatistics Joystick_getBusStatistics(void);
+
+// Return the current Joystick Direction (non-blocking)
 JoystickDirection getJoystickDirection(void);
 #endif
\ No newline at end of file
@@ -1,7 +1,8 @@
 /* rotary_btn_statemachine.h 
 * Header file for the rotary button state machine implementation.
 * This module is responsible for monitoring and processing rotary button
-* signals using a state machine approach.
+* signals using a state machine approach. Each press publishes an
+* INPUT_EVENT_ENCODER_BUTTON (hal/inputEvents.h) with the new value.
 */
 #ifndef _BTN_STATEMACHINE_H_
 #define _BTN_STATEMACHINE_H_
@@ -20,4 +21,7 @@ void BtnStateMachine_setValue(int value);
 // Set the value of the rotary button (mainly for resetting purposes)
 int BtnStateMachine_getValue();
 
+// Set how many values each press cycles through (0 .. numValues - 1)
+void BtnStateMachine_setNumValues(int numValues);
+
 #endif
\ No newline at end of file
@@ -5,10 +5,13 @@
  * clean up, and retrieve the current encoder value.  
  *  
  * Features:  
- * - Uses a state machine to track rotary encoder position changes.  
+ * - Decodes the quadrature signal with a 16-entry transition table, from whole  
+ *   batches of kernel-timestamped edges.  
  * - Supports incrementing and decrementing based on clockwise and  
- *   counterclockwise rotations.  
- * - Provides thread-based monitoring of GPIO events for reliable tracking.  
+ *   counterclockwise rotations, one count per detent.  
+ * - Keeps a second, accelerated count: each detent counts from 1 (slow turns) up to  
+ *   ROTARY_MAX_ACCELERATION (fast spins), from the time between detents.  
+ * - Publishes an INPUT_EVENT_ENCODER (hal/inputEvents.h) for each batch of detents.  
  * - Allows external components to retrieve or reset the encoder value. 
 */
 #ifndef _ENCODER_STATEMACHINE_H_
@@ -16,6 +19,8 @@
 
 #include <stdbool.h>
 
+#define ROTARY_MAX_ACCELERATION 5
+
 //Start thread to monitor the rotary encoder
 void RotaryEncoderStateMachine_init(void);
 
@@ -24,6 +29,9 @@ void RotaryEncoderStateMachine_cleanup(void);
 //Get the current value of the rotary encoder
 int RotaryEncoderStateMachine_getValue(void);
 
+//Get the accelerated count: detents weighted by spin speed
+int RotaryEncoderStateMachine_getAcceleratedValue(void);
+
 //Set the value of the rotary encoder (mainly for resetting purposes)
 void RotaryEncoderStateMachine_setValue(int value);
 
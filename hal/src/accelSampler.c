@@ -0,0 +1,157 @@
+/* accelSampler.c
+ *
+ * This file implements the accelerometer sampler declared in accelSampler.h.
+ *
+ * The ring has a single writer: the sampler thread fills the slot for index
+ * writeCount, then publishes it by incrementing writeCount. Readers copy the slots
+ * they want and then re-check writeCount: any slot the writer may have started to
+ * overwrite during the copy is discarded and counted as lost.
+ */
+
+#include "hal/accelSampler.h"
+#include "sleep_timer_helper.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_MASK (ACCELSAMPLER_RING_SIZE - 1)
+#define NS_PER_SECOND 1000000000LL
+
+static AccelerometerSample ring[ACCELSAMPLER_RING_SIZE];
+static atomic_ullong writeCount = 0;
+static atomic_ullong numMissed = 0;
+
+static pthread_t samplerThread;
+static atomic_bool isRunning = false;
+static int timerFd = -1;
+
+static void* samplerThreadFunc(void* args);
+
+void AccelSampler_start(int odrHz)
+{
+    assert(!isRunning);
+    if (odrHz < 1) {
+        odrHz = 1;
+    } else if (odrHz > ACCELSAMPLER_MAX_ODR_HZ) {
+        odrHz = ACCELSAMPLER_MAX_ODR_HZ;
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timerFd == -1) {
+        perror("ERROR: Unable to create sampler timer");
+        exit(EXIT_FAILURE);
+    }
+    // First deadline one period from now, then every period after it
+    long long periodNs = NS_PER_SECOND / odrHz;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long firstNs = now.tv_sec * NS_PER_SECOND + now.tv_nsec + periodNs;
+    struct itimerspec deadline = {
+        .it_interval = {periodNs / NS_PER_SECOND, periodNs % NS_PER_SECOND},
+        .it_value = {firstNs / NS_PER_SECOND, firstNs % NS_PER_SECOND},
+    };
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &deadline, NULL) == -1) {
+        perror("ERROR: Unable to start sampler timer");
+        exit(EXIT_FAILURE);
+    }
+
+    isRunning = true;
+    pthread_create(&samplerThread, NULL, &samplerThreadFunc, NULL);
+}
+
+void AccelSampler_stop(void)
+{
+    assert(isRunning);
+    isRunning = false;
+    pthread_join(samplerThread, NULL);
+    close(timerFd);
+    timerFd = -1;
+}
+
+bool AccelSampler_isRunning(void)
+{
+    return isRunning;
+}
+
+static void* samplerThreadFunc(void* args)
+{
+    (void) args;
+    while (isRunning) {
+        // Blocks until the next deadline; returns how many deadlines have passed
+        uint64_t expirations;
+        if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            continue;
+        }
+        if (expirations > 1) {
+            atomic_fetch_add_explicit(&numMissed, expirations - 1, memory_order_relaxed);
+        }
+
+        unsigned long long index = atomic_load_explicit(&writeCount, memory_order_relaxed);
+        AccelerometerSample *pSlot = &ring[index & RING_MASK];
+        pSlot->timestampNs = getTimeInNs();
+        pSlot->data = Accelerometer_getReading();
+        atomic_store_explicit(&writeCount, index + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+void AccelSampler_initReader(AccelSampler_reader_t *pReader)
+{
+    pReader->nextIndex = atomic_load_explicit(&writeCount, memory_order_acquire);
+    pReader->numLost = 0;
+}
+
+int AccelSampler_read(AccelSampler_reader_t *pReader, AccelerometerSample *pSamples, int maxSamples)
+{
+    unsigned long long end = atomic_load_explicit(&writeCount, memory_order_acquire);
+    unsigned long long start = pReader->nextIndex;
+    if (end - start > ACCELSAMPLER_RING_SIZE) {
+        start = end - ACCELSAMPLER_RING_SIZE;
+    }
+    if (end - start > (unsigned long long)maxSamples) {
+        end = start + maxSamples;
+    }
+    int count = 0;
+    for (unsigned long long i = start; i < end; i++) {
+        pSamples[count++] = ring[i & RING_MASK];
+    }
+
+    // Slots below this index may have been overwritten while they were copied
+    atomic_thread_fence(memory_order_acquire);
+    unsigned long long written = atomic_load_explicit(&writeCount, memory_order_relaxed);
+    unsigned long long firstValid = (written >= ACCELSAMPLER_RING_SIZE) ? written - ACCELSAMPLER_RING_SIZE + 1 : 0;
+    int skip = 0;
+    if (firstValid > start) {
+        skip = (firstValid - start < (unsigned long long)count) ? (int)(firstValid - start) : count;
+        for (int i = skip; i < count; i++) {
+            pSamples[i - skip] = pSamples[i];
+        }
+    }
+    pReader->numLost += (start + skip) - pReader->nextIndex;
+    pReader->nextIndex = end;
+    return count - skip;
+}
+
+bool AccelSampler_getLatest(AccelerometerSample *pSample)
+{
+    AccelSampler_reader_t reader;
+    unsigned long long written = atomic_load_explicit(&writeCount, memory_order_acquire);
+    if (written == 0) {
+        return false;
+    }
+    reader.nextIndex = written - 1;
+    reader.numLost = 0;
+    return AccelSampler_read(&reader, pSample, 1) == 1;
+}
+
+unsigned long long AccelSampler_getNumMissed(void)
+{
+    return numMissed;
+}
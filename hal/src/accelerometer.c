@@ -2,11 +2,19 @@
  * 
  * This file provides a HAL for interfacing with an
  * accelerometer over I2C using the existing I2C functions.
+ *
+ * In streaming mode the LIS3DH's 32-sample FIFO runs in stream mode: the chip keeps
+ * sampling on its own, and Accelerometer_readBatch() empties the FIFO with a single
+ * auto-incrementing burst read once the watermark is reached (reads of OUT_Z_H wrap
+ * back to OUT_X_L and pop the next sample).
+ *
+ * In click mode the LIS3DH's click engine detects taps itself and raises INT1, which
+ * is waited on as a GPIO edge event: nothing is read over I2C until a tap happens.
  */
 
 #include "hal/accelerometer.h"
 #include "hal/i2c.h"
-#include "sleep_timer_helper.h"
+#include "hal/gpio.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -31,6 +39,13 @@
 #define REG_CTRL5  0x24
 #define REG_CTRL6  0x25
 #define REG_FIFO_CTRL 0x2E
+#define REG_FIFO_SRC 0x2F
+#define REG_CLICK_CFG 0x38
+#define REG_CLICK_SRC 0x39
+#define REG_CLICK_THS 0x3A
+#define REG_TIME_LIMIT 0x3B
+#define REG_TIME_LATENCY 0x3C
+#define REG_TIME_WINDOW 0x3D
 
 #define REG_OUT_X_L 0x28
 #define REG_OUT_X_H 0x29
@@ -41,9 +56,41 @@
 
 #define SENSITIVITY_2G 4096.0  // Sensitivity for ±2g range (14-bit resolution)
 
-static int i2c_file_desc = -1;
+#define AUTO_INCREMENT 0x80     // Set in a register address to read several registers
+#define CTRL1_POLL 0x97         // Settings used when polling
+#define CTRL1_STREAM 0x77       // 400Hz, X/Y/Z enabled
+#define CTRL5_FIFO_EN 0x40
+#define FIFO_MODE_BYPASS 0x00
+#define FIFO_MODE_STREAM 0x80
+#define FIFO_THRESHOLD_MASK 0x1F
+#define FIFO_SRC_WTM 0x80
+#define FIFO_SRC_OVRN 0x40
+#define FIFO_SRC_FSS_MASK 0x1F
+#define BYTES_PER_SAMPLE 6
+
+#define CTRL3_I1_CLICK 0x80     // Route the click interrupt to INT1
+#define CLICK_CFG_SINGLE_XYZ 0x15
+#define CLICK_THS_LATCH 0x80    // INT1 stays high until CLICK_SRC is read
+#define CLICK_THRESHOLD 0x26    // 0.6g: 1 LSB is 2g / 128
+#define CLICK_TIME_LIMIT 10     // A tap is shorter than 25ms (in 400Hz samples)
+#define CLICK_TIME_LATENCY 20   // Ignore 50ms after a tap
+#define CLICK_SRC_IA 0x40
+#define CLICK_SRC_SIGN 0x08
+#define CLICK_SRC_AXES 0x07
+
+// Board wiring of the LIS3DH's INT1 pin
+#define INT1_GPIO_CHIP GPIO_CHIP_2
+#define INT1_GPIO_LINE 17
+#define NS_PER_SECOND 1000000000LL
+
+static I2cDevice device;
 static bool isInitialized = false;
 static volatile bool keepReading = false;
+static bool isStreaming = false;
+static int watermark = 0;
+static long long lastBatchNs = 0;
+static struct GpioLine *int1Line = NULL;
+static Probe *periodProbe = NULL;    // Time between readings
 // static pthread_t accelerometer_thread;
 
 //PROTOTYPES
@@ -52,19 +99,193 @@ void Accelerometer_cleanUp(void);
 void *Accelerometer_thread_func(void *arg);
 AccelerometerData Accelerometer_getReading(void);
 
+// Configuration writes: a failure leaves the chip in an unknown mode, so report it.
+static void writeReg8(uint8_t reg, uint8_t value) {
+    int status = I2c_writeReg8(&device, reg, value);
+    if (status != I2C_OK) {
+        fprintf(stderr, "ERROR: Accelerometer: unable to write register 0x%02X (%d)\n", reg, status);
+    }
+}
+
 void Accelerometer_initialize(void) {
-    i2c_file_desc = init_i2c_bus(I2C_BUS, ACCEL_I2C_ADDRESS);
+    int status = I2c_open(I2C_BUS, ACCEL_I2C_ADDRESS, I2C_PRIORITY_HIGH, "accelerometer", &device);
+    if (status != I2C_OK) {
+        fprintf(stderr, "ERROR: Accelerometer: unable to open %s (%d)\n", I2C_BUS, status);
+        exit(EXIT_FAILURE);
+    }
+    periodProbe = Probe_register("accel period", PROBE_PERIOD);
     isInitialized = true;
     keepReading = true;
-    write_i2c_reg8(i2c_file_desc, REG_CTRL1, 0x97);  //100Hz, (High)14-bit resolution, (Low)14-bit resolution 
-    write_i2c_reg8(i2c_file_desc, REG_CTRL6, 0x00); //+2g
+    writeReg8(REG_CTRL1, CTRL1_POLL);  //100Hz, (High)14-bit resolution, (Low)14-bit resolution 
+    writeReg8(REG_CTRL6, 0x00); //+2g
 }
 
 void Accelerometer_cleanUp(void) {
+    if (isStreaming) {
+        Accelerometer_setStreaming(false, 0);
+    }
+    if (int1Line) {
+        Accelerometer_setClickDetection(false);
+    }
     keepReading = false;
+    I2c_close(&device);
     isInitialized = false;
 }
 
+static AccelerometerData convertSample(const uint8_t *raw_data) {
+    int16_t x = (int16_t)((raw_data[1] << 8) | raw_data[0]) >> 2;
+    int16_t y = (int16_t)((raw_data[3] << 8) | raw_data[2]) >> 2;
+    int16_t z = (int16_t)((raw_data[5] << 8) | raw_data[4]) >> 2;
+    AccelerometerData data = {x / SENSITIVITY_2G, y / SENSITIVITY_2G, z / SENSITIVITY_2G};
+    return data;
+}
+
+static long long getTimeNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+static void sleepNs(long long delayNs) {
+    if (delayNs <= 0) {
+        return;
+    }
+    struct timespec delay = {delayNs / NS_PER_SECOND, delayNs % NS_PER_SECOND};
+    nanosleep(&delay, NULL);
+}
+
+void Accelerometer_setStreaming(bool enable, int newWatermark) {
+    assert(isInitialized);
+    // Passing through bypass mode empties the FIFO
+    writeReg8(REG_FIFO_CTRL, FIFO_MODE_BYPASS);
+    if (!enable) {
+        writeReg8(REG_CTRL5, 0x00);
+        writeReg8(REG_CTRL1, CTRL1_POLL);
+        isStreaming = false;
+        return;
+    }
+
+    if (newWatermark < 1) {
+        newWatermark = 1;
+    } else if (newWatermark > ACCELEROMETER_FIFO_SIZE - 1) {
+        newWatermark = ACCELEROMETER_FIFO_SIZE - 1;
+    }
+    watermark = newWatermark;
+    writeReg8(REG_CTRL1, CTRL1_STREAM);
+    writeReg8(REG_CTRL5, CTRL5_FIFO_EN);
+    writeReg8(REG_FIFO_CTRL, FIFO_MODE_STREAM | (watermark & FIFO_THRESHOLD_MASK));
+    lastBatchNs = getTimeNs();
+    isStreaming = true;
+}
+
+int Accelerometer_readBatch(AccelerometerBatch *pBatch) {
+    assert(isInitialized);
+    assert(isStreaming);
+    const long long periodNs = NS_PER_SECOND / ACCELEROMETER_STREAM_ODR_HZ;
+
+    // Sleep until the FIFO should hold a watermark's worth of samples, then check
+    sleepNs(lastBatchNs + watermark * periodNs - getTimeNs());
+    uint8_t fifoSource;
+    if (I2c_readReg8(&device, REG_FIFO_SRC, &fifoSource) != I2C_OK) {
+        lastBatchNs = getTimeNs();
+        return 0;
+    }
+    int count = fifoSource & FIFO_SRC_FSS_MASK;
+    while (!(fifoSource & (FIFO_SRC_WTM | FIFO_SRC_OVRN)) && count < watermark) {
+        sleepNs((watermark - count) * periodNs);
+        if (I2c_readReg8(&device, REG_FIFO_SRC, &fifoSource) != I2C_OK) {
+            return 0;
+        }
+        count = fifoSource & FIFO_SRC_FSS_MASK;
+    }
+    pBatch->isOverrun = (fifoSource & FIFO_SRC_OVRN) != 0;
+    if (pBatch->isOverrun) {
+        count = ACCELEROMETER_FIFO_SIZE;
+    }
+
+    uint8_t raw_data[ACCELEROMETER_FIFO_SIZE * BYTES_PER_SAMPLE];
+    Probe_markPeriod(periodProbe);
+    int status = I2c_readRegisters(&device, REG_OUT_X_L | AUTO_INCREMENT, raw_data, count * BYTES_PER_SAMPLE);
+    long long nowNs = getTimeNs();
+    lastBatchNs = nowNs;
+    if (status != I2C_OK) {
+        return 0;
+    }
+
+    // The newest sample was taken just before the read; the rest are one period apart
+    for (int i = 0; i < count; i++) {
+        pBatch->samples[i].data = convertSample(&raw_data[i * BYTES_PER_SAMPLE]);
+        pBatch->samples[i].timestampNs = nowNs - (count - 1 - i) * periodNs;
+    }
+    pBatch->numSamples = count;
+    return count;
+}
+
+
+void Accelerometer_setClickDetection(bool enable) {
+    assert(isInitialized);
+    if (!enable) {
+        writeReg8(REG_CTRL3, 0x00);
+        writeReg8(REG_CLICK_CFG, 0x00);
+        writeReg8(REG_CTRL1, CTRL1_POLL);
+        if (int1Line) {
+            Gpio_close(int1Line);
+            int1Line = NULL;
+        }
+        return;
+    }
+
+    writeReg8(REG_CTRL1, CTRL1_STREAM);
+    writeReg8(REG_CLICK_CFG, CLICK_CFG_SINGLE_XYZ);
+    writeReg8(REG_CLICK_THS, CLICK_THS_LATCH | CLICK_THRESHOLD);
+    writeReg8(REG_TIME_LIMIT, CLICK_TIME_LIMIT);
+    writeReg8(REG_TIME_LATENCY, CLICK_TIME_LATENCY);
+    writeReg8(REG_TIME_WINDOW, 0x00);
+    writeReg8(REG_CTRL3, CTRL3_I1_CLICK);
+    if (!int1Line) {
+        int1Line = Gpio_openForEvents(INT1_GPIO_CHIP, INT1_GPIO_LINE);
+    }
+    // Clear any latched click so the next one gives a fresh rising edge
+    uint8_t clickSource;
+    I2c_readReg8(&device, REG_CLICK_SRC, &clickSource);
+}
+
+int Accelerometer_waitForClick(AccelerometerClick *pClick) {
+    assert(isInitialized);
+    assert(int1Line);
+
+    struct gpiod_line_bulk bulkEvents;
+    int numEvents = Gpio_waitFor1LineChange(int1Line, &bulkEvents);
+    if (numEvents <= 0) {
+        // Timed out (or failed): clear the latch in case an edge was missed
+        uint8_t clickSource;
+        I2c_readReg8(&device, REG_CLICK_SRC, &clickSource);
+        return numEvents;
+    }
+
+    struct gpiod_line_event event;
+    struct gpiod_line *line_handle = gpiod_line_bulk_get_line(&bulkEvents, 0);
+    if (gpiod_line_event_read(line_handle, &event) == -1) {
+        perror("Line Event");
+        return -1;
+    }
+    if (event.event_type != GPIOD_LINE_EVENT_RISING_EDGE) {
+        return 0;
+    }
+
+    // Reading CLICK_SRC also releases INT1
+    uint8_t clickSource;
+    if (I2c_readReg8(&device, REG_CLICK_SRC, &clickSource) != I2C_OK) {
+        return -1;
+    }
+    if (!(clickSource & CLICK_SRC_IA)) {
+        return 0;
+    }
+    pClick->axes = clickSource & CLICK_SRC_AXES;
+    pClick->isNegative = (clickSource & CLICK_SRC_SIGN) != 0;
+    pClick->timestampNs = event.ts.tv_sec * NS_PER_SECOND + event.ts.tv_nsec;
+    return 1;
+}
 
 AccelerometerData Accelerometer_getReading(void) {
     if (!isInitialized) {
@@ -72,22 +293,24 @@ AccelerometerData Accelerometer_getReading(void) {
         exit(EXIT_FAILURE);
     }
 
-    uint8_t raw_data[6];
-    Period_markEvent(PERIOD_EVENT_SAMPLE_ACCEL);
-    read_i2c_burst(i2c_file_desc, REG_OUT_X_L, raw_data, 6);
-
-    int16_t x = (int16_t)((raw_data[1] << 8) | raw_data[0]) >> 2;
-    int16_t y = (int16_t)((raw_data[3] << 8) | raw_data[2]) >> 2;
-    int16_t z = (int16_t)((raw_data[5] << 8) | raw_data[4]) >> 2;
+    static AccelerometerData lastData = {0, 0, 0};
+    uint8_t raw_data[BYTES_PER_SAMPLE];
+    Probe_markPeriod(periodProbe);
+    if (I2c_readRegisters(&device, REG_OUT_X_L | AUTO_INCREMENT, raw_data, BYTES_PER_SAMPLE) == I2C_OK) {
+        // On a failed read, repeat the last good sample
+        lastData = convertSample(raw_data);
+    }
+    return lastData;
+}
 
-    sleepForMs(10);
-    AccelerometerData data = {x / SENSITIVITY_2G, y / SENSITIVITY_2G, z / SENSITIVITY_2G};
-    return data;
+I2cStatistics Accelerometer_getBusStatistics(void) {
+    assert(isInitialized);
+    return I2c_getStatistics(&device);
 }
 
-Period_statistics_t Accelerometer_getSamplingTime() {
+Probe_statistics_t Accelerometer_getSamplingTime() {
     assert(isInitialized);
-    Period_statistics_t stats;
-    Period_getStatisticsAndClear(PERIOD_EVENT_SAMPLE_ACCEL, &stats);
+    Probe_statistics_t stats;
+    Probe_getStatistics(periodProbe, &stats);
     return stats;
 }
\ No newline at end of file
@@ -2,17 +2,20 @@
 // which are left as incomplete.
 // Note: Generates low latency audio on BeagleBone Black; higher latency found on host.
 #include "hal/audioMixer.h"
+#include "trace.h"
 #include <alsa/asoundlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <limits.h>
+#include <time.h>
 #include <alloca.h> // needed for mixer
 
 static snd_pcm_t *handle;
 
 #define DEFAULT_VOLUME 80
 
-#define SAMPLE_RATE 44100
+#define SAMPLE_RATE AUDIOMIXER_SAMPLE_RATE
 #define NUM_CHANNELS 1
 #define SAMPLE_SIZE (sizeof(short)) 			// bytes per sample
 // Sample size note: This works for mono files because each sample ("frame') is 1 value.
@@ -21,6 +24,12 @@ static snd_pcm_t *handle;
 static unsigned long playbackBufferSize = 0;
 static short *playbackBuffer = NULL;
 
+// Audio clock: frames rendered so far
+static atomic_llong framePosition = 0;
+
+// Gain is applied in Q15 fixed point
+#define GAIN_ONE (1 << 15)
+
 
 // Currently active (waiting to be played) sound bites
 #define MAX_SOUND_BITES 30
@@ -33,9 +42,23 @@ typedef struct {
 	// The offset into the pData of pSound. Indicates how much of the
 	// sound has already been played (and hence where to start playing next).
 	int location;
+
+	// Output frame at which the sound starts, and its gain (Q15).
+	long long startFrame;
+	int gain;
+	// A timed sound which has not started yet: measure how far from expectedFrame
+	// it does.
+	bool isStartPending;
+	long long expectedFrame;
+
+	// Oscillator/noise/envelope state when pSound is a synthesized drum.
+	DrumSynth_state synth;
 } playbackSound_t;
 static playbackSound_t soundBites[MAX_SOUND_BITES];
 
+static void queueSound(wavedata_t *pSound, float gain, long long startFrame,
+                       bool isTimed, long long expectedFrame);
+
 // Playback threading
 void* playbackThread(void* arg);
 static _Bool stopping = false;
@@ -44,9 +67,30 @@ static pthread_mutex_t audioMutex = PTHREAD_MUTEX_INITIALIZER;
 
 static int volume = 0;
 
+// Start errors of scheduled sounds, in frames, since the last read (under audioMutex)
+static const long long startBucketLimits[AUDIOMIXER_START_BUCKETS - 1] = {
+	0,
+	SAMPLE_RATE / 1000,
+	SAMPLE_RATE * 5 / 1000,
+	SAMPLE_RATE * 25 / 1000,
+};
+static int numStarts = 0;
+static long long totalStartErrorFrames = 0;
+static long long maxStartErrorFrames = 0;
+static int startHistogram[AUDIOMIXER_START_BUCKETS];
+static int numDroppedStarts = 0;
+
+// Timing probes: time between blocks, time to mix a block, and sounds playing
+static Probe *periodProbe;
+static Probe *mixProbe;
+static Probe *voicesProbe;
+
 void AudioMixer_init(void)
 {
 	AudioMixer_setVolume(DEFAULT_VOLUME);
+	periodProbe = Probe_register("audio period", PROBE_PERIOD);
+	mixProbe = Probe_register("audio mix", PROBE_DURATION);
+	voicesProbe = Probe_register("audio voices", PROBE_GAUGE);
 
 	// Initialize the currently active sound-bites being played
 	// REVISIT:- Implement this. Hint: set the pSound pointer to NULL for each
@@ -115,6 +159,7 @@ void AudioMixer_readWaveFileIntoMemory(char *fileName, wavedata_t *pSound)
 	fseek(file, PCM_DATA_OFFSET, SEEK_SET);
 
 	// Allocate space to hold all PCM data
+	pSound->pSynth = NULL;
 	pSound->pData = malloc(sizeInBytes);
 	if (pSound->pData == 0) {
 		fprintf(stderr, "ERROR: Unable to allocate %d bytes for file %s.\n",
@@ -137,13 +182,46 @@ void AudioMixer_freeWaveFileData(wavedata_t *pSound)
 	pSound->numSamples = 0;
 	free(pSound->pData);
 	pSound->pData = NULL;
+	pSound->pSynth = NULL;
+}
+
+void AudioMixer_initSynthSound(DrumSynth_voice *pVoice, wavedata_t *pSound)
+{
+	assert(pVoice);
+	pSound->pData = NULL;
+	pSound->pSynth = pVoice;
+	pSound->numSamples = DrumSynth_getNumFrames(pVoice);
 }
 
 void AudioMixer_queueSound(wavedata_t *pSound)
+{
+	AudioMixer_queueSoundAt(pSound, 1.0f, 0);
+}
+
+void AudioMixer_queueSoundAt(wavedata_t *pSound, float gain, long long startFrame)
+{
+	queueSound(pSound, gain, startFrame, false, 0);
+}
+
+void AudioMixer_queueTimedSound(wavedata_t *pSound, float gain, long long startFrame,
+                                long long expectedFrame)
+{
+	queueSound(pSound, gain, startFrame, true, expectedFrame);
+}
+
+void AudioMixer_countDroppedSound(void)
+{
+	pthread_mutex_lock(&audioMutex);
+	numDroppedStarts++;
+	pthread_mutex_unlock(&audioMutex);
+}
+
+static void queueSound(wavedata_t *pSound, float gain, long long startFrame,
+                       bool isTimed, long long expectedFrame)
 {
 	// Ensure we are only being asked to play "good" sounds:
 	assert(pSound->numSamples > 0);
-	assert(pSound->pData);
+	assert(pSound->pData || pSound->pSynth);
 
 	// Insert the sound by searching for an empty sound bite spot
 	/*
@@ -165,6 +243,13 @@ void AudioMixer_queueSound(wavedata_t *pSound)
 		if (soundBites[i].pSound == NULL) {
 			soundBites[i].pSound = pSound;
 			soundBites[i].location = 0;
+			soundBites[i].startFrame = startFrame;
+			soundBites[i].isStartPending = isTimed;
+			soundBites[i].expectedFrame = expectedFrame;
+			soundBites[i].gain = (int)(gain * GAIN_ONE);
+			if (pSound->pSynth) {
+				DrumSynth_startHit(pSound->pSynth, &soundBites[i].synth, gain);
+			}
 			queued = true;
 			break;
 		}
@@ -243,6 +328,54 @@ void AudioMixer_setVolume(int newVolume)
 }
 
 
+// Add the next `size` values of one playing sound bite into buff.
+// Returns true once the whole sound has been played.
+static bool mixSoundBite(playbackSound_t *pBite, short *buff, int size)
+{
+	wavedata_t *pSound = pBite->pSound;
+	// The offset that sound shold start playin from.
+	int location = pBite->location;
+
+	if (pSound->pSynth) {
+		// Synthesized sounds are rendered on the fly, a block at a time
+		int numFrames = pBite->synth.coeffs.numFrames;
+		int count = numFrames - location < size ? numFrames - location : size;
+		DrumSynth_mixInto(&pBite->synth, buff, count);
+		pBite->location = location + count;
+		return pBite->location >= numFrames;
+	}
+
+	// Buffer store the sound data gonna play, note: This buffer gonna mix the different psound together
+	int count = pSound->numSamples - location < size ? pSound->numSamples - location : size;
+	const short *pData = &pSound->pData[location];
+	const int gain = pBite->gain;
+	for (int j = 0; j < count; j++) {
+		int mixedValue = buff[j] + ((pData[j] * gain) >> 15);
+		if (mixedValue > SHRT_MAX) mixedValue = SHRT_MAX;
+		if (mixedValue < SHRT_MIN) mixedValue = SHRT_MIN;
+		buff[j] = mixedValue;
+	}
+	pBite->location = location + count;
+	return pBite->location >= pSound->numSamples;
+}
+
+// Count a timed sound starting errorFrames after (or, if negative, before) its expected
+// frame. Called with audioMutex held.
+static void recordStart(long long errorFrames)
+{
+	long long sizeFrames = llabs(errorFrames);
+	int bucket = 0;
+	while (bucket < AUDIOMIXER_START_BUCKETS - 1 && sizeFrames > startBucketLimits[bucket]) {
+		bucket++;
+	}
+	startHistogram[bucket]++;
+	numStarts++;
+	totalStartErrorFrames += errorFrames;
+	if (sizeFrames > maxStartErrorFrames) {
+		maxStartErrorFrames = sizeFrames;
+	}
+}
+
 // Fill the buff array with new PCM values to output.
 //    buff: buffer to fill with new PCM data from sound bites.
 //    size: the number of *values* to store into buff
@@ -289,52 +422,57 @@ static void fillPlaybackBuffer(short *buff, int size)
 	 *
 	 */
 
+	 long long mixBeginNs = Probe_beginDuration();
 	 memset(buff, 0, size * sizeof(short));
+	 long long blockStart = framePosition;
+	 int numVoices = 0;
 	 pthread_mutex_lock(&audioMutex);
 	 for (int i = 0; i < MAX_SOUND_BITES; i++) {
 		// If the slot is being used, add the sound to the buffer
 		 if (soundBites[i].pSound != NULL) {
-			 wavedata_t *pSound = soundBites[i].pSound;
-			 // The offset that sound shold start playin from.
-			 int location = soundBites[i].location;
-			 // Buffer store the sound data gonna play, note: This buffer gonna mix the different psound together
-			 for (int j = 0; j < size; j++) {
-				// If there is more data to play, add it to the buffer
-				if (location < pSound->numSamples) {
-					int mixedValue = buff[j] + pSound->pData[location];
-					if (mixedValue > SHRT_MAX) mixedValue = SHRT_MAX;
-					if (mixedValue < SHRT_MIN) mixedValue = SHRT_MIN;
-					buff[j] = mixedValue;
-					location ++;
-				 } else {
-					break;
-				 }
+			 numVoices++;
+			 // Sounds scheduled for later start part way into (or after) this block
+			 int offset = 0;
+			 if (soundBites[i].startFrame > blockStart) {
+				if (soundBites[i].startFrame >= blockStart + size) {
+					continue;
+				}
+				offset = soundBites[i].startFrame - blockStart;
+			 }
+			 if (soundBites[i].isStartPending) {
+				recordStart(blockStart + offset - soundBites[i].expectedFrame);
+				soundBites[i].isStartPending = false;
 			 }
 			 // This psound has finised playing, so free this slot
-			 if (location >= pSound->numSamples) {
+			 if (mixSoundBite(&soundBites[i], buff + offset, size - offset)) {
 				soundBites[i].pSound = NULL;
 				soundBites[i].location = 0;
-			 } else {
-				// reset index 
-				soundBites[i].location = location;
 			 }
 		 }
 	 }
-	 Period_markEvent(PERIOD_EVENT_SAMPLE_SOUND);
+	 Probe_markPeriod(periodProbe);
 	 pthread_mutex_unlock(&audioMutex);
+	 framePosition = blockStart + size;
+	 Probe_setGauge(voicesProbe, numVoices);
+	 Probe_endDuration(mixProbe, mixBeginNs);
 	
 }
 
 void* playbackThread(void* _arg)
 {
 	(void)_arg;
+	Trace_nameThread("audio");
 	while (!stopping) {
 		// Generate next block of audio
+		long long spanNs = Trace_begin();
 		fillPlaybackBuffer(playbackBuffer, playbackBufferSize);
+		Trace_end("mix", spanNs);
 
 		// Output the audio
+		spanNs = Trace_begin();
 		snd_pcm_sframes_t frames = snd_pcm_writei(handle,
 				playbackBuffer, playbackBufferSize);
+		Trace_end("writei", spanNs);
 
 		// Check for (and handle) possible error conditions on output
 		if (frames < 0) {
@@ -355,9 +493,77 @@ void* playbackThread(void* _arg)
 	return NULL;
 }
 
+long long AudioMixer_benchmarkSound(wavedata_t *pSound, int numBlocks)
+{
+	assert(pSound->numSamples > 0);
+	assert(pSound->pData || pSound->pSynth);
+	assert(numBlocks > 0);
+
+	short *scratch = malloc(playbackBufferSize * sizeof(*scratch));
+	if (scratch == NULL) {
+		return -1;
+	}
+	memset(scratch, 0, playbackBufferSize * sizeof(*scratch));
+
+	playbackSound_t bite = {.pSound = pSound, .location = 0, .gain = GAIN_ONE};
+	if (pSound->pSynth) {
+		DrumSynth_startHit(pSound->pSynth, &bite.synth, 1.0f);
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < numBlocks; i++) {
+		if (mixSoundBite(&bite, scratch, playbackBufferSize)) {
+			bite.location = 0;
+			if (pSound->pSynth) {
+				DrumSynth_startHit(pSound->pSynth, &bite.synth, 1.0f);
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(scratch);
+
+	long long elapsedNs = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+	return elapsedNs / numBlocks;
+}
+
+long long AudioMixer_getFramePosition(void)
+{
+	return framePosition;
+}
+
+int AudioMixer_getBlockFrames(void)
+{
+	return playbackBufferSize;
+}
+
 // Get the audio timing stat.
-Period_statistics_t AudioMixer_getAudioStat() {
-    Period_statistics_t stats;
-    Period_getStatisticsAndClear(PERIOD_EVENT_SAMPLE_SOUND, &stats);
+Probe_statistics_t AudioMixer_getAudioStat() {
+    Probe_statistics_t stats;
+    Probe_getStatistics(periodProbe, &stats);
     return stats;
+}
+
+AudioMixer_startStatistics_t AudioMixer_getStartStatisticsAndClear(void)
+{
+	AudioMixer_startStatistics_t stats = {0};
+	pthread_mutex_lock(&audioMutex);
+	{
+		stats.numStarts = numStarts;
+		if (numStarts > 0) {
+			stats.avgErrorInMs = totalStartErrorFrames * 1000.0 / SAMPLE_RATE / numStarts;
+		}
+		stats.maxErrorInMs = maxStartErrorFrames * 1000.0 / SAMPLE_RATE;
+		for (int i = 0; i < AUDIOMIXER_START_BUCKETS; i++) {
+			stats.histogram[i] = startHistogram[i];
+			startHistogram[i] = 0;
+		}
+		stats.numDropped = numDroppedStarts;
+		numStarts = 0;
+		totalStartErrorFrames = 0;
+		maxStartErrorFrames = 0;
+		numDroppedStarts = 0;
+	}
+	pthread_mutex_unlock(&audioMutex);
+	return stats;
 }
\ No newline at end of file
@@ -0,0 +1,279 @@
+/* drumSynth.c
+ *
+ * This file implements the procedural drum voices declared in drumSynth.h.
+ * Hits are rendered 4 frames at a time using GCC vector extensions, so the
+ * kernel compiles to NEON on the target (and SSE on a host build).
+ */
+
+#include "hal/drumSynth.h"
+#include "hal/audioMixer.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#define MS_PER_SECOND 1000.0f
+#define PCM_FULL_SCALE 32767.0f
+#define NOISE_SCALE (1.0f / 2147483648.0f)
+#define NOISE_SEED 0x9E3779B9u
+#define BLOCK_FRAMES 64
+#define MAX_LENGTH_MS 2000.0f
+#define MIN_LENGTH_MS 1.0f
+#define MAX_FREQ_HZ (AUDIOMIXER_SAMPLE_RATE / 2.0f - 1.0f)     // Below Nyquist
+
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int32_t v4si __attribute__((vector_size(16)));
+typedef uint32_t v4su __attribute__((vector_size(16)));
+
+static const DrumSynth_params defaultParams[DRUMSYNTH_NUM_MODELS] = {
+    [DRUMSYNTH_KICK] = {
+        .startFreqHz = 160, .endFreqHz = 50, .pitchDecayMs = 30,
+        .toneDecayMs = 120, .noiseDecayMs = 5,
+        .toneLevel = 0.9f, .noiseLevel = 0.1f, .noiseHighPass = 0,
+        .lengthMs = 600,
+    },
+    [DRUMSYNTH_SNARE] = {
+        .startFreqHz = 260, .endFreqHz = 180, .pitchDecayMs = 10,
+        .toneDecayMs = 60, .noiseDecayMs = 110,
+        .toneLevel = 0.4f, .noiseLevel = 0.6f, .noiseHighPass = 0.5f,
+        .lengthMs = 500,
+    },
+    [DRUMSYNTH_HIHAT] = {
+        .startFreqHz = 0, .endFreqHz = 0, .pitchDecayMs = 0,
+        .toneDecayMs = 0, .noiseDecayMs = 35,
+        .toneLevel = 0, .noiseLevel = 0.5f, .noiseHighPass = 0.95f,
+        .lengthMs = 150,
+    },
+};
+
+// Parameter names accepted by DrumSynth_setParamByName(), and their valid ranges
+// (inclusive). A frequency or decay of 0 turns that part of the voice off.
+static const struct {
+    const char *name;
+    size_t offset;
+    float min;
+    float max;
+} paramFields[] = {
+    {"startFreqHz", offsetof(DrumSynth_params, startFreqHz), 0, MAX_FREQ_HZ},
+    {"endFreqHz", offsetof(DrumSynth_params, endFreqHz), 0, MAX_FREQ_HZ},
+    {"pitchDecayMs", offsetof(DrumSynth_params, pitchDecayMs), 0, MAX_LENGTH_MS},
+    {"toneDecayMs", offsetof(DrumSynth_params, toneDecayMs), 0, MAX_LENGTH_MS},
+    {"noiseDecayMs", offsetof(DrumSynth_params, noiseDecayMs), 0, MAX_LENGTH_MS},
+    {"toneLevel", offsetof(DrumSynth_params, toneLevel), 0, 1},
+    {"noiseLevel", offsetof(DrumSynth_params, noiseLevel), 0, 1},
+    {"noiseHighPass", offsetof(DrumSynth_params, noiseHighPass), 0, 1},
+    {"lengthMs", offsetof(DrumSynth_params, lengthMs), MIN_LENGTH_MS, MAX_LENGTH_MS},
+};
+#define NUM_PARAM_FIELDS (sizeof(paramFields) / sizeof(paramFields[0]))
+
+// Per-sample multiplier for an exponential decay with the given time constant.
+static float decayPerSample(float timeConstantMs)
+{
+    if (timeConstantMs <= 0) {
+        return 0;
+    }
+    return expf(-MS_PER_SECOND / (timeConstantMs * AUDIOMIXER_SAMPLE_RATE));
+}
+
+static void computeCoeffs(const DrumSynth_params *pParams, DrumSynth_coeffs_t *pCoeffs)
+{
+    pCoeffs->endFreq = pParams->endFreqHz / AUDIOMIXER_SAMPLE_RATE;
+    pCoeffs->sweepFreq = (pParams->startFreqHz - pParams->endFreqHz) / AUDIOMIXER_SAMPLE_RATE;
+    pCoeffs->sweepDecay = decayPerSample(pParams->pitchDecayMs);
+    pCoeffs->toneDecay = decayPerSample(pParams->toneDecayMs);
+    pCoeffs->noiseDecay = decayPerSample(pParams->noiseDecayMs);
+    pCoeffs->toneGain = pParams->toneLevel * PCM_FULL_SCALE;
+    pCoeffs->noiseGain = pParams->noiseLevel * PCM_FULL_SCALE;
+    pCoeffs->noiseHighPass = pParams->noiseHighPass;
+    pCoeffs->numFrames = (int)(pParams->lengthMs * AUDIOMIXER_SAMPLE_RATE / MS_PER_SECOND);
+    if (pCoeffs->numFrames < 1) {
+        pCoeffs->numFrames = 1;
+    }
+}
+
+void DrumSynth_initVoice(DrumSynth_voice *pVoice, DrumSynth_model model)
+{
+    assert(model >= 0 && model < DRUMSYNTH_NUM_MODELS);
+    pthread_mutex_init(&pVoice->lock, NULL);
+    pVoice->params = defaultParams[model];
+    computeCoeffs(&pVoice->params, &pVoice->coeffs);
+}
+
+void DrumSynth_cleanupVoice(DrumSynth_voice *pVoice)
+{
+    pthread_mutex_destroy(&pVoice->lock);
+}
+
+DrumSynth_params DrumSynth_getParams(DrumSynth_voice *pVoice)
+{
+    pthread_mutex_lock(&pVoice->lock);
+    DrumSynth_params params = pVoice->params;
+    pthread_mutex_unlock(&pVoice->lock);
+    return params;
+}
+
+void DrumSynth_setParams(DrumSynth_voice *pVoice, const DrumSynth_params *pParams)
+{
+    pthread_mutex_lock(&pVoice->lock);
+    pVoice->params = *pParams;
+    computeCoeffs(&pVoice->params, &pVoice->coeffs);
+    pthread_mutex_unlock(&pVoice->lock);
+}
+
+bool DrumSynth_setParamByName(DrumSynth_voice *pVoice, const char *name, float value)
+{
+    for (size_t i = 0; i < NUM_PARAM_FIELDS; i++) {
+        if (strcmp(name, paramFields[i].name) == 0) {
+            if (!isfinite(value) || value < paramFields[i].min || value > paramFields[i].max) {
+                return false;
+            }
+            DrumSynth_params params = DrumSynth_getParams(pVoice);
+            *(float *)((char *)&params + paramFields[i].offset) = value;
+            DrumSynth_setParams(pVoice, &params);
+            return true;
+        }
+    }
+    return false;
+}
+
+int DrumSynth_getNumFrames(DrumSynth_voice *pVoice)
+{
+    pthread_mutex_lock(&pVoice->lock);
+    int numFrames = pVoice->coeffs.numFrames;
+    pthread_mutex_unlock(&pVoice->lock);
+    return numFrames;
+}
+
+void DrumSynth_startHit(DrumSynth_voice *pVoice, DrumSynth_state *pState, float gain)
+{
+    pthread_mutex_lock(&pVoice->lock);
+    pState->coeffs = pVoice->coeffs;
+    pthread_mutex_unlock(&pVoice->lock);
+
+    pState->coeffs.toneGain *= gain;
+    pState->coeffs.noiseGain *= gain;
+
+    pState->phase = 0;
+    pState->sweep = pState->coeffs.sweepFreq;
+    pState->toneEnv = 1;
+    pState->noiseEnv = 1;
+    for (int lane = 0; lane < DRUMSYNTH_LANES; lane++) {
+        pState->noiseSeed[lane] = NOISE_SEED * (lane + 1);
+        pState->prevNoise[lane] = 0;
+    }
+    pState->carryCount = 0;
+}
+
+// Fast approximation of sin(2*pi*phase) for phase in [0, 1).
+static inline v4sf sinCycles(v4sf phase)
+{
+    const v4su absMask = {0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF};
+
+    // Map to u in [-0.5, 0.5) where sin(2*pi*phase) = -sin(2*pi*u)
+    v4sf u = phase - 0.5f;
+    v4sf absU = (v4sf)((v4su)u & absMask);
+    v4sf y = -8.0f * u * (1.0f - 2.0f * absU);
+
+    // One refinement step takes the parabola to within ~0.1% of a sine
+    v4sf absY = (v4sf)((v4su)y & absMask);
+    return 0.225f * (y * absY - y) + y;
+}
+
+// Render numFrames (a multiple of DRUMSYNTH_LANES) of the hit into out[].
+static void renderBlock(DrumSynth_state *pState, float *out, int numFrames)
+{
+    const DrumSynth_coeffs_t *c = &pState->coeffs;
+    const v4sf laneIndex = {0, 1, 2, 3};
+    const float toneDecay2 = c->toneDecay * c->toneDecay;
+    const float noiseDecay2 = c->noiseDecay * c->noiseDecay;
+    const v4sf toneRamp = {1, c->toneDecay, toneDecay2, toneDecay2 * c->toneDecay};
+    const v4sf noiseRamp = {1, c->noiseDecay, noiseDecay2, noiseDecay2 * c->noiseDecay};
+    const float toneStep = toneDecay2 * toneDecay2;
+    const float noiseStep = noiseDecay2 * noiseDecay2;
+    const float sweepDecay2 = c->sweepDecay * c->sweepDecay;
+    const float sweepStep = sweepDecay2 * sweepDecay2;
+
+    float phase = pState->phase;
+    float sweep = pState->sweep;
+    float toneEnv = pState->toneEnv;
+    float noiseEnv = pState->noiseEnv;
+    v4su seed;
+    v4sf prevNoise;
+    memcpy(&seed, pState->noiseSeed, sizeof(seed));
+    memcpy(&prevNoise, pState->prevNoise, sizeof(prevNoise));
+
+    for (int i = 0; i < numFrames; i += DRUMSYNTH_LANES) {
+        // Oscillator; the swept frequency is held constant across the 4 lanes
+        float freq = c->endFreq + sweep;
+        v4sf lanePhase = phase + freq * laneIndex;
+        lanePhase -= __builtin_convertvector(__builtin_convertvector(lanePhase, v4si), v4sf);
+        v4sf tone = sinCycles(lanePhase) * (toneEnv * c->toneGain) * toneRamp;
+
+        // Noise: an independent xorshift32 generator per lane, with a
+        // first-difference high-pass against the lane's previous value
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        v4sf white = __builtin_convertvector((v4si)seed, v4sf) * NOISE_SCALE;
+        v4sf noise = (white - c->noiseHighPass * prevNoise) * (noiseEnv * c->noiseGain) * noiseRamp;
+        prevNoise = white;
+
+        v4sf mixed = tone + noise;
+        memcpy(&out[i], &mixed, sizeof(mixed));
+
+        phase += DRUMSYNTH_LANES * freq;
+        phase -= (int)phase;
+        sweep *= sweepStep;
+        toneEnv *= toneStep;
+        noiseEnv *= noiseStep;
+    }
+
+    pState->phase = phase;
+    pState->sweep = sweep;
+    pState->toneEnv = toneEnv;
+    pState->noiseEnv = noiseEnv;
+    memcpy(pState->noiseSeed, &seed, sizeof(seed));
+    memcpy(pState->prevNoise, &prevNoise, sizeof(prevNoise));
+}
+
+static inline void mixFrames(short *buff, const float *in, int numFrames)
+{
+    for (int i = 0; i < numFrames; i++) {
+        int mixedValue = buff[i] + (int)in[i];
+        if (mixedValue > SHRT_MAX) mixedValue = SHRT_MAX;
+        if (mixedValue < SHRT_MIN) mixedValue = SHRT_MIN;
+        buff[i] = mixedValue;
+    }
+}
+
+void DrumSynth_mixInto(DrumSynth_state *pState, short *buff, int numFrames)
+{
+    // Use up frames left over from the previous call first
+    int fromCarry = pState->carryCount < numFrames ? pState->carryCount : numFrames;
+    if (fromCarry > 0) {
+        int start = DRUMSYNTH_LANES - pState->carryCount;
+        mixFrames(buff, &pState->carry[start], fromCarry);
+        pState->carryCount -= fromCarry;
+        buff += fromCarry;
+        numFrames -= fromCarry;
+    }
+
+    float block[BLOCK_FRAMES];
+    while (numFrames >= DRUMSYNTH_LANES) {
+        int count = numFrames < BLOCK_FRAMES ? numFrames : BLOCK_FRAMES;
+        count -= count % DRUMSYNTH_LANES;
+        renderBlock(pState, block, count);
+        mixFrames(buff, block, count);
+        buff += count;
+        numFrames -= count;
+    }
+
+    // Render one more 4-wide step for the tail; keep what isn't used for next time
+    if (numFrames > 0) {
+        renderBlock(pState, pState->carry, DRUMSYNTH_LANES);
+        mixFrames(buff, pState->carry, numFrames);
+        pState->carryCount = DRUMSYNTH_LANES - numFrames;
+    }
+}
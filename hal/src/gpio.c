@@ -7,6 +7,14 @@
 #include <stdio.h>
 #include <gpiod.h>
 #include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <linux/gpio.h>
 
 // Relies on the gpiod library.
 // Insallation for cross compiling:
@@ -17,11 +25,16 @@
 // Example: https://github.com/starnight/libgpiod-example/blob/master/libgpiod-input/main.c
 
 // TYPE NOTE:
-// Internally cast the 
-//    struct GpioLine* 
-// to 
+// A struct GpioLine wraps either a
 //    (struct gpiod_line*)
+// or, for lines opened with kernel debounce, the file descriptor of a
+// gpio-cdev v2 line request (which libgpiod v1 cannot configure),
 // so we hide the dependency on gpiod
+struct GpioLine {
+    struct gpiod_line* gpiodLine;   // NULL for a v2 line request
+    int requestFd;                  // -1 for a gpiod line
+    unsigned int offset;
+};
 
 
 static bool s_isInitialized = false;
@@ -35,6 +48,26 @@ static char* s_chipNames[] = {
 // Hold open chips
 static struct gpiod_chip* s_openGpiodChips[GPIO_NUM_CHIPS];
 
+#define NS_PER_SECOND 1000000000LL
+#define STOP_KEY UINT32_MAX
+
+// Event reactor. A watch's epoll key is (watch index << 8 | line index).
+typedef struct {
+    bool isUsed;
+    struct GpioLine* lines[GPIO_MAX_WATCH_LINES];
+    int numLines;
+    Gpio_eventHandler handler;
+    void *pContext;
+} Watch_t;
+
+static Watch_t s_watches[GPIO_MAX_WATCHES];
+static pthread_mutex_t s_watchLock = PTHREAD_MUTEX_INITIALIZER;
+static int s_epollFd = -1;
+static int s_stopFd = -1;
+static pthread_t s_reactorThread;
+
+static void* reactorThread(void* arg);
+
 void Gpio_initialize(void)
 {
     for (int i = 0; i < GPIO_NUM_CHIPS; i++) {
@@ -45,12 +78,29 @@ void Gpio_initialize(void)
             exit(EXIT_FAILURE);
         }
     }
+    s_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    s_stopFd = eventfd(0, EFD_CLOEXEC);
+    if (s_epollFd == -1 || s_stopFd == -1) {
+        perror("GPIO Initializing: Unable to create event reactor");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event stopEvent = {.events = EPOLLIN, .data.u32 = STOP_KEY};
+    epoll_ctl(s_epollFd, EPOLL_CTL_ADD, s_stopFd, &stopEvent);
+    memset(s_watches, 0, sizeof(s_watches));
     s_isInitialized = true;
+    pthread_create(&s_reactorThread, NULL, &reactorThread, NULL);
 }
 
 void Gpio_cleanup(void)
 {
     assert(s_isInitialized);
+    uint64_t stop = 1;
+    if (write(s_stopFd, &stop, sizeof(stop)) != sizeof(stop)) {
+        perror("GPIO Cleanup: Unable to stop event reactor");
+    }
+    pthread_join(s_reactorThread, NULL);
+    close(s_stopFd);
+    close(s_epollFd);
     for (int i = 0; i < GPIO_NUM_CHIPS; i++) {
         // Close GPIO chip
         gpiod_chip_close(s_openGpiodChips[i]);
@@ -74,63 +124,257 @@ struct GpioLine* Gpio_openForEvents(enum eGpioChips chip, int pinNumber)
         perror("Unable to get GPIO line");
         exit(EXIT_FAILURE);
     }
+    if (gpiod_line_request_both_edges_events(line, "Event Waiting") == -1) {
+        perror("Unable to request GPIO line events");
+        exit(EXIT_FAILURE);
+    }
 
-    return (struct GpioLine*) line;  
+    struct GpioLine* pLine = malloc(sizeof(*pLine));
+    pLine->gpiodLine = line;
+    pLine->requestFd = -1;
+    pLine->offset = pinNumber;
+    return pLine;
 }
 
-void Gpio_close(struct GpioLine* line)
+// Request the line for both edges through gpio-cdev v2, with the kernel debouncing
+// it. Returns the request's fd, or -1 if the kernel does not support it.
+static int requestDebouncedLine(enum eGpioChips chip, int pinNumber, int debounceUs)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/%s", s_chipNames[chip]);
+    int chipFd = open(path, O_RDWR | O_CLOEXEC);
+    if (chipFd == -1) {
+        return -1;
+    }
+    struct gpio_v2_line_request request;
+    memset(&request, 0, sizeof(request));
+    request.offsets[0] = pinNumber;
+    request.num_lines = 1;
+    strncpy(request.consumer, "Event Waiting", sizeof(request.consumer) - 1);
+    request.config.flags = GPIO_V2_LINE_FLAG_INPUT
+        | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    request.config.num_attrs = 1;
+    request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+    request.config.attrs[0].attr.debounce_period_us = debounceUs;
+    request.config.attrs[0].mask = 1;   // Applies to offsets[0]
+    int status = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &request);
+    close(chipFd);
+    return status == -1 ? -1 : request.fd;
+}
+
+struct GpioLine* Gpio_openForDebouncedEvents(enum eGpioChips chip, int pinNumber, int debounceUs)
 {
     assert(s_isInitialized);
-    gpiod_line_release((struct gpiod_line*) line);
+    int requestFd = requestDebouncedLine(chip, pinNumber, debounceUs);
+    if (requestFd == -1) {
+        printf("WARNING: No kernel debounce for GPIO %s line %d, debouncing in userspace\n",
+            s_chipNames[chip], pinNumber);
+        return Gpio_openForEvents(chip, pinNumber);
+    }
+    struct GpioLine* pLine = malloc(sizeof(*pLine));
+    pLine->gpiodLine = NULL;
+    pLine->requestFd = requestFd;
+    pLine->offset = pinNumber;
+    return pLine;
 }
 
+bool Gpio_isKernelDebounced(struct GpioLine* line)
+{
+    return line->requestFd != -1;
+}
 
-// Returns the number of events
-int Gpio_waitFor1LineChange(
-    struct GpioLine* line1, 
-    struct gpiod_line_bulk *bulkEvents
-) {
+static int getEventFd(struct GpioLine* line)
+{
+    return line->gpiodLine ? gpiod_line_event_get_fd(line->gpiodLine) : line->requestFd;
+}
+
+int Gpio_watchLines(struct GpioLine* lines[], int numLines, Gpio_eventHandler handler, void *pContext)
+{
     assert(s_isInitialized);
+    assert(numLines > 0 && numLines <= GPIO_MAX_WATCH_LINES);
+    int watchId = -1;
+    pthread_mutex_lock(&s_watchLock);
+    {
+        for (int i = 0; i < GPIO_MAX_WATCHES && watchId == -1; i++) {
+            if (!s_watches[i].isUsed) {
+                watchId = i;
+            }
+        }
+        if (watchId != -1) {
+            Watch_t *pWatch = &s_watches[watchId];
+            pWatch->isUsed = true;
+            pWatch->numLines = numLines;
+            pWatch->handler = handler;
+            pWatch->pContext = pContext;
+            for (int i = 0; i < numLines; i++) {
+                pWatch->lines[i] = lines[i];
+                struct epoll_event event = {.events = EPOLLIN, .data.u32 = (uint32_t)watchId << 8 | i};
+                if (epoll_ctl(s_epollFd, EPOLL_CTL_ADD, getEventFd(lines[i]), &event) == -1) {
+                    perror("Unable to watch GPIO line");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&s_watchLock);
+    return watchId;
+}
 
-    // Source: https://people.eng.unimelb.edu.au/pbeuchat/asclinic/software/building_block_gpio_encoder_counting.html   
-    struct gpiod_line_bulk bulkWait;
-    gpiod_line_bulk_init(&bulkWait);
-    
-    gpiod_line_bulk_add(&bulkWait, (struct gpiod_line*)line1);
-    
-    gpiod_line_request_bulk_both_edges_events(&bulkWait, "Event Waiting");
+void Gpio_unwatch(int watchId)
+{
+    assert(s_isInitialized);
+    assert(watchId >= 0 && watchId < GPIO_MAX_WATCHES);
+    pthread_mutex_lock(&s_watchLock);
+    {
+        Watch_t *pWatch = &s_watches[watchId];
+        for (int i = 0; i < pWatch->numLines; i++) {
+            epoll_ctl(s_epollFd, EPOLL_CTL_DEL, getEventFd(pWatch->lines[i]), NULL);
+        }
+        pWatch->isUsed = false;
+    }
+    pthread_mutex_unlock(&s_watchLock);
+}
 
-    struct timespec timeout = { 1, 0 }; // 1 second timeout
-    int result = gpiod_line_event_wait_bulk(&bulkWait, &timeout, bulkEvents);
-    if ( result == -1) {
-        perror("Error waiting on lines for event waiting");
-        return -1;
+// Read the waiting events of a v2 line request (timestamps are CLOCK_MONOTONIC).
+static int readRequestEvents(struct GpioLine* line, GpioEvent *pEvents)
+{
+    struct gpio_v2_line_event events[GPIO_MAX_EVENTS];
+    ssize_t length = read(line->requestFd, events, sizeof(events));
+    if (length == -1) {
+        perror("Line Event");
+        return 0;
     }
-    if (result == 0) {
+    int count = length / sizeof(events[0]);
+    for (int i = 0; i < count; i++) {
+        pEvents[i].lineNumber = events[i].offset;
+        pEvents[i].isRising = events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+        pEvents[i].timestampNs = events[i].timestamp_ns;
+    }
+    return count;
+}
+
+// Read the waiting events of one line, appending them to pEvents.
+static int readLineEvents(struct GpioLine* pLine, GpioEvent *pEvents)
+{
+    if (!pLine->gpiodLine) {
+        return readRequestEvents(pLine, pEvents);
+    }
+    struct gpiod_line_event events[GPIO_MAX_EVENTS];
+    int count = gpiod_line_event_read_multiple(pLine->gpiodLine, events, GPIO_MAX_EVENTS);
+    if (count == -1) {
+        perror("Line Event");
         return 0;
     }
+    unsigned int lineNumber = pLine->offset;
+    for (int i = 0; i < count; i++) {
+        pEvents[i].lineNumber = lineNumber;
+        pEvents[i].isRising = events[i].event_type == GPIOD_LINE_EVENT_RISING_EDGE;
+        pEvents[i].timestampNs = events[i].ts.tv_sec * NS_PER_SECOND + events[i].ts.tv_nsec;
+    }
+    return count;
+}
 
-    int numEvents = gpiod_line_bulk_num_lines(bulkEvents);
-    return numEvents;
+// Insertion sort by timestamp: merges the (already sorted) batches of two lines.
+static void sortEvents(GpioEvent *pEvents, int count)
+{
+    for (int i = 1; i < count; i++) {
+        GpioEvent event = pEvents[i];
+        int j = i - 1;
+        while (j >= 0 && pEvents[j].timestampNs > event.timestampNs) {
+            pEvents[j + 1] = pEvents[j];
+            j--;
+        }
+        pEvents[j + 1] = event;
+    }
+}
+
+static void* reactorThread(void* arg)
+{
+    (void)arg;
+    struct epoll_event ready[GPIO_MAX_WATCHES * GPIO_MAX_WATCH_LINES + 1];
+    while (true) {
+        int numReady = epoll_wait(s_epollFd, ready, sizeof(ready) / sizeof(ready[0]), -1);
+        if (numReady == -1) {
+            continue;   // Interrupted by a signal
+        }
+
+        pthread_mutex_lock(&s_watchLock);
+        // Which lines of each watch have events waiting
+        bool isLineReady[GPIO_MAX_WATCHES][GPIO_MAX_WATCH_LINES] = {{false}};
+        bool isStopping = false;
+        for (int i = 0; i < numReady; i++) {
+            uint32_t key = ready[i].data.u32;
+            if (key == STOP_KEY) {
+                isStopping = true;
+            } else {
+                isLineReady[key >> 8][key & 0xFF] = true;
+            }
+        }
+        for (int watchId = 0; watchId < GPIO_MAX_WATCHES && !isStopping; watchId++) {
+            Watch_t *pWatch = &s_watches[watchId];
+            if (!pWatch->isUsed) {
+                continue;
+            }
+            GpioEvent events[GPIO_MAX_EVENTS * GPIO_MAX_WATCH_LINES];
+            int numEvents = 0;
+            for (int i = 0; i < pWatch->numLines; i++) {
+                if (isLineReady[watchId][i]) {
+                    numEvents += readLineEvents(pWatch->lines[i], &events[numEvents]);
+                }
+            }
+            if (numEvents > 0) {
+                sortEvents(events, numEvents);
+                pWatch->handler(events, numEvents, pWatch->pContext);
+            }
+        }
+        pthread_mutex_unlock(&s_watchLock);
+        if (isStopping) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+int Gpio_getValue(struct GpioLine* line)
+{
+    assert(s_isInitialized);
+    if (line->gpiodLine) {
+        return gpiod_line_get_value(line->gpiodLine);
+    }
+    struct gpio_v2_line_values values = {.bits = 0, .mask = 1};
+    if (ioctl(line->requestFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) == -1) {
+        return -1;
+    }
+    return values.bits & 1;
 }
 
+void Gpio_close(struct GpioLine* line)
+{
+    assert(s_isInitialized);
+    if (line->gpiodLine) {
+        gpiod_line_release(line->gpiodLine);
+    } else {
+        close(line->requestFd);
+    }
+    free(line);
+}
+
+
 // Returns the number of events
-int Gpio_waitFor2LineChange(
+int Gpio_waitFor1LineChange(
     struct GpioLine* line1, 
-    struct GpioLine* line2, 
     struct gpiod_line_bulk *bulkEvents
 ) {
     assert(s_isInitialized);
+    assert(line1->gpiodLine);
 
     // Source: https://people.eng.unimelb.edu.au/pbeuchat/asclinic/software/building_block_gpio_encoder_counting.html   
     struct gpiod_line_bulk bulkWait;
     gpiod_line_bulk_init(&bulkWait);
     
-    gpiod_line_bulk_add(&bulkWait, (struct gpiod_line*)line1);
-    gpiod_line_bulk_add(&bulkWait, (struct gpiod_line*)line2);
-    
-    gpiod_line_request_bulk_both_edges_events(&bulkWait, "Event Waiting");
+    gpiod_line_bulk_add(&bulkWait, line1->gpiodLine);
 
+    // Already requested for events in Gpio_openForEvents()
     struct timespec timeout = { 1, 0 }; // 1 second timeout
     int result = gpiod_line_event_wait_bulk(&bulkWait, &timeout, bulkEvents);
     if ( result == -1) {
@@ -143,4 +387,4 @@ int Gpio_waitFor2LineChange(
 
     int numEvents = gpiod_line_bulk_num_lines(bulkEvents);
     return numEvents;
-}
\ No newline at end of file
+}
@@ -1,23 +1,53 @@
 /* i2c.c
- * 
- * This file provides initialization, cleanup, and register read/write 
- * operations for I2C communication using the Linux I2C driver. It includes 
- * functions to open an I2C bus, configure it for a specific slave device, 
- * and perform 16-bit register read and write operations.
+ *
+ * This file provides initialization, cleanup, and register read/write
+ * operations for I2C communication using the Linux I2C driver. It includes
+ * functions to open an I2C bus, configure it for a specific slave device,
+ * and perform register reads and writes as combined I2C_RDWR transactions.
+ *
+ * Each open bus has a bus thread which owns its file descriptor. Requests wait in a
+ * small array; the thread always takes the highest priority one, oldest first
+ * within a priority. Submitters wait on the bus's `completed` condition.
  */
 
 #include "hal/i2c.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <stdbool.h>
-#include <time.h>
+#include <pthread.h>
+#include <assert.h>
 #include "sleep_timer_helper.h"
+#include "trace.h"
+
+#define NS_PER_MS 1000000.0
+#define MAX_BUS_NAME 32
+
+struct I2cBus {
+    char name[MAX_BUS_NAME];
+    int fd;
+    int numDevices;
+    pthread_t thread;
+    bool isRunning;
+    pthread_mutex_t lock;
+    pthread_cond_t pending;     // A request was queued, or the bus is stopping
+    pthread_cond_t completed;   // A request completed, freeing a queue slot
+    I2cRequest *queue[I2C_MAX_PENDING];
+    int numQueued;
+    unsigned long long nextSequence;
+};
 
 static bool isInitialized = false;
+static pthread_mutex_t busesLock = PTHREAD_MUTEX_INITIALIZER;
+static I2cBus buses[I2C_MAX_BUSES];
+
+static void* busThread(void* args);
+static int runTransfer(int fd, I2cSegment *pSegments, int numSegments);
 
 void Ic2_initialize(void) {
     isInitialized = true;
@@ -27,118 +57,339 @@ void Ic2_cleanUp(void) {
     isInitialized = false;
 }
 
+// Find the open bus called name, or start one. Called with busesLock held.
+static int openBus(const char *name, I2cBus **ppBus) {
+    I2cBus *pFree = NULL;
+    for (int i = 0; i < I2C_MAX_BUSES; i++) {
+        if (buses[i].numDevices > 0 && strcmp(buses[i].name, name) == 0) {
+            *ppBus = &buses[i];
+            return I2C_OK;
+        }
+        if (buses[i].numDevices == 0 && !pFree) {
+            pFree = &buses[i];
+        }
+    }
+    if (!pFree || strlen(name) >= MAX_BUS_NAME) {
+        return I2C_ERROR_PARAMETER;
+    }
 
-int init_i2c_bus(const char* bus, int address) {
-    if (!isInitialized) {
-        perror("Error: Ic2 not initialized!\n");
-        exit(EXIT_FAILURE);
+    int fd = open(name, O_RDWR);
+    if (fd == -1) {
+        return I2C_ERROR_OPEN;
     }
+    memset(pFree, 0, sizeof(*pFree));
+    strcpy(pFree->name, name);
+    pFree->fd = fd;
+    pthread_mutex_init(&pFree->lock, NULL);
+    pthread_cond_init(&pFree->pending, NULL);
+    pthread_cond_init(&pFree->completed, NULL);
+    pFree->isRunning = true;
+    pthread_create(&pFree->thread, NULL, &busThread, pFree);
+    *ppBus = pFree;
+    return I2C_OK;
+}
 
-    int i2c_file_desc = open(bus, O_RDWR);
-    if (i2c_file_desc == -1) {
-        printf("I2C DRV: Unable to open bus for read/write (%s)\n", bus);
-        perror("Error is:");
-        exit(EXIT_FAILURE);
+int I2c_open(const char* bus, int address, int priority, const char *name, I2cDevice *pDevice) {
+    if (!isInitialized) {
+        return I2C_ERROR_NOT_INITIALIZED;
     }
 
-    if (ioctl(i2c_file_desc, I2C_SLAVE, address) == -1) {
-        perror("Unable to set I2C device to slave address.");
-        exit(EXIT_FAILURE);
+    pthread_mutex_lock(&busesLock);
+    I2cBus *pBus = NULL;
+    int status = openBus(bus, &pBus);
+    if (status == I2C_OK) {
+        pBus->numDevices++;
+    }
+    pthread_mutex_unlock(&busesLock);
+    if (status != I2C_OK) {
+        return status;
     }
 
-    return i2c_file_desc;
+    memset(pDevice, 0, sizeof(*pDevice));
+    pDevice->pBus = pBus;
+    pDevice->address = address;
+    pDevice->priority = priority;
+    pDevice->name = name;
+    return I2C_OK;
 }
 
-void write_i2c_reg16(int i2c_file_desc, uint8_t reg_addr, uint16_t value) {
-    if (!isInitialized) {
-        perror("Error: Ic2 not initialized!\n");
-        exit(EXIT_FAILURE);
+void I2c_close(I2cDevice *pDevice) {
+    I2cBus *pBus = pDevice->pBus;
+    if (!pBus) {
+        return;
     }
+    pDevice->pBus = NULL;
 
-    int tx_size = 1 + sizeof(value);
-    uint8_t buff[tx_size];
-    buff[0] = reg_addr;
-    buff[1] = (value & 0xFF);
-    buff[2] = (value & 0xFF00) >> 8;
-
-    int bytes_written = write(i2c_file_desc, buff, tx_size);
-    if (bytes_written != tx_size) {
-        perror("Unable to write i2c register");
-        exit(EXIT_FAILURE);
+    pthread_mutex_lock(&busesLock);
+    bool isLast = --pBus->numDevices == 0;
+    if (isLast) {
+        pthread_mutex_lock(&pBus->lock);
+        pBus->isRunning = false;
+        pthread_cond_signal(&pBus->pending);
+        pthread_mutex_unlock(&pBus->lock);
+        pthread_join(pBus->thread, NULL);
+        close(pBus->fd);
+        pthread_cond_destroy(&pBus->pending);
+        pthread_cond_destroy(&pBus->completed);
+        pthread_mutex_destroy(&pBus->lock);
     }
-    sleepForMs(1);
+    pthread_mutex_unlock(&busesLock);
 }
 
-uint16_t read_i2c_reg16(int i2c_file_desc, uint8_t reg_addr) {
-    if (!isInitialized) {
-        perror("Error: Ic2 not initialized!\n");
-        exit(EXIT_FAILURE);
+void I2c_submit(I2cRequest *pRequest) {
+    I2cBus *pBus = pRequest->pDevice->pBus;
+    assert(pBus);
+    pRequest->isDone = false;
+    pRequest->submitNs = getTimeInNs();
+
+    pthread_mutex_lock(&pBus->lock);
+    {
+        while (pBus->numQueued == I2C_MAX_PENDING) {
+            pthread_cond_wait(&pBus->completed, &pBus->lock);
+        }
+        pRequest->sequence = pBus->nextSequence++;
+        pBus->queue[pBus->numQueued++] = pRequest;
+        pthread_cond_signal(&pBus->pending);
     }
+    pthread_mutex_unlock(&pBus->lock);
+}
 
-    int bytes_written = write(i2c_file_desc, &reg_addr, sizeof(reg_addr));
-    if (bytes_written != sizeof(reg_addr)) {
-        perror("Unable to write i2c register.");
-        exit(EXIT_FAILURE);
+int I2c_wait(I2cRequest *pRequest) {
+    I2cBus *pBus = pRequest->pDevice->pBus;
+    pthread_mutex_lock(&pBus->lock);
+    {
+        while (!pRequest->isDone) {
+            pthread_cond_wait(&pBus->completed, &pBus->lock);
+        }
     }
+    pthread_mutex_unlock(&pBus->lock);
+    return pRequest->status;
+}
 
-    uint16_t value = 0;
-    int bytes_read = read(i2c_file_desc, &value, sizeof(value));
-    if (bytes_read != sizeof(value)) {
-        perror("Unable to read i2c register");
-        exit(EXIT_FAILURE);
+// Remove the request to run next: highest priority, then oldest. Called with the
+// bus lock held and at least one request queued.
+static I2cRequest* takeNext(I2cBus *pBus) {
+    int best = 0;
+    for (int i = 1; i < pBus->numQueued; i++) {
+        I2cRequest *pCandidate = pBus->queue[i];
+        I2cRequest *pBest = pBus->queue[best];
+        if (pCandidate->pDevice->priority > pBest->pDevice->priority
+                || (pCandidate->pDevice->priority == pBest->pDevice->priority
+                    && pCandidate->sequence < pBest->sequence)) {
+            best = i;
+        }
     }
+    I2cRequest *pRequest = pBus->queue[best];
+    pBus->queue[best] = pBus->queue[--pBus->numQueued];
+    return pRequest;
+}
 
-    sleepForMs(1);
-    return value;
+static void recordStatistics(I2cDevice *pDevice, int status, double waitInMs, double latencyInMs) {
+    I2cStatistics *pStats = &pDevice->stats;
+    pStats->numTransfers++;
+    if (status < 0) {
+        pStats->numErrors++;
+    }
+    pDevice->totalLatencyInMs += latencyInMs;
+    pStats->avgLatencyInMs = pDevice->totalLatencyInMs / pStats->numTransfers;
+    if (latencyInMs > pStats->maxLatencyInMs) {
+        pStats->maxLatencyInMs = latencyInMs;
+    }
+    if (waitInMs > pStats->maxWaitInMs) {
+        pStats->maxWaitInMs = waitInMs;
+    }
 }
 
-uint8_t read_i2c_reg8(int i2c_file_desc, uint8_t reg_addr) {
-    if (!isInitialized) {
-        perror("Error: I2C not initialized!\n");
-        exit(EXIT_FAILURE);
+static void* busThread(void* args) {
+    I2cBus *pBus = args;
+    Trace_nameThread("i2c");
+    pthread_mutex_lock(&pBus->lock);
+    while (true) {
+        while (pBus->isRunning && pBus->numQueued == 0) {
+            pthread_cond_wait(&pBus->pending, &pBus->lock);
+        }
+        if (pBus->numQueued == 0) {
+            break;
+        }
+        I2cRequest *pRequest = takeNext(pBus);
+        pthread_mutex_unlock(&pBus->lock);
+
+        long long startNs = getTimeInNs();
+        int status = runTransfer(pBus->fd, pRequest->pSegments, pRequest->numSegments);
+        long long endNs = getTimeInNs();
+        Trace_record(pRequest->pDevice->name, startNs, endNs);
+
+        // Finish with the request before handing it back: the handler may reuse it
+        I2c_completionHandler onComplete = pRequest->onComplete;
+        pthread_mutex_lock(&pBus->lock);
+        recordStatistics(pRequest->pDevice, status,
+            (startNs - pRequest->submitNs) / NS_PER_MS, (endNs - pRequest->submitNs) / NS_PER_MS);
+        pRequest->status = status;
+        pRequest->isDone = true;
+        pthread_cond_broadcast(&pBus->completed);
+        if (onComplete) {
+            pthread_mutex_unlock(&pBus->lock);
+            onComplete(pRequest);
+            pthread_mutex_lock(&pBus->lock);
+        }
     }
+    pthread_mutex_unlock(&pBus->lock);
+    return NULL;
+}
 
-    if (write(i2c_file_desc, &reg_addr, 1) != 1) {
-        perror("Unable to write I2C register address.");
-        exit(EXIT_FAILURE);
+I2cStatistics I2c_getStatistics(I2cDevice *pDevice) {
+    I2cStatistics copy = {0};
+    I2cBus *pBus = pDevice->pBus;
+    if (pBus) {
+        pthread_mutex_lock(&pBus->lock);
+        copy = pDevice->stats;
+        pthread_mutex_unlock(&pBus->lock);
     }
+    return copy;
+}
 
-    uint8_t value = 0;
-    
-    if (read(i2c_file_desc, &value, 1) != 1) {
-        perror("Unable to read I2C register.");
-        exit(EXIT_FAILURE);
+int I2c_transfer(I2cDevice *pDevice, I2cSegment *pSegments, int numSegments) {
+    if (!isInitialized) {
+        return I2C_ERROR_NOT_INITIALIZED;
     }
+    if (numSegments < 1 || numSegments > I2C_MAX_SEGMENTS) {
+        return I2C_ERROR_PARAMETER;
+    }
+    I2cRequest request = {
+        .pDevice = pDevice,
+        .pSegments = pSegments,
+        .numSegments = numSegments,
+    };
+    I2c_submit(&request);
+    return I2c_wait(&request);
+}
 
-    sleepForMs(1);
-    return value;
+// Run the segments as one I2C_RDWR ioctl. Bus thread only.
+static int runTransfer(int fd, I2cSegment *pSegments, int numSegments) {
+    if (numSegments < 1 || numSegments > I2C_MAX_SEGMENTS) {
+        return I2C_ERROR_PARAMETER;
+    }
+    struct i2c_msg messages[I2C_MAX_SEGMENTS];
+    for (int i = 0; i < numSegments; i++) {
+        messages[i].addr = pSegments[i].address;
+        messages[i].flags = (pSegments[i].flags & I2C_SEGMENT_READ) ? I2C_M_RD : 0;
+        messages[i].len = pSegments[i].length;
+        messages[i].buf = pSegments[i].buffer;
+    }
+    struct i2c_rdwr_ioctl_data transaction = {
+        .msgs = messages,
+        .nmsgs = numSegments,
+    };
+    if (ioctl(fd, I2C_RDWR, &transaction) < 0) {
+        return I2C_ERROR_TRANSFER;
+    }
+    return I2C_OK;
 }
 
+int I2c_zip(I2cDevice *pDevice, const uint8_t *pCommands, int commandLength,
+            uint8_t *pOutput, int outputLength) {
+    I2cSegment segments[I2C_MAX_SEGMENTS];
+    int numSegments = 0;
+    int inPos = 0;
+    int outPos = 0;
+    uint16_t address = pDevice->address;
+
+    while (inPos < commandLength) {
+        uint8_t command = pCommands[inPos++];
+        if (command == I2C_ZIP_END) {
+            break;
+        }
+        if (inPos >= commandLength) {
+            return I2C_ERROR_PARAMETER;
+        }
+        uint8_t parameter = pCommands[inPos++];
 
+        if (command == I2C_ZIP_ADDRESS) {
+            address = parameter;
+            continue;
+        }
+        I2cSegment *pSegment = &segments[numSegments];
+        pSegment->address = address;
+        pSegment->length = parameter;
+        if (command == I2C_ZIP_READ) {
+            if (outPos + parameter > outputLength) {
+                return I2C_ERROR_PARAMETER;
+            }
+            pSegment->flags = I2C_SEGMENT_READ;
+            pSegment->buffer = pOutput + outPos;
+            outPos += parameter;
+        } else if (command == I2C_ZIP_WRITE) {
+            if (inPos + parameter > commandLength) {
+                return I2C_ERROR_PARAMETER;
+            }
+            // The kernel only reads from write buffers
+            pSegment->flags = I2C_SEGMENT_WRITE;
+            pSegment->buffer = (uint8_t *)(pCommands + inPos);
+            inPos += parameter;
+        } else {
+            return I2C_ERROR_PARAMETER;
+        }
+
+        numSegments++;
+        if (numSegments == I2C_MAX_SEGMENTS) {
+            int status = I2c_transfer(pDevice, segments, numSegments);
+            if (status < 0) {
+                return status;
+            }
+            numSegments = 0;
+        }
+    }
 
-void write_i2c_reg8(int i2c_file_desc, uint8_t reg_addr, uint8_t value) {
-    uint8_t buffer[2] = {reg_addr, value};
-    if (write(i2c_file_desc, buffer, sizeof(buffer)) != sizeof(buffer)) {
-        perror("Error writing to I2C register");
-        exit(EXIT_FAILURE);
+    if (numSegments > 0) {
+        int status = I2c_transfer(pDevice, segments, numSegments);
+        if (status < 0) {
+            return status;
+        }
     }
+    return outPos;
 }
 
-void read_i2c_burst(int i2c_file_desc, uint8_t reg_addr, uint8_t *buffer, int length) {
-    if (!isInitialized) {
-        perror("Error: I2C not initialized!\n");
-        exit(EXIT_FAILURE);
+int I2c_readRegisters(I2cDevice *pDevice, uint8_t reg_addr, uint8_t *buffer, int length) {
+    if (length < 1 || length > UINT16_MAX) {
+        return I2C_ERROR_PARAMETER;
     }
+    I2cSegment segments[2] = {
+        {pDevice->address, I2C_SEGMENT_WRITE, 1, &reg_addr},
+        {pDevice->address, I2C_SEGMENT_READ, length, buffer},
+    };
+    return I2c_transfer(pDevice, segments, 2);
+}
 
-    // Send register address
-    if (write(i2c_file_desc, &reg_addr, 1) != 1) {
-        perror("Unable to write i2c register address.");
-        exit(EXIT_FAILURE);
+int I2c_writeRegisters(I2cDevice *pDevice, uint8_t reg_addr, const uint8_t *buffer, int length) {
+    if (length < 0 || length > I2C_MAX_REGISTER_BYTES) {
+        return I2C_ERROR_PARAMETER;
     }
+    // The register address and the data must be one segment: no restart in between
+    uint8_t message[1 + I2C_MAX_REGISTER_BYTES];
+    message[0] = reg_addr;
+    memcpy(&message[1], buffer, length);
+    I2cSegment segment = {pDevice->address, I2C_SEGMENT_WRITE, 1 + length, message};
+    return I2c_transfer(pDevice, &segment, 1);
+}
+
+int I2c_readReg8(I2cDevice *pDevice, uint8_t reg_addr, uint8_t *pValue) {
+    return I2c_readRegisters(pDevice, reg_addr, pValue, 1);
+}
 
-    // Read multiple bytes from the register
-    if (read(i2c_file_desc, buffer, length) != (ssize_t)length) {
-        perror("Unable to read i2c burst data.");
-        exit(EXIT_FAILURE);
+int I2c_writeReg8(I2cDevice *pDevice, uint8_t reg_addr, uint8_t value) {
+    return I2c_writeRegisters(pDevice, reg_addr, &value, 1);
+}
+
+int I2c_readReg16(I2cDevice *pDevice, uint8_t reg_addr, uint16_t *pValue) {
+    uint8_t buffer[2];
+    int status = I2c_readRegisters(pDevice, reg_addr, buffer, sizeof(buffer));
+    if (status == I2C_OK) {
+        *pValue = buffer[0] | (buffer[1] << 8);
     }
-}
\ No newline at end of file
+    return status;
+}
+
+int I2c_writeReg16(I2cDevice *pDevice, uint8_t reg_addr, uint16_t value) {
+    uint8_t buffer[2] = {value & 0xFF, (value & 0xFF00) >> 8};
+    return I2c_writeRegisters(pDevice, reg_addr, buffer, sizeof(buffer));
+}
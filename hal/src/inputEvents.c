@@ -0,0 +1,149 @@
+/* inputEvents.c
+ *
+ * This file implements the input event bus declared in inputEvents.h.
+ *
+ * Each slot of the ring carries a sequence number. A producer claims the slot for
+ * position pos by advancing enqueuePos with a compare-and-swap, once the slot's
+ * sequence shows it is free (== pos); it then fills the slot and publishes it by
+ * setting the sequence to pos + 1. The consumer takes the slot at dequeuePos once
+ * its sequence is dequeuePos + 1, and frees it for the next lap by setting it to
+ * dequeuePos + INPUT_EVENTS_QUEUE_SIZE.
+ */
+
+#include "hal/inputEvents.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define QUEUE_MASK (INPUT_EVENTS_QUEUE_SIZE - 1)
+
+typedef struct {
+    atomic_uint sequence;
+    InputEvent event;
+} Slot_t;
+
+static bool isInitialized = false;
+static Slot_t slots[INPUT_EVENTS_QUEUE_SIZE];
+static atomic_uint enqueuePos = 0;
+static unsigned int dequeuePos = 0;     // Only touched by the consumer
+static int wakeFd = -1;
+
+static atomic_ullong numPublished = 0;
+static atomic_ullong numDropped = 0;
+
+void InputEvents_init(void)
+{
+    assert(!isInitialized);
+    for (unsigned int i = 0; i < INPUT_EVENTS_QUEUE_SIZE; i++) {
+        atomic_init(&slots[i].sequence, i);
+    }
+    enqueuePos = 0;
+    dequeuePos = 0;
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeFd == -1) {
+        perror("ERROR: Unable to create input event queue");
+        exit(EXIT_FAILURE);
+    }
+    isInitialized = true;
+}
+
+void InputEvents_cleanup(void)
+{
+    assert(isInitialized);
+    close(wakeFd);
+    wakeFd = -1;
+    isInitialized = false;
+}
+
+static void wakeConsumer(void)
+{
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) != sizeof(one)) {
+        // Only fails if the counter would overflow, when the consumer is already due to wake
+    }
+}
+
+bool InputEvents_publish(const InputEvent *pEvent)
+{
+    assert(isInitialized);
+    unsigned int pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+    Slot_t *pSlot;
+    while (true) {
+        pSlot = &slots[pos & QUEUE_MASK];
+        unsigned int sequence = atomic_load_explicit(&pSlot->sequence, memory_order_acquire);
+        int difference = (int)(sequence - pos);
+        if (difference == 0) {
+            // Free: claim it (on failure pos is reloaded)
+            if (atomic_compare_exchange_weak_explicit(&enqueuePos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // Still holds the event from the previous lap: full
+            numDropped++;
+            return false;
+        } else {
+            // Another producer claimed it first
+            pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+        }
+    }
+    pSlot->event = *pEvent;
+    atomic_store_explicit(&pSlot->sequence, pos + 1, memory_order_release);
+    numPublished++;
+    wakeConsumer();
+    return true;
+}
+
+// Copy out the events which are ready, without waiting.
+static int takeEvents(InputEvent *pEvents, int maxEvents)
+{
+    int count = 0;
+    while (count < maxEvents) {
+        Slot_t *pSlot = &slots[dequeuePos & QUEUE_MASK];
+        unsigned int sequence = atomic_load_explicit(&pSlot->sequence, memory_order_acquire);
+        if (sequence != dequeuePos + 1) {
+            break;
+        }
+        pEvents[count++] = pSlot->event;
+        atomic_store_explicit(&pSlot->sequence, dequeuePos + INPUT_EVENTS_QUEUE_SIZE, memory_order_release);
+        dequeuePos++;
+    }
+    return count;
+}
+
+int InputEvents_getFd(void)
+{
+    assert(isInitialized);
+    return wakeFd;
+}
+
+int InputEvents_take(InputEvent *pEvents, int maxEvents)
+{
+    assert(isInitialized);
+    // Reset the fd before taking: a publish after this makes it readable again, so
+    // none is missed. If the oldest slot is claimed but not filled yet, nothing is
+    // taken; its producer makes the fd readable again once it is.
+    uint64_t numWakes;
+    if (read(wakeFd, &numWakes, sizeof(numWakes)) != sizeof(numWakes)) {
+        // Nothing published since the last take (EAGAIN)
+    }
+    int count = takeEvents(pEvents, maxEvents);
+    if (count == maxEvents) {
+        wakeConsumer();     // There may be more: come back for them
+    }
+    return count;
+}
+
+InputEvents_statistics_t InputEvents_getStatistics(void)
+{
+    InputEvents_statistics_t stats = {
+        .numPublished = numPublished,
+        .numDropped = numDropped,
+    };
+    return stats;
+}
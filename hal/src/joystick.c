@@ -3,25 +3,37 @@
 //     It initializes the I2C bus, reads joystick position data from the ADC,
 //     scales the raw values to a normalized range (-1 to 1), and provides a function
 //     to retrieve the current joystick position.
+//
+//     A background sampler thread owns the ADC: it alternates the TLA2024 between
+//     the two channels, and publishes each X/Y pair as one atomic snapshot, so
+//     Joystick_getReading() never touches the I2C bus or blocks. Presses and
+//     changes of direction are also published on the input event bus.
 // */ 
 
 #include "hal/joystick.h"
 #include "hal/i2c.h"
 #include "hal/gpio.h"
-#include "sleep_timer_helper.h"
+#include "hal/inputEvents.h"
 #include <stdbool.h>
 #include <assert.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
 
 #define I2CDRV_LINUX_BUS "/dev/i2c-1"
 #define I2C_DEVICE_ADDRESS 0x48 // ADC chip
 #define REG_CONFIGURATION 0x01
 #define REG_DATA 0x00
+// Configurations are byte-swapped on the wire: 0x83C2 sets the register to 0xC283,
+// i.e. AIN0, +/-4.096V, continuous conversion at 1600SPS
 #define TLA2024_CHANNEL_CONF_0 0x83C2 // Configuration for Y-axis
 #define TLA2024_CHANNEL_CONF_1 0x83D2 // Configuration for X-axis
+#define SAMPLE_PERIOD_NS (10 * NS_PER_MS)   // Both axes every 10ms
+#define CONVERSION_SETTLE_NS 1300000LL      // Two conversions at 1600SPS after a channel switch
+#define SNAPSHOT_SCALE 10000                // Snapshot axes are fixed-point, -1..1 as -10000..10000
 #define X_Y_UP_THRESHOLD 0.7
 #define X_Y_DOWN_THRESHOLD -0.7
 
@@ -29,113 +41,174 @@
 #define GPIO_LINE 15
 struct GpioLine* s_line = NULL;
 
-static int i2c_file_desc = -1;
+static I2cDevice device;
 static bool isInitialized = false;
 static atomic_int page_number = 1;
 
-static pthread_t button_thread;
+static int button_watch = -1;
+static pthread_t sampler_thread;
+// Latest X (high 16 bits) and Y (low 16 bits), each scaled by SNAPSHOT_SCALE
+static atomic_uint snapshot = 0;
 static volatile bool keepReading = false;
 
 static uint16_t x_min = 18, x_max = 1644;
 static uint16_t y_min = 8, y_max = 1635;
 
 //DEBOUNCE
+// The kernel debounces the line when it can; otherwise presses closer together
+// than DEBOUNCE_TIME_MS are ignored here.
+#define KERNEL_DEBOUNCE_US 10000
 #define DEBOUNCE_TIME_MS 100
-static struct timespec last_btn_time;
-void *joystick_button_thread_func(void *arg);
+#define NS_PER_SECOND 1000000000LL
+#define NS_PER_MS 1000000LL
+static long long last_btn_time_ns = 0;
+static bool is_kernel_debounced = false;
+static void joystick_button_on_events(const GpioEvent *pEvents, int numEvents, void *pContext);
+static void *joystick_sampler_thread_func(void *arg);
 
 void Joystick_initialize(void) {
-    s_line = Gpio_openForEvents(GPIO_CHIP, GPIO_LINE);
-    i2c_file_desc = init_i2c_bus(I2CDRV_LINUX_BUS, I2C_DEVICE_ADDRESS);
+    s_line = Gpio_openForDebouncedEvents(GPIO_CHIP, GPIO_LINE, KERNEL_DEBOUNCE_US);
+    is_kernel_debounced = Gpio_isKernelDebounced(s_line);
+    int status = I2c_open(I2CDRV_LINUX_BUS, I2C_DEVICE_ADDRESS, I2C_PRIORITY_LOW, "joystick", &device);
+    if (status != I2C_OK) {
+        fprintf(stderr, "ERROR: Joystick: unable to open %s (%d)\n", I2CDRV_LINUX_BUS, status);
+        exit(EXIT_FAILURE);
+    }
     keepReading = true;
     isInitialized = true;
-    pthread_create(&button_thread, NULL, joystick_button_thread_func, NULL);
+    button_watch = Gpio_watchLines(&s_line, 1, &joystick_button_on_events, NULL);
+    assert(button_watch != -1);
+    pthread_create(&sampler_thread, NULL, joystick_sampler_thread_func, NULL);
 }
 
 void Joystick_cleanUp(void) {
     keepReading = false;
-    pthread_join(button_thread, NULL);
+    Gpio_unwatch(button_watch);
+    pthread_join(sampler_thread, NULL);
     Gpio_close(s_line);
+    I2c_close(&device);
     isInitialized = false;
 }
 
-void *joystick_button_thread_func(void *arg) {
-    (void)arg;
-    assert(isInitialized);
-
-    clock_gettime(CLOCK_MONOTONIC, &last_btn_time);
-
-    while (keepReading) {
-        struct gpiod_line_bulk events;
-        bool buttonFlag = false;
-        
-        int eventCount = Gpio_waitFor1LineChange(s_line, &events);
-        if (eventCount > 0) {
-            struct gpiod_line_event event;
-            struct gpiod_line *line_handle = gpiod_line_bulk_get_line(&events, 0);
-            if (gpiod_line_event_read(line_handle, &event) == -1) {
-                perror("Line Event");
-                exit(EXIT_FAILURE);
-            }
+// Runs on the GPIO reactor thread with each batch of edges on the button line
+static void joystick_button_on_events(const GpioEvent *pEvents, int numEvents, void *pContext) {
+    (void)pContext;
 
-            if (event.event_type == GPIOD_LINE_EVENT_FALLING_EDGE) {
-                buttonFlag = true;
-            }
+    for (int i = 0; i < numEvents; i++) {
+        if (pEvents[i].isRising) {
+            continue;
         }
-
-        struct timespec now;
-        clock_gettime(CLOCK_MONOTONIC, &now);
-
-        if (buttonFlag && time_diff_ms(&last_btn_time, &now) > DEBOUNCE_TIME_MS) {
-            int new_page = atomic_load(&page_number) % 3 + 1;
-            atomic_store(&page_number, new_page);
-            // printf("Button pressed, page number: %d\n", new_page);
-            last_btn_time = now;
+        // Kernel timestamp of the edge, so taps are timed without thread latency
+        long long press_time_ns = pEvents[i].timestampNs;
+        if (is_kernel_debounced || press_time_ns - last_btn_time_ns > DEBOUNCE_TIME_MS * NS_PER_MS) {
+            InputEvent event = {
+                .type = INPUT_EVENT_JOYSTICK_BUTTON,
+                .timestampNs = press_time_ns,
+            };
+            InputEvents_publish(&event);
+            last_btn_time_ns = press_time_ns;
         }
-
-        sleepForMs(10);
     }
-    return NULL;
 }
 
 static double scale_value(double raw, double min, double max) {
     return 2.0 * ((raw - min) / (max - min)) - 1.0;
 }
 
+static JoystickDirection to_direction(double x, double y) {
+    if (x > X_Y_UP_THRESHOLD) return JOYSTICK_RIGHT;
+    if (x < X_Y_DOWN_THRESHOLD) return JOYSTICK_LEFT;
+    if (y > X_Y_UP_THRESHOLD) return JOYSTICK_UP;
+    if (y < X_Y_DOWN_THRESHOLD) return JOYSTICK_DOWN;
+    return JOYSTICK_CENTER;
+}
+
 JoystickDirection getJoystickDirection(void) {
     struct JoystickData data = Joystick_getReading();
-    if (data.x > X_Y_UP_THRESHOLD) return JOYSTICK_RIGHT;
-    if (data.x < X_Y_DOWN_THRESHOLD) return JOYSTICK_LEFT;
-    if (data.y > X_Y_UP_THRESHOLD) return JOYSTICK_UP;
-    if (data.y < X_Y_DOWN_THRESHOLD) return JOYSTICK_DOWN;
-    return JOYSTICK_CENTER;
+    return to_direction(data.x, data.y);
 }
 
-struct JoystickData Joystick_getReading() {
-    if (!isInitialized) {
-        fprintf(stderr, "Error: Joystick not initialized!\n");
-        exit(EXIT_FAILURE);
+// Switch the ADC to a channel, wait for a conversion on it and read the result.
+static bool sample_channel(uint16_t configuration, uint16_t *pPosition) {
+    if (I2c_writeReg16(&device, REG_CONFIGURATION, configuration) != I2C_OK) {
+        return false;
     }
+    struct timespec settle = {0, CONVERSION_SETTLE_NS};
+    nanosleep(&settle, NULL);
+    uint16_t raw;
+    if (I2c_readReg16(&device, REG_DATA, &raw) != I2C_OK) {
+        return false;
+    }
+    // Data is big-endian, left-aligned 12 bits
+    *pPosition = ((raw & 0xFF00) >> 8 | (raw & 0x00FF) << 8) >> 4;
+    return true;
+}
 
-    write_i2c_reg16(i2c_file_desc, REG_CONFIGURATION, TLA2024_CHANNEL_CONF_0);
-    uint16_t raw_y = read_i2c_reg16(i2c_file_desc, REG_DATA);
-    uint16_t y_position = ((raw_y & 0xFF00) >> 8 | (raw_y & 0x00FF) << 8) >> 4;
+static uint16_t to_snapshot_axis(double scaled) {
+    return (uint16_t)(int16_t)(scaled * SNAPSHOT_SCALE);
+}
+
+static double from_snapshot_axis(uint16_t axis) {
+    return (double)(int16_t)axis / SNAPSHOT_SCALE;
+}
 
-    if (y_position < y_min) y_min = y_position;
-    if (y_position > y_max) y_max = y_position;
-    double y_scaled = scale_value(y_position, y_min, y_max) * -1;
+static void *joystick_sampler_thread_func(void *arg) {
+    (void)arg;
+    assert(isInitialized);
 
-    write_i2c_reg16(i2c_file_desc, REG_CONFIGURATION, TLA2024_CHANNEL_CONF_1);
-    uint16_t raw_x = read_i2c_reg16(i2c_file_desc, REG_DATA);
-    uint16_t x_position = ((raw_x & 0xFF00) >> 8 | (raw_x & 0x00FF) << 8) >> 4;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    JoystickDirection last_direction = JOYSTICK_CENTER;
+    while (keepReading) {
+        // Keep the previous snapshot if either channel fails to read
+        uint16_t x_position, y_position;
+        if (sample_channel(TLA2024_CHANNEL_CONF_0, &y_position)
+                && sample_channel(TLA2024_CHANNEL_CONF_1, &x_position)) {
+            if (y_position < y_min) y_min = y_position;
+            if (y_position > y_max) y_max = y_position;
+            double y_scaled = scale_value(y_position, y_min, y_max) * -1;
+
+            if (x_position < x_min) x_min = x_position;
+            if (x_position > x_max) x_max = x_position;
+            double x_scaled = scale_value(x_position, x_min, x_max);
+
+            atomic_store(&snapshot, (unsigned int)to_snapshot_axis(x_scaled) << 16 | to_snapshot_axis(y_scaled));
+
+            JoystickDirection direction = to_direction(x_scaled, y_scaled);
+            if (direction != last_direction) {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                InputEvent event = {
+                    .type = INPUT_EVENT_JOYSTICK_MOVE,
+                    .timestampNs = now.tv_sec * NS_PER_SECOND + now.tv_nsec,
+                    .joystick = {.direction = direction},
+                };
+                InputEvents_publish(&event);
+                last_direction = direction;
+            }
+        }
 
-    if (x_position < x_min) x_min = x_position;
-    if (x_position > x_max) x_max = x_position;
-    double x_scaled = scale_value(x_position, x_min, x_max);
+        // Absolute deadlines, so the period does not stretch by the time spent sampling
+        deadline.tv_nsec += SAMPLE_PERIOD_NS;
+        if (deadline.tv_nsec >= NS_PER_SECOND) {
+            deadline.tv_nsec -= NS_PER_SECOND;
+            deadline.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    }
+    return NULL;
+}
 
+struct JoystickData Joystick_getReading() {
+    if (!isInitialized) {
+        fprintf(stderr, "Error: Joystick not initialized!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned int latest = atomic_load(&snapshot);
     struct JoystickData data = {
-        .x = x_scaled,
-        .y = y_scaled,
+        .x = from_snapshot_axis(latest >> 16),
+        .y = from_snapshot_axis(latest & 0xFFFF),
         .isPressed = false //Handled in button thread
     };
 
@@ -145,3 +218,13 @@ struct JoystickData Joystick_getReading() {
 int Joystick_getPageCount() {
     return page_number;
 }
+
+I2cStatistics Joystick_getBusStatistics(void) {
+    assert(isInitialized);
+    return I2c_getStatistics(&device);
+}
+
+void Joystick_nextPage(void) {
+    int new_page = atomic_load(&page_number) % JOYSTICK_NUM_PAGES + 1;
+    atomic_store(&page_number, new_page);
+}
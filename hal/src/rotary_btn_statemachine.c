@@ -1,38 +1,42 @@
 
 #include "hal/rotary_btn_statemachine.h"
 #include "hal/gpio.h"
-#include "sleep_timer_helper.h"
+#include "hal/inputEvents.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdatomic.h>
-#include <pthread.h>
 
 #define GPIO_CHIP          GPIO_CHIP_0
 #define GPIO_LINE_NUMBER   10
 
-static pthread_t stateMachineThread;
 
 static bool isInitialized = false;
 
 struct GpioLine* s_lineBtn = NULL;
 static atomic_int counter = 1;
-static bool stateMachineRunning = false;
+static atomic_int numValues = 3;
+static int watchId = -1;
 
 //DEBOUNCE
+// The kernel debounces the line when it can; otherwise releases closer together
+// than DEBOUNCE_TIME_MS are ignored here.
+#define KERNEL_DEBOUNCE_US 10000
 #define DEBOUNCE_TIME_MS 100
-static struct timespec last_btn_time;
+#define NS_PER_MS 1000000LL
+static long long last_btn_time_ns = 0;
+static bool isKernelDebounced = false;
 
 //PROTOTYPE
-static void* BtnStateMachine_doState(void* arg);
+static void BtnStateMachine_onEvents(const GpioEvent *pEvents, int numEvents, void *pContext);
 
 /*
     Define the Statemachine Data Structures
 */
 struct stateEvent {
     struct state* pNextState;
-    void (*action)();
+    void (*action)(long long timestampNs);
 };
 struct state {
     struct stateEvent rising;
@@ -40,15 +44,18 @@ struct state {
 };
 
 
-static void on_release(void)
+static void on_release(long long timestampNs)
 {
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-
-    if(time_diff_ms(&last_btn_time, &now) > DEBOUNCE_TIME_MS) {
-        int new_counter = (atomic_load(&counter) + 1) % 3;
+    if(isKernelDebounced || timestampNs - last_btn_time_ns > DEBOUNCE_TIME_MS * NS_PER_MS) {
+        int new_counter = (atomic_load(&counter) + 1) % atomic_load(&numValues);
         atomic_store(&counter, new_counter);
-        last_btn_time = now;
+        last_btn_time_ns = timestampNs;
+        InputEvent event = {
+            .type = INPUT_EVENT_ENCODER_BUTTON,
+            .timestampNs = timestampNs,
+            .button = {.value = new_counter},
+        };
+        InputEvents_publish(&event);
     }
 }
 
@@ -69,16 +76,16 @@ struct state* pCurrentState = &states[0];
 void BtnStateMachine_init()
 {
     assert(!isInitialized);
-    stateMachineRunning = true;
     isInitialized = true;
-    s_lineBtn = Gpio_openForEvents(GPIO_CHIP, GPIO_LINE_NUMBER);
-    pthread_create(&stateMachineThread, NULL, &BtnStateMachine_doState, NULL);
+    s_lineBtn = Gpio_openForDebouncedEvents(GPIO_CHIP, GPIO_LINE_NUMBER, KERNEL_DEBOUNCE_US);
+    isKernelDebounced = Gpio_isKernelDebounced(s_lineBtn);
+    watchId = Gpio_watchLines(&s_lineBtn, 1, &BtnStateMachine_onEvents, NULL);
+    assert(watchId != -1);
 }
 void BtnStateMachine_cleanup()
 {
     assert(isInitialized);
-    stateMachineRunning = false;
-    pthread_join(stateMachineThread, NULL);
+    Gpio_unwatch(watchId);
     Gpio_close(s_lineBtn);
     isInitialized = false;
 }
@@ -93,69 +100,31 @@ void BtnStateMachine_setValue(int value)
     counter = value;
 }
 
-static void* BtnStateMachine_doState(void* arg)
+void BtnStateMachine_setNumValues(int value)
 {
-    (void)arg; // Suppress unused parameter warning
-    assert(isInitialized);
-
-    // printf("\n\nWaiting for an event...\n");
-    while (stateMachineRunning) {
-        struct gpiod_line_bulk bulkEvents;
-        int numEvents = Gpio_waitFor1LineChange(s_lineBtn, &bulkEvents);
-        if (numEvents == -1) {
-            break;  // Exit the loop on failure
-        }
+    assert(value > 0);
+    numValues = value;
+}
 
-        // Iterate over the event
-        for (int i = 0; i < numEvents; i++)
-        {
-            struct gpiod_line *line_handle = gpiod_line_bulk_get_line(&bulkEvents, i);
-
-            // Get the number of this line
-            unsigned int this_line_number = gpiod_line_offset(line_handle);
-
-            // Get the line event
-            struct gpiod_line_event event;
-            if (gpiod_line_event_read(line_handle,&event) == -1) {
-                perror("Line Event");
-                exit(EXIT_FAILURE);
-            }
-
-
-            // Run the state machine
-            bool isRising = event.event_type == GPIOD_LINE_EVENT_RISING_EDGE;
-
-            // Can check with line it is, if you have more than one...
-            bool isBtn = this_line_number == GPIO_LINE_NUMBER;
-            assert (isBtn);
-
-            struct stateEvent* pStateEvent = NULL;
-            if (isRising) {
-                pStateEvent = &pCurrentState->rising;
-            } else {
-                pStateEvent = &pCurrentState->falling;
-            } 
-
-            // Do the action
-            if (pStateEvent->action != NULL) {
-                pStateEvent->action();
-            }
-            pCurrentState = pStateEvent->pNextState;
-
-            // DEBUG INFO ABOUT STATEMACHINE
-            #if 0
-            int newState = (pCurrentState - &states[0]);
-            double time = event.ts.tv_sec + event.ts.tv_nsec / 1000000000.0;
-            printf("State machine Debug: i=%d/%d  line num/dir = %d %8s -> new state %d     [%f]\n", 
-                i, 
-                numEvents,
-                this_line_number, 
-                isRising ? "RISING": "falling", 
-                newState,
-                time);
-            #endif
+// Runs on the GPIO reactor thread with each batch of edges on the button line
+static void BtnStateMachine_onEvents(const GpioEvent *pEvents, int numEvents, void *pContext)
+{
+    (void)pContext; // Suppress unused parameter warning
+
+    for (int i = 0; i < numEvents; i++)
+    {
+        // Run the state machine
+        struct stateEvent* pStateEvent = NULL;
+        if (pEvents[i].isRising) {
+            pStateEvent = &pCurrentState->rising;
+        } else {
+            pStateEvent = &pCurrentState->falling;
+        } 
+
+        // Do the action
+        if (pStateEvent->action != NULL) {
+            pStateEvent->action(pEvents[i].timestampNs);
         }
+        pCurrentState = pStateEvent->pNextState;
     }
-    return NULL;
 }
-
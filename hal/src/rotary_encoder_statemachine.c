@@ -1,136 +1,93 @@
-/* rotary_encoder_statemachine.c 
-* Rotary encoder state machine implementation as discussed in class. Uses state machine to keep track of the rotary encoder value.
+/* rotary_encoder_statemachine.c
+* Rotary encoder quadrature decoder. Keeps track of the levels of lines A and B, and
+* looks up each change of the two levels in a 16-entry transition table.
 */
 #include "hal/rotary_encoder_statemachine.h"
 #include "hal/gpio.h"
+#include "hal/inputEvents.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdatomic.h>
-#include <pthread.h>
 
 #define GPIO_CHIP GPIO_CHIP_2
 #define GPIO_LINE_A 7
 #define GPIO_LINE_B 8
 
+// Both lines are high between detents
+#define REST_STATE 3
+// Quarter-steps in the same direction needed to count a detent; 2 tolerates a
+// missed edge, a full detent is 4.
+#define MIN_QUARTER_STEPS 2
+
+// Velocity estimate: detents further apart than ACCEL_SLOW_NS count 1, detents
+// ACCEL_FAST_NS apart or closer count ROTARY_MAX_ACCELERATION, linear in between.
+#define NS_PER_MS 1000000LL
+#define ACCEL_SLOW_NS (100 * NS_PER_MS)
+#define ACCEL_FAST_NS (20 * NS_PER_MS)
+#define ACCEL_RESET_NS (250 * NS_PER_MS)   // A pause this long starts a new spin
+
 
 static bool isInitialized = false;
 struct GpioLine* s_lineA = NULL;
 struct GpioLine* s_lineB = NULL;
 static atomic_int counter = 0;
-static bool ccwFlag = false;
-static bool cwFlag = false;
-static pthread_t stateMachineThread;
-static volatile bool stateMachineRunning = false;
+static atomic_int acceleratedCounter = 0;
+static int watchId = -1;
 
+// Decoder state, only touched on the GPIO reactor thread
+static int levels = REST_STATE;     // A << 1 | B
+static int quarterSteps = 0;
+static long long lastDetentNs = 0;
+static int lastDirection = 0;
+static long long smoothedIntervalNs = ACCEL_SLOW_NS;
 
-// Function Prototypes 
+
+// Function Prototypes
 void RotaryEncoderStateMachine_init();
 void RotaryEncoderStateMachine_cleanup();
-static void* RotaryEncoderStateMachine_doState(void* arg);
+static void RotaryEncoderStateMachine_onEvents(const GpioEvent *pEvents, int numEvents, void *pContext);
 int RotaryEncoderStateMachine_getValue();
-static void on_clockwise(void);
-static void on_counterclockwise(void);
 
 /*
-    Define the Statemachine Data Structures
+    Transition table, indexed by (previous levels << 2 | new levels).
+    Clockwise (A falls first) runs 3 -> 1 -> 0 -> 2 -> 3 and counts +1 per step;
+    counterclockwise runs the other way. No change, or both lines changing at
+    once (a missed edge), counts 0.
 */
-struct stateEvent {
-    struct state* pNextState;
-    void (*action)();
-};
-struct state {
-    struct stateEvent aRise;
-    struct stateEvent aFall;
-    struct stateEvent bRise;
-    struct stateEvent bFall;
+static const int8_t transitions[16] = {
+    0, -1, +1,  0,
+   +1,  0,  0, -1,
+   -1,  0,  0, +1,
+    0, +1, -1,  0,
 };
 
 
-/*
-    START STATEMACHINE
-*/
-static void reset_flag(void) {
-    cwFlag = false;
-    ccwFlag = false;
-}
-
-static void on_clockwise(void) {
-    if(cwFlag) {
-        counter++;
-        reset_flag();
-    }
-}
-static void on_counterclockwise(void) {
-    if(ccwFlag) {
-        counter--;
-        reset_flag();
-    }
-}
-
-static void track_clockwise(void) {
-    if (cwFlag == false) {
-        cwFlag = true;
-        ccwFlag = false;
-    }
-}
-
-static void track_counterclockwise(void) {
-    if (ccwFlag == false) {
-        ccwFlag = true;
-        cwFlag = false;
-    }
-}
-
-struct state states[] = {
-    { // State 0
-        .aRise = {&states[0], reset_flag},
-        .aFall = {&states[1], track_clockwise},
-        .bRise = {&states[0], reset_flag},
-        .bFall = {&states[3], track_counterclockwise},
-    },
-    { // State 1
-        .aRise = {&states[0], on_counterclockwise},
-        .aFall = {&states[1], NULL},
-        .bRise = {&states[1], NULL},
-        .bFall = {&states[2], NULL},
-    },
-    { // State 2
-        .aRise = {&states[3], NULL},
-        .aFall = {&states[2], NULL},
-        .bRise = {&states[1], NULL},
-        .bFall = {&states[2], NULL},
-    },
-    { // State 3
-        .aRise = {&states[3], NULL},
-        .aFall = {&states[2], NULL},
-        .bRise = {&states[0], on_clockwise},
-        .bFall = {&states[3], NULL},
-    }
-};
-/*
-    END STATEMACHINE
-*/
-
-static struct state* pCurrentState = &states[0];
-
-
 
 void RotaryEncoderStateMachine_init()
 {
     assert(!isInitialized);
     s_lineA = Gpio_openForEvents(GPIO_CHIP, GPIO_LINE_A);
     s_lineB = Gpio_openForEvents(GPIO_CHIP, GPIO_LINE_B);
-    stateMachineRunning = true;
-    pthread_create(&stateMachineThread, NULL, &RotaryEncoderStateMachine_doState, NULL);
+
+    // Start from the actual levels, in case the knob rests between detents
+    int levelA = Gpio_getValue(s_lineA);
+    int levelB = Gpio_getValue(s_lineB);
+    levels = (levelA == -1 || levelB == -1) ? REST_STATE : (levelA << 1 | levelB);
+    quarterSteps = 0;
+    lastDirection = 0;
+
+    struct GpioLine* lines[] = {s_lineA, s_lineB};
+    watchId = Gpio_watchLines(lines, 2, &RotaryEncoderStateMachine_onEvents, NULL);
+    assert(watchId != -1);
     isInitialized = true;
 }
 void RotaryEncoderStateMachine_cleanup()
 {
     assert(isInitialized);
-    stateMachineRunning = false;
-    pthread_join(stateMachineThread, NULL);
+    Gpio_unwatch(watchId);
     Gpio_close(s_lineA);
     Gpio_close(s_lineB);
     isInitialized = false;
@@ -142,78 +99,76 @@ int RotaryEncoderStateMachine_getValue()
     return counter;
 }
 
+int RotaryEncoderStateMachine_getAcceleratedValue(void)
+{
+    assert(isInitialized);
+    return acceleratedCounter;
+}
+
 void RotaryEncoderStateMachine_setValue(int value)
 {
     counter = value;
 }
 
-static void* RotaryEncoderStateMachine_doState(void* arg)
+// How much a detent at timestampNs counts, from the smoothed time between detents.
+static int getAcceleration(int direction, long long timestampNs)
 {
-    (void)arg; // Suppress unused parameter warning
-
-    // printf("\n\nWaiting for an event...\n");
-    while (stateMachineRunning) {
-        struct gpiod_line_bulk bulkEvents;
-        int numEvents = Gpio_waitFor2LineChange(s_lineA, s_lineB, &bulkEvents);
-        if (numEvents == -1) {
-            break;  // Exit the loop on failure
-        }
-
-        // Iterate over the event
-        for (int i = 0; i < numEvents; i++)
-        {
-            // Get the line handle for this event
-            struct gpiod_line *line_handle = gpiod_line_bulk_get_line(&bulkEvents, i);
-
-            // Get the number of this line
-            unsigned int this_line_number = gpiod_line_offset(line_handle);
-
-            // Get the line event
-            struct gpiod_line_event event;
-            if (gpiod_line_event_read(line_handle,&event) == -1) {
-                perror("Line Event");
-                exit(EXIT_FAILURE);
-            }
-
-
-            // Run the state machine
-            bool isRising = event.event_type == GPIOD_LINE_EVENT_RISING_EDGE;
-
-            // Can check with line it is, if you have more than one...
-            bool isA = this_line_number == GPIO_LINE_A;
-            bool isB = this_line_number == GPIO_LINE_B;
+    long long interval = timestampNs - lastDetentNs;
+    lastDetentNs = timestampNs;
+    if (direction != lastDirection || interval > ACCEL_RESET_NS) {
+        lastDirection = direction;
+        smoothedIntervalNs = ACCEL_SLOW_NS;
+        return 1;
+    }
+    smoothedIntervalNs = (3 * smoothedIntervalNs + interval) / 4;
+    if (smoothedIntervalNs >= ACCEL_SLOW_NS) {
+        return 1;
+    }
+    if (smoothedIntervalNs <= ACCEL_FAST_NS) {
+        return ROTARY_MAX_ACCELERATION;
+    }
+    return 1 + (int)((ACCEL_SLOW_NS - smoothedIntervalNs) * (ROTARY_MAX_ACCELERATION - 1)
+        / (ACCEL_SLOW_NS - ACCEL_FAST_NS));
+}
 
-            struct stateEvent* pStateEvent = NULL;
-            if (isA && isRising) {
-                pStateEvent = &pCurrentState->aRise;
-            } else if (isA && !isRising) {
-                pStateEvent = &pCurrentState->aFall;
-            } else if (isB && isRising) {
-                pStateEvent = &pCurrentState->bRise;
-            } else if (isB && !isRising) {
-                pStateEvent = &pCurrentState->bFall;
+// Runs on the GPIO reactor thread with each batch of edges on lines A and B
+static void RotaryEncoderStateMachine_onEvents(const GpioEvent *pEvents, int numEvents, void *pContext)
+{
+    (void)pContext; // Suppress unused parameter warning
+
+    int detents = 0;
+    int acceleratedDetents = 0;
+    for (int i = 0; i < numEvents; i++)
+    {
+        int bit = pEvents[i].lineNumber == GPIO_LINE_A ? 2 : 1;
+        int newLevels = pEvents[i].isRising ? (levels | bit) : (levels & ~bit);
+        quarterSteps += transitions[levels << 2 | newLevels];
+        levels = newLevels;
+
+        // Count a detent when the knob settles back to rest
+        if (levels == REST_STATE) {
+            int direction = 0;
+            if (quarterSteps >= MIN_QUARTER_STEPS) {
+                direction = 1;
+            } else if (quarterSteps <= -MIN_QUARTER_STEPS) {
+                direction = -1;
             }
-
-
-            // Do the action
-            if (pStateEvent && pStateEvent->action) {
-                pStateEvent->action();
+            quarterSteps = 0;
+            if (direction != 0) {
+                detents += direction;
+                acceleratedDetents += direction * getAcceleration(direction, pEvents[i].timestampNs);
             }
-            pCurrentState = pStateEvent ? pStateEvent->pNextState : pCurrentState;
-
-            // DEBUG INFO ABOUT STATEMACHINE
-            #if 0
-            int newState = (pCurrentState - &states[0]);
-            double time = event.ts.tv_sec + event.ts.tv_nsec / 1000000000.0;
-            printf("State machine Debug: i=%d/%d  line num/dir = %d %8s -> new state %d     [%f]\n", 
-                i, 
-                numEvents,
-                this_line_number, 
-                isRising ? "RISING": "falling", 
-                newState,
-                time);
-            #endif
         }
     }
-    return NULL;
+
+    if (detents != 0) {
+        counter += detents;
+        acceleratedCounter += acceleratedDetents;
+        InputEvent event = {
+            .type = INPUT_EVENT_ENCODER,
+            .timestampNs = lastDetentNs,
+            .encoder = {.detents = detents, .acceleratedDetents = acceleratedDetents},
+        };
+        InputEvents_publish(&event);
+    }
 }
@@ -263,7 +263,7 @@ void LCD_1IN54_DisplayWindows(UWORD Xstart, UWORD Ystart, UWORD Xend, UWORD Yend
     UWORD j;
     LCD_1IN54_SetWindows(Xstart, Ystart, Xend , Yend);
     LCD_1IN54_DC_1;
-    for (j = Ystart; j < Yend - 1; j++) {
+    for (j = Ystart; j < Yend; j++) {
         Addr = Xstart + j * LCD_1IN54_WIDTH ;
         DEV_SPI_Write_nByte((uint8_t *)&Image[Addr], (Xend-Xstart)*2);
     }